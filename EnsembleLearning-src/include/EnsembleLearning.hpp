@@ -30,6 +30,8 @@
 #include "EnsembleLearning/Output.hpp"
 #include "EnsembleLearning/Input.hpp"
 #include "EnsembleLearning/Builder.hpp"
+#include "EnsembleLearning/Batch.hpp"
+#include "EnsembleLearning/Scorer.hpp"
 #include "EnsembleLearning/calculation_tree/Factory.hpp"
 
 /** @defgroup UserInterface The user interface of the Ensemble Learning Library.
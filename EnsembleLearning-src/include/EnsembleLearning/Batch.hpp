@@ -0,0 +1,97 @@
+#pragma once
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+#include "EnsembleLearning/Builder.hpp"
+
+#include <omp.h>
+#include <vector>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** Run many independent models at once.
+     *  The models are shared out amongst the threads as the threads become free,
+     *  so a batch of models of differing sizes keeps every thread busy.
+     *  Whilst it runs, each model is updated on a single thread (see Builder::set_parallel,
+     *  which only splits synchronous sweeps and extractions between threads),
+     *  so it is the models, rather than the nodes within them, that run in parallel.
+     *  The models must not share any nodes.
+     *
+     *  Example of use:
+     *  @code
+     *  std::vector<boost::shared_ptr<Builder<double> > > models;
+     *  for(size_t c=0;c<channels;++c){
+     *    boost::shared_ptr<Builder<double> > build(new Builder<double>());
+     *    build->set_quiet();
+     *    //...build the model for channel c
+     *    models.push_back(build);
+     *  }
+     *  std::vector<bool> converged = run_batch(models.begin(), models.end(), 1e-6, 100);
+     *  @endcode
+     *
+     *  @tparam RandomAccessIterator An iterator to pointers (or shared pointers) to Builders.
+     *  @param first The first model.
+     *  @param last One past the last model.
+     *  @param epsilon The convergence criterium passed to Builder::run.
+     *  @param max_iterations The maximum number of iterations passed to Builder::run.
+     *  @param skip The number of iterations to skip passed to Builder::run.
+     *  @param threads The number of threads to use (0 for the OpenMP default).
+     *  @return Whether each model converged, in order.
+     *  @note The set_parallel() setting of each model is restored once it has run.
+     *  @ingroup UserInterface
+     */
+    template<class RandomAccessIterator>
+    std::vector<bool>
+    run_batch(RandomAccessIterator first, 
+	      RandomAccessIterator last,
+	      const double epsilon = 1e-6,
+	      const size_t max_iterations = 100,
+	      const size_t skip = Builder<double>::auto_skip,
+	      const size_t threads = 0)
+    {
+      const long n = last - first;
+      std::vector<char> converged(n, 0);
+      const int team = threads == 0 ? omp_get_max_threads() : int(threads);
+	
+#pragma omp parallel for schedule(dynamic, 1) num_threads(team)
+      for(long i=0;i<n;++i){
+	const bool parallel = (*(first+i))->is_parallel();
+	(*(first+i))->set_parallel(false);
+	converged[i] = (*(first+i))->run(epsilon, max_iterations, skip);
+	(*(first+i))->set_parallel(parallel);
+      }
+      
+      return std::vector<bool>(converged.begin(), converged.end());
+    }
+    
+  }
+}
+
+#endif  // guard for BATCH_HPP
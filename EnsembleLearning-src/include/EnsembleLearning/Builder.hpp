@@ -29,13 +29,26 @@
 
 //node definitions required so inheritence relationship available to user.
 #include "EnsembleLearning/node/variable/Hidden.hpp"
+#include "EnsembleLearning/node/variable/Plate.hpp"
 #include "EnsembleLearning/node/variable/Observed.hpp"
 #include "EnsembleLearning/node/variable/Calculation.hpp"
+//exceptions thrown to the user
+#include "EnsembleLearning/exception/IncompatibleState.hpp"
+#include "EnsembleLearning/exception/IncompatibleLanes.hpp"
+#include "EnsembleLearning/exception/IncompatibleGraph.hpp"
+//reporting of the cost
+#include "EnsembleLearning/monitor/CostLogger.hpp"
+//distributed inference
+#include "EnsembleLearning/distributed/Reducer.hpp"
+//concurrent construction
+#include "EnsembleLearning/detail/ChildStaging.hpp"
 
 
 #include <boost/shared_ptr.hpp>
 #include <vector>
 #include <string>
+#include <set>
+#include <map>
 
 
 namespace ICR{
@@ -57,13 +70,19 @@ namespace ICR{
     namespace detail{
       template<template<class> class Model, class T> class Factor;
       template<class Model, class T> class Mixture;
+      template<class T> class Shortlist;
       template<template<class> class Model, class T> class Deterministic;
+      template<template<class> class Model, class T> class Plate;
+      template<class T> class DiscretePlate;
+      template<class Model, class T> class MixturePlate;
+      template<template<class> class Model, class T> class InstancePlate;
     }
 
 
     //forward declaration of Expressions
     template<class T> class Expression;
     template<class T> class Context;
+    template<class T> class ExpressionFactory;
     
 
     /** Build the components for ensemble learning.
@@ -127,6 +146,17 @@ namespace ICR{
      */
 
 
+    /** A struct containing the methods that can accelerate the convergence of Builder::run.
+     */
+    struct Acceleration{
+      /** An enumeration of the methods. */
+      enum Value{
+	NONE,            //<!-- Plain sweeps (the default).
+	OVER_RELAXATION, //<!-- Adaptive over-relaxation.
+	SQUAREM          //<!-- Squared extrapolation (SQUAREM).
+      };
+    };
+
     template<class T>
     class Builder
     {
@@ -140,6 +170,11 @@ namespace ICR{
       typedef detail::Mixture<Gaussian<T>, T >     GaussianMixtureFactor;
 
       typedef detail::Deterministic<Gaussian, T >  DeterministicFactor;
+      typedef detail::Plate<Gaussian, T >       GaussianPlateFactor;
+      typedef detail::Plate<Gamma, T >          GammaPlateFactor;
+      typedef detail::DiscretePlate<T >         DiscretePlateFactor;
+      typedef detail::MixturePlate<Gaussian<T>, T >  GaussianMixturePlateFactor;
+      typedef detail::InstancePlate<Gaussian, T >    GaussianInstancePlateFactor;
 
       typedef HiddenNode<Gaussian, T >      GaussianType;
       typedef HiddenNode<RectifiedGaussian, T >      RectifiedGaussianType;
@@ -152,10 +187,57 @@ namespace ICR{
       typedef ObservedNode<Gaussian, T >   NormalConstType;
       typedef ObservedNode<Dirichlet, T >  DirichletConstType;
       typedef DeterministicNode<Gaussian<T>, T>    GaussianResultType;
-
+      typedef HiddenPlate<Gaussian, T >     GaussianPlateType;
+      typedef HiddenPlate<Discrete, T >     CatagoryPlateType;
+
+      //Order the calculations by their expression and context.
+      typedef std::pair<Expression<T>*, const Context<T>*> CalculationKey;
+      struct CalculationOrder
+      {
+	bool
+	operator()(const CalculationKey& a, const CalculationKey& b) const
+	{
+	  if (a.first != b.first) return a.first < b.first;
+	  return *a.second < *b.second;
+	}
+      };
       
       typedef HiddenNode<Dirichlet, T >     WeightsType;
       typedef HiddenNode<Discrete, T >      CatagoryType;
+
+      //The components of the mixtures sharing a weights node,
+      // the nodes that belong to each component and those that are still active.
+      struct MixtureComponents
+      {
+	boost::shared_ptr<std::vector<size_t> > active;
+	std::vector<std::set<VariableNode<T>*> > nodes;
+	boost::shared_ptr<detail::Shortlist<T> > shortlist;
+      };
+      //The nodes and factors made by one thread while building concurrently.
+      struct Staging
+      {
+	Staging() : nodes(), factors(), data_nodes(0) {}
+	std::vector<boost::shared_ptr<VariableNode<T> > > nodes;
+	std::vector<boost::shared_ptr<FactorNode<T> > > factors;
+	size_t data_nodes;
+      };
+      //Nodes that are pruned when a precision (for example an ARD prior) becomes large.
+      struct PrecisionRule
+      {
+	HiddenNode<Gamma, T >* precision;
+	std::vector<VariableNode<T>*> nodes;
+	bool pruned;
+      };
+      //The concrete types of the nodes that the builder makes,
+      // so that the sweep can update each without a virtual call.
+      struct NodeKind
+      {
+	enum Value {
+	  GAUSSIAN, RECTIFIED_GAUSSIAN, GAMMA, DIRICHLET, DISCRETE,
+	  GAUSSIAN_DATA, GAMMA_DATA, DIRICHLET_CONST,
+	  OTHER
+	};
+      };
     public:
       
       /** @name Useful typdefs for types that are exposed to the user.
@@ -170,6 +252,7 @@ namespace ICR{
       typedef ObservedNode<Gaussian, T >* GaussianConstNode;
       typedef ObservedNode<Gamma, T >*    GammaConstNode;
       typedef DeterministicNode<Gaussian<T>, T>*    GaussianResultNode;
+      typedef HiddenPlate<Gaussian, T >*     GaussianPlateNode;
       
       typedef HiddenNode<Dirichlet, T >*      WeightsNode;
       typedef HiddenNode<Discrete, T >*       CatagoryNode;
@@ -314,6 +397,25 @@ namespace ICR{
       gaussian_mixture( std::vector<Variable>& vMean, 
 		        std::vector<Variable>& vPrecision, 
 		       WeightsNode Weights);
+
+      /** A plate of Gaussian Mixture Models.
+       *  This models count independent draws from the mixture, exactly as calling gaussian_mixture() count times would,
+       *  but the draws and their responsibilities are each held by one node (a HiddenPlate),
+       *  and the messages to the components are summed over the plate by one factor.
+       *  @param vMean The vector container containing all the  variables representing the means.
+       *  @param vPrecision The vector container containing all the  variables representing the precisions.
+       *  @param Weights A Weights variable that stores the weights to the means and precisions in vMean and vPrecision.
+       *  @param count The number of draws.
+       *  @attention The size of vMean and vPrecision must be identical, 
+       *   and must be the same as the size of the Weights Node.
+       *   The plate does not truncate the responsibilities (see set_mixture_truncation()).
+       * @return The GaussianPlateNode that holds the inferred Gaussian Moments of every draw.
+       */
+      GaussianPlateNode
+      gaussian_mixture( std::vector<Variable>& vMean, 
+		        std::vector<Variable>& vPrecision, 
+		        WeightsNode Weights,
+		        const size_t count);
 	
 
   
@@ -416,6 +518,9 @@ namespace ICR{
        *  @param context The explicit Context (the actual nodes involved) in
        *  which the calculation takes place.
        *  @return The GaussianResultsNode that holds the calculated Moments.
+       *  A calculation of the same expression in the same context is only made once:
+       *  later calls return the same node, 
+       *  whose children then send a single (summed) message back through the expression.
        */
       GaussianResultNode
       calc_gaussian(Expression<T>* Expr,  Context<T>& context);
@@ -489,6 +594,35 @@ namespace ICR{
       void 
       join(Variable Mean, GammaNode Precision, const T data );
 
+      /** Join a plate of Gaussian data with the mean and precision.
+       *  This models each value independently, exactly as calling join() for each value would,
+       *  but the whole plate is held by one node and one factor 
+       *  whose messages are summed in a single step.
+       *  @param Mean The VariableNode that models the mean.
+       *  @param Precision The VariableNode that models the Precision.
+       *  @param data The values of the data.
+       */
+      void 
+      join(Variable Mean, GammaNode Precision, const std::vector<T>& data );
+
+      /** Join a plate of Gamma data with the shape and inverse scale.
+       *  @param shape The (constant) shape.
+       *  @param IScale The VariableNode that models the inverse scale.
+       *  @param data The values of the data.
+       *  @see join(Variable, GammaNode, const std::vector<T>&)
+       */
+      void 
+      join(T& shape, GammaNode IScale, const std::vector<T>& data );
+
+      /** Join a plate of Gaussian data to a plate of means, one value to each instance.
+       *  @param Mean The plate of means (see gaussian_mixture(std::vector<Variable>&, std::vector<Variable>&, WeightsNode, const size_t)).
+       *  @param Precision The VariableNode that models the Precision common to every value.
+       *  @param data The values of the data.
+       *  @attention The size of data must be the number of instances in the Mean plate.
+       */
+      void 
+      join(GaussianPlateNode Mean, GammaNode Precision, const std::vector<T>& data );
+
 
       /** Join Gaussian Modelled data to a mixture model.
        *  @param vMean The vector of VariableNode's that models the mean's of the Gaussian Mixture.
@@ -513,6 +647,22 @@ namespace ICR{
 	    std::vector<Variable>& vPrecision, 
 	    WeightsNode Weights,
 	    const T data );
+
+      /** Join a plate of Gaussian Modelled data to a mixture model.
+       *  This models each value independently, exactly as calling join() for each value would,
+       *  but the data and the responsibilities are each held by one node,
+       *  and the messages to the components are summed over the plate by one factor.
+       *  @param vMean The vector of VariableNode's that models the mean's of the Gaussian Mixture.
+       *  @param vPrecision The vector of VariableNode's that models the  Precision to each Gaussian in the mixture.
+       *  @param Weights The Weights node that stores the weights.
+       *  @param data The values of the data.
+       *  @attention The plate does not truncate the responsibilities (see set_mixture_truncation()).
+       */
+      void
+      join( std::vector<Variable>& vMean, 
+	    std::vector<Variable>& vPrecision, 
+	    WeightsNode Weights,
+	    const std::vector<T>& data );
 	
    /** Join Gaussian Modelled data to a mixture model.
        *  @param MeanBegin The iterator at the beginning of the the container containing all the  variables representing the means.
@@ -540,6 +690,101 @@ namespace ICR{
       void
       set_cost_file(const std::string& cost_file);
 
+      /** Stop (or restart) printing the cost to the console.
+       *  @param quiet If true nothing is printed while running.
+       */
+      void
+      set_quiet(const bool quiet = true);
+
+      /** Update the nodes of the model in parallel (the default) or one after another.
+       *  Only synchronous sweeps (see set_synchronous()) are split between threads,
+       *  using the backend of the PARALLEL_* algorithms (see set_parallel_backend()).
+       *  Turn this off when many models are run at once, for example by run_batch(),
+       *  so that the threads are spent on the models rather than within them.
+       *  @param parallel If false the nodes are updated on the calling thread.
+       */
+      void
+      set_parallel(const bool parallel = true);
+
+      /** Whether the nodes of the model are updated in parallel (see set_parallel()).
+       *  @return True if synchronous sweeps and extractions are split between threads.
+       */
+      bool
+      is_parallel() const;
+
+      /** Update the nodes synchronously (a Jacobi sweep) or as soon as each is ready (the default).
+       *  In a synchronous sweep every node is updated from the moments of the previous sweep,
+       *  each into its own second buffer, and the buffers are swapped once the sweep is over.
+       *  No locks are taken on the moments and the result (and the cost) 
+       *  does not depend upon the number of threads or the order that the nodes are updated in.
+       *  It can take more iterations to converge than the default, 
+       *  which updates the nodes one after another on the calling thread.
+       *  Distributed runs (see set_reducer()) are always asynchronous.
+       *  @param synchronous If true the nodes are updated synchronously.
+       */
+      void
+      set_synchronous(const bool synchronous = true);
+
+      /** Sweep the nodes in an order that keeps neighbouring nodes together.
+       *  The nodes are otherwise updated in the order they were built, 
+       *  which for a large model interleaves unrelated parts of the graph.
+       *  The new order is a reverse Cuthill-McKee ordering of the graph in which 
+       *  two nodes are adjacent when they share a factor, 
+       *  so that consecutive updates (and so the range given to each thread) 
+       *  mostly read the same few nodes.
+       *  Nodes shared by a large part of the model (such as a noise precision) 
+       *  are placed but not followed, as they would join everything together.
+       *  The order is worked out before the next sweep, and again whenever nodes are added.
+       *  It changes the path of an asynchronous run but not its fixed points.
+       *  Distributed runs (see set_reducer()) keep their own order.
+       *  @param reorder If true the nodes are reordered.
+       */
+      void
+      set_reordering(const bool reorder = true);
+
+      /** Accelerate the convergence of run().
+       *  Between sweeps the natural parameters of the hidden nodes are extrapolated 
+       *  along the direction that the sweeps are moving them in.
+       *  Adaptive over-relaxation steps further by a factor that grows while the bound improves,
+       *  SQUAREM extrapolates from every pair of sweeps.
+       *  If the bound is worse after the sweep from an extrapolated point
+       *  the plain sweep is restored (and the over-relaxation is reset),
+       *  so the model converges to the same fixed point as the plain sweeps.
+       *  Nodes for which the extrapolation is not a valid distribution keep the plain update.
+       *  @param method The method to use.
+       */
+      void
+      set_acceleration(const Acceleration::Value method = Acceleration::OVER_RELAXATION);
+
+      /** Evaluate the bound in run() only every few sweeps.
+       *  The cost of a node takes nearly as long to work out as its update,
+       *  so by default (an interval of one) it is evaluated in every sweep.
+       *  With a longer interval the sweeps in between only update the nodes
+       *  and the largest relative change in a natural parameter is tracked instead.
+       *  The bound is evaluated in a separate pass (split between threads for a synchronous sweep)
+       *  every interval sweeps, or as soon as the largest change falls below the given change.
+       *  The convergence test then compares bounds that are several sweeps apart.
+       *  Accelerated runs (see set_acceleration()) need the bound after every sweep 
+       *  and ignore this setting.
+       *  @param interval The number of sweeps between evaluations of the bound.
+       *  @param change Evaluate the bound early once no natural parameter changes by more than this.
+       */
+      void
+      set_bound_interval(const size_t interval, const double change = 1e-4);
+
+      /** Add a destination for the cost records made during run().
+       *  The records are written by a background thread, so the sink never holds up the inference.
+       *  @param sink The sink, for example a FileSink, RingBufferSink or CallbackSink.
+       */
+      void
+      add_sink(const boost::shared_ptr<CostSink>& sink);
+
+      /** Remove a sink that was added with add_sink.
+       *  @param sink The sink to remove.
+       */
+      void
+      remove_sink(const boost::shared_ptr<CostSink>& sink);
+
       /** The number of variable nodes in the model.
        *  @return The number of variable nodes used in the model.
        */
@@ -551,26 +796,350 @@ namespace ICR{
        */
       size_t
       number_of_factors() const;
+
+      /** The number of iterations made so far.
+       *  This includes iterations restored with load_state.
+       *  @return The number of iterations made on the model.
+       */
+      size_t
+      number_of_iterations() const;
+
+      /** The history of the cost (per data point) over the run.
+       *  @return One entry for every convergence check made by run().
+       */
+      const std::vector<double>&
+      cost_history() const;
+
+      /** An estimate of the sweeps saved by the acceleration (see set_acceleration()).
+       *  Each extrapolation is counted as the number of plain sweeps that would move as far,
+       *  less the sweeps spent on it (including the sweeps that were rejected).
+       *  @return The estimated number of iterations saved.
+       */
+      double
+      iterations_saved() const;
       
       ///@}
+
+      /** @name Save and restore the inferred state.
+       */
+      ///@{
+
+      /** Save the state of the model to a binary file.
+       *  The moments of every node are written in the order that the nodes were created,
+       *  along with the number of iterations and the cost history.
+       *  The layout is versioned and records the data type (float or double),
+       *  so that it can be checked when it is read back in.
+       *  @param filename The file in which to save the state.
+       */
+      void
+      save_state(const std::string& filename) const;
+
+      /** Restore the state of the model from a binary file written by save_state.
+       *  The model must have been built in exactly the same way as the model that was saved
+       *  (the nodes are identified by the order in which they were created).
+       *  The run may then be resumed, or used as a warm start, by calling run().
+       *  @param filename The file from which to read the state.
+       *  @throw Exception::IncompatibleState If the file was not written by an identically structured model of the same data type.
+       */
+      void
+      load_state(const std::string& filename);
+
+      /** Save the state periodically during run().
+       *  @param filename The file in which to save the state.
+       *   If the filename is blank (the default) then no checkpoints are made.
+       *  @param interval The number of iterations between checkpoints.
+       */
+      void
+      set_checkpoint_file(const std::string& filename, const size_t interval = 10);
+
+      ///@}
+
+      /** @name Save and reload the built model.
+       */
+      ///@{
+
+      /** Save the graph of the model to a binary file.
+       *  The type and moments of every node, the nodes joined by every factor, 
+       *  the expressions of the calculations (as postfix programs) and the number of data points are written,
+       *  so that the model can be reloaded by load_graph() without being built again.
+       *  Nodes and expressions are referred to by their index in the file,
+       *  and every entry is a 64 bit word, so that the file can be read in place once it is mapped.
+       *  The partitions, the pruned components and the settings of the builder are not saved.
+       *  @param filename The file in which to save the graph.
+       *  @throw Exception::IncompatibleGraph If the model contains a node or factor that the builder did not make.
+       */
+      void
+      save_graph(const std::string& filename) const;
+
+      /** Load a model from a binary file written by save_graph.
+       *  The file is memory mapped and the nodes and factors are made straight from it,
+       *  in the order in which they were saved.
+       *  The nodes (and the factors) of each type are counted first and built in place in one allocation for the type.
+       *  Every node is then given all of its children at once, and the saved moments,
+       *  rather than being initialised as the factors are joined to it.
+       *  The expressions are rebuilt by factories that belong to the builder.
+       *  The builder must be empty, the nodes of the model can then be found with node().
+       *  @param filename The file from which to read the graph.
+       *  @throw Exception::IncompatibleGraph If the file is not a graph of the same data type and version,
+       *   or if the builder is not empty.
+       */
+      void
+      load_graph(const std::string& filename);
+
+      /** A node of the model.
+       *  @param i The index of the node, in the order that the nodes were created 
+       *   (which is the order in which they are saved and loaded).
+       *  @return The node.
+       */
+      Variable
+      node(const size_t i) const;
+
+      ///@}
+
+      /** @name Extract the inferred posteriors.
+       *  The values of many nodes are written to contiguous buffers in one (parallel) pass,
+       *  from the moments found in the last sweep.
+       */
+      ///@{
+
+      /** Extract the means and variances of a set of nodes.
+       *  The values are those of Mean() and StandardDeviation() (squared),
+       *  but for the Gaussian, RectifiedGaussian and Discrete nodes they are worked out from the moments,
+       *  rather than from the messages of the adjacent nodes, and so are not allocated.
+       *  (The variances of the Gamma and Dirichlet nodes, and the means of the Dirichlet nodes,
+       *  can not be found from their moments and are worked out as Mean() and StandardDeviation() do.)
+       *  @param nodes The nodes.
+       *  @param mean The mean of every node is written here (there must be room for nodes.size() values).
+       *  @param variance If this is not zero, the variance of every node is written here.
+       *  @param index The index of the mean (as for Mean(), only the Dirichlet nodes and the plates have more than one).
+       */
+      void
+      extract_posteriors(const std::vector<Variable>& nodes, T* mean, T* variance = 0, const size_t index = 0) const;
+
+      /** Extract the moments of a set of nodes.
+       *  @param nodes The nodes.
+       *  @param moments The moments of each node are written here in turn
+       *   (there must be room for two for every node, other than the Discrete and Dirichlet nodes,
+       *    which have a moment for each component, and the plates, which have the moments of each instance).
+       */
+      void
+      extract_moments(const std::vector<Variable>& nodes, T* moments) const;
+
+      ///@}
+
+      /** @name Concurrent construction.
+       *  A large model can be built by several threads at once.
+       *  Between begin_concurrent() and end_concurrent() each thread keeps the nodes and factors that it makes,
+       *  and the child factors that it gives to existing nodes, to itself,
+       *  so the threads do not wait on each other.
+       *  They are merged, in the order of the threads, when the construction ends.
+       *  With a static schedule the model is therefore the one that would have been built by a single thread,
+       *  except for the random initial moments of the nodes made by the other threads
+       *  (each thread draws from its own generator, see Random::Split()).
+       *
+       *  Example of use:
+       *  @code
+       *  Build.begin_concurrent();
+       *  #pragma omp parallel for schedule(static)
+       *  for(long i=0;i<long(data.size());++i) 
+       *    Build.join(Mean, Precision, data[i]);
+       *  Build.end_concurrent();
+       *  @endcode
+       *  @attention Only the functions that make nodes and join them may be called concurrently, 
+       *   and the nodes they make are not counted (or saved) until the construction ends.
+       */
+      ///@{
+
+      /** Start building the model concurrently.
+       *  This must be called outside of a parallel region,
+       *  which may have no more than the default number of threads (omp_get_max_threads()).
+       */
+      void
+      begin_concurrent();
+
+      /** Finish building the model concurrently and merge the nodes made by the threads.
+       *  This is called by run() if need be.
+       */
+      void
+      end_concurrent();
+
+      ///@}
       
       
+      /** @name Distributed inference.
+       *  The model can be spread over several processes (for example with MPI).
+       *  Every process builds the same global nodes (in the same order), 
+       *  but only its own share of the data, between begin_partition() and end_partition().
+       *  Each iteration the processes update the nodes in their partition, 
+       *  sum the messages that the partitions send to the global nodes with the Reducer (once per iteration),
+       *  and then update the global nodes identically.
+       *  @attention Calculation nodes that feed the partitioned data must be created inside the partition.
+       */
+      ///@{
+
+      /** Set the reducer that sums the messages over the processes.
+       *  @param reducer The reducer, for example an MPIReducer.
+       */
+      void
+      set_reducer(const boost::shared_ptr<Reducer>& reducer);
+
+      /** Start the partition of the model that belongs to this process.
+       *  All the nodes and factors that are created until end_partition() 
+       *  are local to this process.
+       */
+      void
+      begin_partition();
+
+      /** End the partition of the model that belongs to this process.
+       */
+      void
+      end_partition();
+
+      ///@}
+      
       /** @name Run the inference.
        */
       ///@{
       
+      /** Work out the warm up of run() from the graph. */
+      static const size_t auto_skip = size_t(-1);
+
       /** Run the inference.
+       *  The initial moments are random, 
+       *  so the cost means little until they have been flushed through the graph.
+       *  By default (auto_skip) a model that has not been run yet is warmed up 
+       *  with two ordered passes over the nodes:
+       *  from the roots of the graph to the leaves (so that every node is updated after its parents)
+       *  and back again (after its children).
+       *  The depth of each node is worked out from the factors, however deep the graph is,
+       *  and the cost is trusted from the first sweep after the passes.
+       *  The passes are counted as two iterations.
        *  @param epsilon The percentage difference in the cost (per data point) for convergence.
        *    The model will stop running once the increase in the cost reduced to this threshold.
        *  @param max_iterations The maximum number of iterations.
        *   The model will stop running once this number of iterations has been surpassed.
-       *  @param skip Skip n iterations at the beginning while the initial moments are getting flushed.  This value should be the span of the graph.
+       *  @param skip Skip n iterations at the beginning while the initial moments are getting flushed,
+       *   or auto_skip to warm the model up from the depth of the graph.
        *  @return Whether the convergance criterium was met.  
        *   If false, then the number of iterations exceeded the maximum.
        *  
        */
       bool
-      run(const double& epsilon = 1e-6, const size_t& max_iterations = 100, size_t skip = 1);
+      run(const double& epsilon = 1e-6, const size_t& max_iterations = 100, size_t skip = auto_skip);
+
+      /** Run several models with the same structure in lockstep.
+       *  The models (the lanes) must have been built in the same way, 
+       *  typically the same model fitted to different channels or with different priors.
+       *  Each iteration the lanes that are still running are split into a block for each thread
+       *  (the threads are started once for all the lanes).
+       *  Each thread makes one pass over the compiled sweep (see run()),
+       *  updating the node in every lane of its block before moving onto the next node,
+       *  so the nodes of each lane are updated in order, as in run().
+       *  Each lane checks its own convergence and is dropped from the pass once it has converged.
+       *  The lanes must not share any nodes.
+       *  Every lane is swept plainly: 
+       *  lanes that accelerate (set_acceleration()), evaluate the bound lazily (set_bound_interval()) 
+       *  or prune (set_pruning()) must be run with run() or run_batch() instead.
+       *  @param lanes The models.
+       *  @param epsilon The convergence criterium for each lane (as in run()).
+       *  @param max_iterations The maximum number of iterations.
+       *  @param skip The number of iterations to skip at the beginning
+       *   (or auto_skip to warm each lane up as in run()).
+       *  @return Whether each lane converged.
+       *  @throw Exception::IncompatibleLanes If the lanes do not have the same number of nodes and factors,
+       *   or any of them is distributed, synchronous (see set_synchronous()), accelerated, lazy or pruned.
+       */
+      static
+      std::vector<bool>
+      run_lanes(const std::vector<Builder<T>*>& lanes,
+		const double epsilon = 1e-6, 
+		const size_t max_iterations = 100, 
+		const size_t skip = auto_skip);
+
+      /** Truncate the responsibilities of the mixtures built from now on.
+       *  Each data point is only assigned to its keep most responsible components 
+       *  (the responsibilities are renormalised over them),
+       *  and the remaining components are skipped by the messages that its mixture factor sends
+       *  to the child and to the parameters of the components.
+       *  The factor of each point keeps the components and their responsibilities, 
+       *  and the mass of the ones it dropped.
+       *  Before every sweep a shortlist of twice keep components is drawn up for each mixture: 
+       *  the keep with the largest expected weights and a window of the others that moves on each sweep.
+       *  A point only works out the expected log likelihood of the shortlist and of the components it kept the sweep before
+       *  (all of them the first time),
+       *  so the cost of choosing its components does not grow with the number of components.
+       *  (The responsibilities of a point are still passed to its catagory node as one value for every component.)
+       *  This is a (small) approximation.
+       *  @param keep The number of components to keep for each data point (zero to keep them all).
+       */
+      void
+      set_mixture_truncation(const size_t keep);
+
+      /** Prune the parts of the model that have been switched off.
+       *  After every check of the convergence made by run(),
+       *  the mixture components whose expected weight 
+       *  (the exponential of the average log weight) falls below weight are pruned:
+       *  the mixture factors no longer loop over them 
+       *  and the nodes that belong only to them are no longer updated.
+       *  Nodes registered with prune_with() are pruned 
+       *  once the expected value of their precision exceeds precision.
+       *  The cost of a pruned node is held at its value when it was pruned.
+       *  Pruning is not applied to distributed models or by run_lanes().
+       *  @param weight The expected weight below which a mixture component is pruned (zero to never prune).
+       *  @param precision The expected precision above which the nodes registered with prune_with() are pruned.
+       *  @param verify If true the pruned nodes are restored once the pruned model has converged
+       *    and run() carries on with the full model, so that the final cost is exact.
+       *    Otherwise the pruned nodes stay pruned.
+       */
+      void
+      set_pruning(const double weight = 1e-3, 
+		  const double precision = 1e4, 
+		  const bool verify = true);
+
+      /** Prune some nodes when a precision becomes large (see set_pruning()).
+       *  For example the nodes of a source in ICA when the precision of its mixing column
+       *  (an automatic relevance determination prior) switches it off.
+       *  @param Precision The precision node.  It is pruned with the nodes.
+       *  @param nodes The nodes to prune.
+       */
+      void
+      prune_with(GammaNode Precision, const std::vector<Variable>& nodes);
+
+      /** The number of variable nodes that are currently pruned.
+       *  @return The number of pruned nodes.
+       */
+      size_t
+      number_of_pruned_nodes() const;
+
+      /** Run the model from several starting points and keep the best.
+       *  Restart zero is this model, from its current moments.
+       *  The others are copies of its graph (made with save_graph() and load_graph(), 
+       *  through a temporary file) with the same settings and moments drawn afresh from their parents 
+       *  (as perturb() does).
+       *  Every round the restarts that are still running are advanced together by run_batch(),
+       *  so that they run concurrently, each on a single thread.
+       *  After every round the restarts whose cost (per data point) 
+       *  is more than abandon percent behind the best are abandoned.
+       *  When every restart has converged, reached max_iterations or been abandoned
+       *  the best of them is left in the model, with its cost history and what it has pruned (see set_pruning()).
+       *  number_of_iterations() counts the sweeps of every restart.
+       *  This is not suitable for a distributed model.
+       *  @param restarts The number of restarts (at least one).
+       *  @param epsilon The convergence criterium passed to run().
+       *  @param max_iterations The maximum number of iterations of each restart.
+       *  @param skip The number of iterations each restart makes before the convergence is checked
+       *   (or auto_skip to warm each up from the depth of the graph, see run()).
+       *  @param round The number of iterations each restart is advanced by before they are compared.
+       *  @param abandon The percentage of the best cost that a restart may fall behind by.
+       *  @return True if the best restart converged.
+       */
+      bool
+      run_restarts(const size_t restarts,
+		   const double epsilon = 1e-6, 
+		   const size_t max_iterations = 100, 
+		   const size_t skip = auto_skip,
+		   const size_t round = 5,
+		   const double abandon = 1.0);
 
       /** Reset all the moments based on their parents current variables.
        *  @attention This is an experimental feature,
@@ -581,9 +1150,92 @@ namespace ICR{
       
       ///@}
     private:
+      void
+      clone_restart(Builder<T>& restart, const std::map<VariableNode<T>*, size_t>& index) const;
+      void
+      adopt_restart(const Builder<T>& restart, const std::map<VariableNode<T>*, size_t>& index);
       double
       iterate();
 
+      void
+      distribute();
+
+      double
+      iterate_distributed();
+      double
+      iterate_synchronous();
+      bool 
+      reject_extrapolation(const double Cost);
+      void
+      extrapolate(const double Cost);
+      void
+      stack_natural_parameters(std::vector<double>& stack);
+      void
+      set_natural_parameters(const std::vector<double>& stack);
+      void
+      refresh_synchronous();
+      void
+      reset_acceleration();
+      boost::shared_ptr<std::vector<size_t> >
+      mixture_components(WeightsNode Weights, 
+			 const std::vector<Variable>& vMean, 
+			 const std::vector<Variable>& vPrecision);
+      boost::shared_ptr<detail::Shortlist<T> >
+      mixture_shortlist(WeightsNode Weights, const size_t keep);
+      void
+      refresh_shortlists();
+      void
+      prune();
+      void
+      freeze(const std::set<VariableNode<T>*>& nodes);
+      void
+      unprune();
+      const std::vector<boost::shared_ptr<VariableNode<T> > >&
+      sweep_nodes() const;
+      void
+      collect_unpruned();
+      void
+      reorder();
+      void
+      compile_sweep();
+      template<class Operation>
+      void
+      sweep_node(const std::ptrdiff_t i, const Operation& op);
+      void
+      sweep_node_synchronous(const std::ptrdiff_t i);
+      static
+      void
+      sweep_lanes(const std::vector<Builder<T>*>& lanes, const std::vector<size_t>& begin,
+		  std::vector<Coster>& costs, const std::ptrdiff_t b);
+      void
+      update_node_synchronous(const std::ptrdiff_t i);
+      void
+      evaluate_node_synchronous(const std::ptrdiff_t i);
+      double
+      update();
+      double
+      evaluate_bound();
+      void
+      swap_moments();
+      void
+      warm_up();
+      typename detail::ChildStaging<T>::Links*
+      staged_links();
+      void
+      add_node(const boost::shared_ptr<VariableNode<T> >& node);
+      void
+      add_factor(const boost::shared_ptr<FactorNode<T> >& factor);
+      void
+      add_data_nodes(const size_t count);
+      void
+      link_staged_children();
+      void
+      extract_posterior(const std::vector<Variable>& nodes, T* mean, T* variance, 
+			const size_t index, const std::ptrdiff_t i) const;
+      void
+      extract_node_moments(const std::vector<Variable>& nodes, const std::vector<size_t>& offset, 
+			   T* moments, const std::ptrdiff_t i) const;
+
       bool
       HasConverged(const T Cost, const T epsilon);
       
@@ -591,9 +1243,61 @@ namespace ICR{
       T m_PrevCost;
       std::vector<boost::shared_ptr<FactorNode<T> > > m_Factors;
       std::vector<boost::shared_ptr<VariableNode<T> > > m_Nodes;
+      std::map<CalculationKey, GaussianResultNode, CalculationOrder> m_calculations;
       bool m_initialised;
       size_t m_data_nodes;
       std::string m_cost_file;
+      size_t m_iterations;
+      std::vector<double> m_cost_history;
+      std::string m_checkpoint_file;
+      size_t m_checkpoint_interval;
+      boost::shared_ptr<CostLogger> m_logger;
+      boost::shared_ptr<CostSink> m_console_sink;
+      boost::shared_ptr<CostSink> m_file_sink;
+      double m_start_time;
+      bool m_parallel;
+      bool m_synchronous;
+      size_t m_synchronous_nodes;
+      std::vector<Coster> m_node_costs;
+      Acceleration::Value m_acceleration;
+      bool m_extrapolated;
+      double m_accepted_cost;
+      double m_relaxation;
+      size_t m_squarem_step;
+      std::vector<double> m_theta0, m_theta1, m_theta_plain;
+      double m_iterations_saved;
+      double m_prune_weight;
+      double m_prune_precision;
+      bool m_verify_pruning;
+      std::map<WeightsNode, MixtureComponents> m_mixtures;
+      std::vector<PrecisionRule> m_precision_rules;
+      std::set<VariableNode<T>*> m_pruned;
+      std::vector<boost::shared_ptr<VariableNode<T> > > m_unpruned_nodes;
+      double m_pruned_cost;
+      bool m_reorder;
+      std::vector<boost::shared_ptr<VariableNode<T> > > m_sweep;
+      std::vector<VariableNode<T>*> m_compiled;
+      std::vector<typename NodeKind::Value> m_kinds;
+      size_t m_compiled_nodes;
+      bool m_compiled_valid;
+      size_t m_bound_interval;
+      double m_bound_change;
+      std::vector<double> m_node_changes;
+      size_t m_mixture_truncation;
+      boost::shared_ptr<Reducer> m_reducer;
+      bool m_partitioning;
+      size_t m_partition_begin;
+      std::set<VariableNode<T>*> m_partitioned_nodes;
+      std::set<FactorNode<T>*> m_partitioned_factors;
+      size_t m_partition_factor_begin;
+      bool m_distributed;
+      std::vector<VariableNode<T>*> m_local_nodes;
+      std::vector<VariableNode<T>*> m_global_nodes;
+      std::vector<VariableNode<T>*> m_reduced_nodes;
+      bool m_concurrent;
+      std::vector<Staging> m_staging;
+      typename detail::ChildStaging<T>::Links m_staged_links;
+      std::vector<boost::shared_ptr<ExpressionFactory<T> > > m_graph_expressions;
     };
 
   }
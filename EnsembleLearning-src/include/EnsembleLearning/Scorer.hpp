@@ -0,0 +1,481 @@
+#pragma once
+#ifndef SCORER_HPP
+#define SCORER_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+#include "EnsembleLearning/Builder.hpp"
+//nodes
+#include "EnsembleLearning/node/variable/Hidden.hpp"
+//models
+#include "EnsembleLearning/exponential_model/Gaussian.hpp"
+#include "EnsembleLearning/exponential_model/RectifiedGaussian.hpp"
+//algorithms
+#include "EnsembleLearning/detail/parallel_algorithms.hpp"
+
+#include <boost/assert.hpp>
+#include <omp.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    //forward declaration
+    template<template<class> class Model, class T>
+    class SourceScorer;
+    
+    /** Score new data against a mixture model that has been inferred.
+     *  The posteriors of the means, precisions and weights of the mixture are taken when the scorer is made,
+     *  so that the global nodes are frozen.
+     *  New data is then scored without building any nodes or changing the model:
+     *  the responsibilities of the components (the posterior of the Catagory node that Builder::join would have made)
+     *  and the evidence of each datum are evaluated in one pass that allocates no memory.
+     *
+     *  Example of use:
+     *  @code
+     *  Builder<double> Build;
+     *  //...build the mixture with Build.join(vMean, vPrecision, Weights, data[i]) and run it
+     *  MixtureScorer<Gaussian, double> Scorer(vMean, vPrecision, Weights);
+     *  std::vector<double> responsibilities(new_data.size()*Scorer.size()), evidence(new_data.size());
+     *  Scorer.score(&new_data[0], new_data.size(), &responsibilities[0], &evidence[0]);
+     *  @endcode
+     *
+     *  @tparam Model The model of the mixture (Gaussian or RectifiedGaussian).
+     *  @tparam T The data type (float or double).
+     *  @attention The scorer does not see any later changes to the model, make a new one after running it again.
+     *  @ingroup UserInterface
+     */
+    template<template<class> class Model, class T>
+    class MixtureScorer
+    {
+    public:
+      typedef typename Builder<T>::Variable    Variable;
+      typedef typename Builder<T>::GammaNode   GammaNode;
+      typedef typename Builder<T>::WeightsNode WeightsNode;
+
+      /** A constructor.
+       *  @param vMean The variables that model the means of the components.
+       *  @param vPrecision The variables that model the precisions of the components.
+       *  @param Weights The Weights node that stores the weights.
+       *  @attention The size of vMean and vPrecision must be identical, 
+       *   and must be the same as the size of the Weights Node.
+       */
+      MixtureScorer(const std::vector<Variable>& vMean, 
+		    const std::vector<Variable>& vPrecision, 
+		    WeightsNode Weights);
+
+      /** A constructor.
+       *  @param vMean The variables that model the means of the components.
+       *  @param Precision The variable that models the common precision of the components.
+       *  @param Weights The Weights node that stores the weights.
+       *  @attention The size of vMean must be the same as the size of the Weights Node.
+       */
+      MixtureScorer(const std::vector<Variable>& vMean, 
+		    GammaNode Precision, 
+		    WeightsNode Weights);
+
+      /** The number of components in the mixture. */
+      size_t
+      size() const {return m_log_weight.size();}
+
+      /** Score a datum.
+       *  @param datum The value of the datum.
+       *  @param responsibilities Set to the responsibility of each component (unless it is 0).
+       *  @return The evidence of the datum (its contribution to the cost).
+       */
+      T
+      score(const T datum, 
+	    T* responsibilities = 0) const;
+
+      /** Score a batch of data.
+       *  The data is scored in parallel.
+       *  @param data The n data.
+       *  @param n The number of data.
+       *  @param responsibilities Set to the responsibilities of each datum in turn,
+       *   size() of them a datum (unless it is 0).
+       *  @param evidence Set to the evidence of each datum (unless it is 0).
+       */
+      void
+      score(const T* data, 
+	    const size_t n,
+	    T* responsibilities,
+	    T* evidence = 0) const;
+
+    private:
+      friend class SourceScorer<Model, T>;
+
+      void
+      add_component(const Variable Mean, const Variable Precision, const T log_weight);
+      
+      /* The log evidence of a child with the moments (first, second).
+       * Optionally sets the responsibilities and the natural parameters of the message to the child,
+       * averaged over the responsibilities.
+       */
+      T
+      evaluate(const T first, 
+	       const T second,
+	       T* responsibilities,
+	       T* NP0 = 0,
+	       T* NP1 = 0) const;
+
+      //For each component, the log of the weight, the message to the child and the log norm.
+      std::vector<T> m_log_weight, m_NP0, m_NP1, m_log_norm;
+    };
+
+    /** Infer the sources of new samples from an ICA model (or any linear model) that has been inferred.
+     *  The model of each channel n of a sample x is
+     *  @f[ x_n = \sum_m A_{nm} s_m + \mu_n + \mbox{noise}_n, @f]
+     *  with a mixture for each source s_m.
+     *  The mixing matrix A, the noise means and precisions and the mixtures of the sources are frozen
+     *  when the scorer is made, and only the sources (and their responsibilities) of the new samples are inferred.
+     *  This is the update Builder::run would make for a new sample if the global nodes did not change.
+     *  The samples are independent and are scored in parallel, 
+     *  each with a workspace that is allocated with the scorer.
+     *
+     *  Example of use:
+     *  @code
+     *  std::vector<MixtureScorer<Gaussian, double> > priors;
+     *  for(size_t m=0;m<M;++m){
+     *    priors.push_back(MixtureScorer<Gaussian, double>(SourceMean[m], SourcePrecision[m], SourceWeights[m]));
+     *  }
+     *  SourceScorer<Gaussian, double> Scorer(A, priors, NoisePrecision, NoiseMean);
+     *  Scorer.score(&samples[0], samples.size()/N, &sources[0], &evidence[0]);
+     *  @endcode
+     *
+     *  @tparam Model The model of the sources (Gaussian or RectifiedGaussian).
+     *  @tparam T The data type (float or double).
+     *  @attention A scorer must not be used by several threads at once (it has one workspace for each thread of a call),
+     *   copy it for each thread instead.
+     *  @ingroup UserInterface
+     */
+    template<template<class> class Model, class T>
+    class SourceScorer
+    {
+    public:
+      typedef typename Builder<T>::Variable Variable;
+
+      /** A constructor.
+       *  @param mixing The variables that model the N by M mixing matrix A, in row major order.
+       *  @param sources The mixtures of the M sources.
+       *  @param noise_precision The variables that model the precision of the noise on each of the N channels.
+       *  @param noise_mean The variables that model the mean of the noise on each of the N channels
+       *   (empty if the noise has zero mean).
+       *  @param max_iterations The maximum number of updates of the sources of a sample.
+       *  @param epsilon The sources of a sample have converged when no mean changes by more than epsilon (relative to 1 + the mean).
+       */
+      SourceScorer(const std::vector<Variable>& mixing,
+		   const std::vector<MixtureScorer<Model, T> >& sources,
+		   const std::vector<Variable>& noise_precision,
+		   const std::vector<Variable>& noise_mean = std::vector<Variable>(),
+		   const size_t max_iterations = 100,
+		   const T epsilon = 1e-6);
+
+      /** The number of channels (N) in a sample. */
+      size_t
+      channels() const {return m_channels;}
+      
+      /** The number of sources (M) in a sample. */
+      size_t
+      sources() const {return m_sources;}
+
+      /** Infer the sources of a batch of samples.
+       *  @param data The n samples, channels() values a sample.
+       *  @param n The number of samples.
+       *  @param sources Set to the posterior mean of the sources of each sample in turn, sources() of them a sample.
+       *  @param evidence Set to the evidence of each sample (unless it is 0).
+       */
+      void
+      score(const T* data,
+	    const size_t n,
+	    T* sources,
+	    T* evidence = 0) const;
+      
+    private:
+      
+      T
+      score_sample(const T* x, T* s, T* workspace) const;
+
+      size_t m_channels, m_sources;
+      //The moments of the mixing matrix (row major) and the noise.
+      std::vector<T> m_A, m_A2, m_noise_precision, m_noise_mean, m_noise_mean2;
+      std::vector<MixtureScorer<Model, T> > m_priors;
+      //The second natural parameter of the message from the data to each source,
+      //and the message from each prior before the responsibilities are known.
+      std::vector<T> m_data_NP1, m_prior_NP0, m_prior_NP1;
+      size_t m_max_iterations;
+      T m_epsilon;
+      //A workspace for each thread.
+      size_t m_threads;
+      mutable std::vector<T> m_workspace;
+    };
+
+  }
+}
+
+template<template<class> class Model, class T>
+ICR::EnsembleLearning::MixtureScorer<Model,T>::MixtureScorer(const std::vector<Variable>& vMean, 
+							     const std::vector<Variable>& vPrecision, 
+							     WeightsNode Weights)
+  : m_log_weight(), m_NP0(), m_NP1(), m_log_norm()
+{
+  BOOST_ASSERT(vMean.size() == vPrecision.size());
+  BOOST_ASSERT(vMean.size() == Weights->size());
+  //The moments of the Weights node are the log of the weights.
+  const Moments<T>& weights = Weights->GetMoments();
+  for(size_t i=0;i<vMean.size();++i){
+    add_component(vMean[i], vPrecision[i], weights[i]);
+  }
+}
+
+template<template<class> class Model, class T>
+ICR::EnsembleLearning::MixtureScorer<Model,T>::MixtureScorer(const std::vector<Variable>& vMean, 
+							     GammaNode Precision, 
+							     WeightsNode Weights)
+  : m_log_weight(), m_NP0(), m_NP1(), m_log_norm()
+{
+  BOOST_ASSERT(vMean.size() == Weights->size());
+  const Moments<T>& weights = Weights->GetMoments();
+  for(size_t i=0;i<vMean.size();++i){
+    add_component(vMean[i], Precision, weights[i]);
+  }
+}
+
+template<template<class> class Model, class T>
+inline
+void
+ICR::EnsembleLearning::MixtureScorer<Model,T>::add_component(const Variable Mean, 
+							     const Variable Precision, 
+							     const T log_weight)
+{
+  //The same message and log norm as the mixture factor sends to its child.
+  const NaturalParameters<T> NP = Model<T>::CalcNP2Data(Mean->GetMoments(), Precision->GetMoments());
+  m_log_weight.push_back(log_weight);
+  m_NP0.push_back(NP[0]);
+  m_NP1.push_back(NP[1]);
+  m_log_norm.push_back(Model<T>::CalcLogNorm(Mean->GetMoments(), Precision->GetMoments()));
+}
+
+template<template<class> class Model, class T>
+inline
+T
+ICR::EnsembleLearning::MixtureScorer<Model,T>::evaluate(const T first, 
+							const T second,
+							T* responsibilities,
+							T* NP0,
+							T* NP1) const
+{
+  //The log of the sum of the exponents, kept scaled by the largest exponent seen so far.
+  T largest = -std::numeric_limits<T>::infinity();
+  T sum = 0, sum0 = 0, sum1 = 0;
+  for(size_t i=0;i<m_log_weight.size();++i){
+    const T exponent = m_log_weight[i] + m_NP0[i]*first + m_NP1[i]*second + m_log_norm[i];
+    if (exponent > largest) {
+      const T scale = std::exp(largest - exponent);
+      sum  *= scale;
+      sum0 *= scale;
+      sum1 *= scale;
+      largest = exponent;
+    }
+    const T w = std::exp(exponent - largest);
+    sum  += w;
+    sum0 += w*m_NP0[i];
+    sum1 += w*m_NP1[i];
+  }
+  const T log_evidence = largest + std::log(sum);
+
+  if (NP0 != 0) *NP0 = sum0/sum;
+  if (NP1 != 0) *NP1 = sum1/sum;
+  if (responsibilities != 0) {
+    for(size_t i=0;i<m_log_weight.size();++i){
+      const T exponent = m_log_weight[i] + m_NP0[i]*first + m_NP1[i]*second + m_log_norm[i];
+      responsibilities[i] = std::exp(exponent - log_evidence);
+    }
+  }
+  return log_evidence;
+}
+
+template<template<class> class Model, class T>
+inline
+T
+ICR::EnsembleLearning::MixtureScorer<Model,T>::score(const T datum, 
+						     T* responsibilities) const
+{
+  return evaluate(datum, datum*datum, responsibilities);
+}
+
+template<template<class> class Model, class T>
+void
+ICR::EnsembleLearning::MixtureScorer<Model,T>::score(const T* data, 
+						     const size_t n,
+						     T* responsibilities,
+						     T* evidence) const
+{
+  const size_t K = size();
+#pragma omp parallel for schedule(static) if(detail::go_parallel(n, ParallelSettings::get().minimal_size))
+  for(long i=0;i<long(n);++i){
+    const T e = evaluate(data[i], data[i]*data[i], responsibilities == 0 ? 0 : responsibilities + i*K);
+    if (evidence != 0) evidence[i] = e;
+  }
+}
+
+template<template<class> class Model, class T>
+ICR::EnsembleLearning::SourceScorer<Model,T>::SourceScorer(const std::vector<Variable>& mixing,
+							   const std::vector<MixtureScorer<Model, T> >& sources,
+							   const std::vector<Variable>& noise_precision,
+							   const std::vector<Variable>& noise_mean,
+							   const size_t max_iterations,
+							   const T epsilon)
+  : m_channels(noise_precision.size()),
+    m_sources(sources.size()),
+    m_A(mixing.size()),
+    m_A2(mixing.size()),
+    m_noise_precision(m_channels),
+    m_noise_mean(m_channels, 0),
+    m_noise_mean2(m_channels, 0),
+    m_priors(sources),
+    m_data_NP1(m_sources, 0),
+    m_prior_NP0(m_sources),
+    m_prior_NP1(m_sources),
+    m_max_iterations(max_iterations),
+    m_epsilon(epsilon),
+    m_threads(omp_get_max_threads()),
+    m_workspace()
+{
+  BOOST_ASSERT(mixing.size() == m_channels*m_sources);
+  BOOST_ASSERT(noise_mean.empty() || noise_mean.size() == m_channels);
+  for(size_t n=0;n<m_channels;++n){
+    m_noise_precision[n] = noise_precision[n]->GetMoments()[0];
+    if (!noise_mean.empty()) {
+      m_noise_mean[n]  = noise_mean[n]->GetMoments()[0];
+      m_noise_mean2[n] = noise_mean[n]->GetMoments()[1];
+    }
+    for(size_t m=0;m<m_sources;++m){
+      m_A[n*m_sources+m]  = mixing[n*m_sources+m]->GetMoments()[0];
+      m_A2[n*m_sources+m] = mixing[n*m_sources+m]->GetMoments()[1];
+      m_data_NP1[m] -= 0.5*m_noise_precision[n]*m_A2[n*m_sources+m];
+    }
+  }
+  //Before a source is known its prior is weighted by the weights alone (a source with zero moments).
+  for(size_t m=0;m<m_sources;++m){
+    m_priors[m].evaluate(0, 0, 0, &m_prior_NP0[m], &m_prior_NP1[m]);
+  }
+  //The residual of the channels, and the second moment, the prior message and the posterior of the sources.
+  m_workspace.resize(m_threads*(m_channels + 5*m_sources));
+}
+
+template<template<class> class Model, class T>
+void
+ICR::EnsembleLearning::SourceScorer<Model,T>::score(const T* data,
+						    const size_t n,
+						    T* sources,
+						    T* evidence) const
+{
+  const size_t stride = m_channels + 5*m_sources;
+  const int threads = detail::go_parallel(n, ParallelSettings::get().minimal_sweep) 
+    ? int(std::min<size_t>(omp_get_max_threads(), m_threads)) : 1;
+#pragma omp parallel for schedule(static) num_threads(threads)
+  for(long i=0;i<long(n);++i){
+    T* workspace = &m_workspace[omp_get_thread_num()*stride];
+    const T e = score_sample(data + i*m_channels, sources + i*m_sources, workspace);
+    if (evidence != 0) evidence[i] = e;
+  }
+}
+
+template<template<class> class Model, class T>
+T
+ICR::EnsembleLearning::SourceScorer<Model,T>::score_sample(const T* x, T* s, T* workspace) const
+{
+  const size_t N = m_channels, M = m_sources;
+  T* residual = workspace;
+  T* s2       = residual + N;
+  T* prior0   = s2 + M;
+  T* prior1   = prior0 + M;
+  T* NP0      = prior1 + M;
+  T* NP1      = NP0 + M;
+
+  //Start from sources with zero moments.
+  for(size_t n=0;n<N;++n){
+    residual[n] = x[n] - m_noise_mean[n];
+  }
+  std::fill(s, s+M, T(0));
+  std::fill(s2, s2+M, T(0));
+  std::copy(m_prior_NP0.begin(), m_prior_NP0.end(), prior0);
+  std::copy(m_prior_NP1.begin(), m_prior_NP1.end(), prior1);
+
+  for(size_t iteration=0;iteration<m_max_iterations;++iteration){
+    bool converged = true;
+    for(size_t m=0;m<M;++m){
+      //The message from the data, with the residual excluding this source.
+      T data_NP0 = 0;
+      for(size_t n=0;n<N;++n){
+	const T a = m_A[n*M+m];
+	data_NP0 += m_noise_precision[n]*a*(residual[n] + a*s[m]);
+      }
+      NP0[m] = prior0[m] + data_NP0;
+      NP1[m] = prior1[m] + m_data_NP1[m];
+      T first, second;
+      Model<T>::CalcMoments(NP0[m], NP1[m], first, second);
+      
+      for(size_t n=0;n<N;++n){
+	residual[n] -= m_A[n*M+m]*(first - s[m]);
+      }
+      if (std::fabs(first - s[m]) > m_epsilon*(1 + std::fabs(first)))
+	converged = false;
+      s[m]  = first;
+      s2[m] = second;
+      //Update the responsibilities of the source.
+      m_priors[m].evaluate(s[m], s2[m], 0, &prior0[m], &prior1[m]);
+    }
+    if (converged) 
+      break;
+  }
+  
+  //The evidence, as it would be added to the cost by the nodes of the sample.
+  double evidence = 0;
+  for(size_t n=0;n<N;++n){
+    T variance = m_noise_mean2[n] - m_noise_mean[n]*m_noise_mean[n];
+    for(size_t m=0;m<M;++m){
+      const T a = m_A[n*M+m];
+      variance += m_A2[n*M+m]*s2[m] - a*a*s[m]*s[m];
+    }
+    const T mean = x[n] - residual[n];
+    const T beta = m_noise_precision[n];
+    evidence += beta*mean*x[n] - 0.5*beta*x[n]*x[n] + Gaussian<T>::CalcLogNorm(mean, mean*mean + variance, beta);
+  }
+  for(size_t m=0;m<M;++m){
+    const T precision = -2.0*NP1[m];
+    const T mean = NP0[m]/precision;
+    evidence += m_priors[m].evaluate(s[m], s2[m], 0)
+      - NP0[m]*s[m] - NP1[m]*s2[m] - Model<T>::CalcLogNorm(mean, mean*mean, precision);
+  }
+  return T(evidence);
+}
+
+#endif  // guard for SCORER_HPP
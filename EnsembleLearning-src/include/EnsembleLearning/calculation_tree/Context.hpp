@@ -29,9 +29,11 @@
 
 //From this lib
 #include "EnsembleLearning/node/Node.hpp"
+#include "EnsembleLearning/exception/IncompatiblePlaceholder.hpp"
 
 //From boost
 #include <boost/call_traits.hpp>
+#include <boost/assert.hpp>
 
 #include <omp.h>
 #include <iostream>
@@ -41,6 +43,7 @@ namespace ICR{
   namespace EnsembleLearning {
     //Forward declaration.
     template<class> class Placeholder;
+    template<class> class ExpressionFactory;
     
     //Forward declaration.
     namespace detail{
@@ -108,6 +111,21 @@ namespace ICR{
 
       ///@}
 
+      /** Constructor.
+       *  @param size The number of placeholders in the expression
+       *   (the largest placeholder id + 1).
+       */
+      explicit
+      SubContext(size_t size = 0)
+	: m_context_data(size)
+      {}
+
+      /** The number of values stored.
+       *  @return The largest placeholder id assigned + 1.
+       */
+      size_t
+      size() const {return m_context_data.size();}
+
       /** Obtain the value associated with for the placeholder.
        *   @param P The placeholder.
        *   @return A value taken from the moment of the Variable node represented by P.
@@ -225,6 +243,13 @@ namespace ICR{
       size_parameter;
       
       ///@}
+
+      /** Constructor */
+      Context()
+	: m_map(),
+	  m_size(0),
+	  m_factory(0)
+      {}
       
       /** Obtain the placeholder associated  with a particular VariableNoder.
        *   @param V The VariableNode.
@@ -236,6 +261,8 @@ namespace ICR{
       /** Assign a placeholder a VariableNode.
        *  @param P The Placeholder.
        *  @param V The VariableNode 
+       *  @throws Exception::IncompatiblePlaceholder If P is from a different ExpressionFactory
+       *   to the placeholders already in the context.
        */
       void 
       Assign(placeholder_parameter P, 
@@ -265,7 +292,9 @@ namespace ICR{
       {
 	//Defer thread safety to the variable
 	// (m_map not being altered here)
-	SubContext<T> c;
+	//The placeholder ids are dense within their factory, 
+	// so the subcontext is exactly the size of the expression.
+	SubContext<T> c(m_size);
 	for(typename DataContainer::const_iterator it = m_map.begin();
 	    it != m_map.end();
 	    ++it)
@@ -276,6 +305,20 @@ namespace ICR{
 	return c;
       }
 
+      /** Compare two contexts.
+       *  @param other The other context.
+       *  @return True if both assign the same placeholders to the same variables.
+       */
+      bool
+      operator==(const Context<T>& other) const {return m_map == other.m_map;}
+
+      /** Order two contexts (so that they can be used as a key).
+       *  @param other The other context.
+       *  @return True if this context comes before the other.
+       */
+      bool
+      operator<(const Context<T>& other) const {return m_map < other.m_map;}
+
       /** Output the Context to a stream. 
        *  @param c The context.
        *  @param out The output stream.
@@ -307,6 +350,9 @@ namespace ICR{
 	  }
       }
       mutable DataContainer m_map;
+      size_t m_size;
+      //The factory of the placeholders (their ids are only unique within it).
+      const ExpressionFactory<T>* m_factory;
     };
 
 
@@ -383,28 +429,10 @@ void
 ICR::EnsembleLearning::SubContext<T>::Assign(placeholder_parameter P, 
 				data_parameter V)
 {
-  typedef std::map<placeholder_t,data_t> DataContainer;
-  typedef std::pair<placeholder_t,data_t> Datum;
-      
-  typename DataContainer::iterator it;
-  std::pair<typename DataContainer::iterator,bool> ret;
-
-  //make sure not trying to assign to things at once.
-#pragma omp critical
-  {
-    if (P->id()<m_context_data.size())
-      m_context_data[P->id()] = V;
-    else
-      {
-	m_context_data.resize(P->id()+1);
-	m_context_data[P->id()] = V;
-      }
-    // ret = m_map.insert( Datum(P, V) );
-    // if (ret.second == false) //already exists
-    //   {
-    // 	ret.first->second = V;
-    //   }
-  }
+  //A subcontext is local to the thread that made it, so no lock is needed.
+  if (P->id()>=m_context_data.size())
+    m_context_data.resize(P->id()+1);
+  m_context_data[P->id()] = V;
 }
 
 
@@ -441,16 +469,27 @@ ICR::EnsembleLearning::Context<T>::Assign(placeholder_parameter P,
 			     variable_parameter  V )
 {
   std::pair<typename DataContainer::iterator,bool> ret;
+  bool compatible = true;
 
   //make sure not trying to assign to things at once.
 #pragma omp critical
   {
-    ret = m_map.insert( Datum ( V,P) );
-    if (ret.second == false) //already exists
-      {
-	ret.first->second = P;
-      }
+    //Placeholders from different factories could share an id.
+    if (m_map.empty())
+      m_factory = P->factory();
+    compatible = P->factory() == m_factory;
+    if (compatible) {
+      ret = m_map.insert( Datum ( V,P) );
+      if (ret.second == false) //already exists
+	{
+	  ret.first->second = P;
+	}
+      if (P->id() >= m_size)
+	m_size = P->id()+1;
+    }
   }
+  if (!compatible)
+    throw Exception::IncompatiblePlaceholder();
 }
 
 #endif
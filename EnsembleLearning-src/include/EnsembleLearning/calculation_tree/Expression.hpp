@@ -30,6 +30,7 @@
 
 
 #include <boost/call_traits.hpp>
+#include <vector>
 
 namespace ICR{
 
@@ -62,6 +63,19 @@ namespace ICR{
 	TIMES, //<!-- Mutliplication function specifier.
       };
     };
+
+    /** A struct containing the codes of a postfix program.
+     *  An expression is written out as a postfix program (see Expression::Postfix)
+     *  so that it can be saved and rebuilt.
+     */
+    struct ExpressionCode{
+      /** An enumeration of the codes. */
+      enum Value{
+	PLACEHOLDER, //<!-- A placeholder, the next entry is its id.
+	PLUS,        //<!-- Add the last two results.
+	TIMES        //<!-- Multiply the last two results.
+      };
+    };
     
     /** An interface for every expression (and sub expression).
      *  @tparam T The data type: float or double.
@@ -96,6 +110,12 @@ namespace ICR{
        */
       virtual data_t Evaluate(subcontext_parameter C) const = 0;
 
+      /** Write the expression as a postfix program.
+       *  The operands of a function are written before the function.
+       *  @param program The codes (see ExpressionCode) are appended to this vector.
+       */
+      virtual void Postfix(std::vector<size_t>& program) const = 0;
+
     protected:
       friend class Plus<T>;
       friend class Times<T>;
@@ -80,6 +80,12 @@ namespace ICR{
     template<class T>
     class ExpressionFactory{
     public:
+
+      /** Constructor */
+      ExpressionFactory()
+	: m_Expr(),
+	  m_placeholders(0)
+      {}
       
       /** @name Useful typdefs for types that are exposed to the user.
        */
@@ -119,10 +125,19 @@ namespace ICR{
       Multiply(expression_parameter a, 
 	       expression_parameter b);
       
+      /** The number of placeholders created by this factory.
+       *  Their ids run from 0 to number_of_placeholders()-1.
+       *  @return The number of placeholders.
+       */
+      size_t
+      number_of_placeholders() const {return m_placeholders;}
+      
 
     private:
       //References to the expression - memory management hanled by the shared pointers.
       std::list<boost::shared_ptr<Expression<T> > >  m_Expr;
+      //The number of placeholders (and the id of the next one)
+      size_t m_placeholders;
     };
   }
 }
@@ -86,6 +86,11 @@ namespace ICR{
        *  @return The result of the addition.
        */
       data_t Evaluate(subcontext_parameter C) const;
+
+      /** Write the addition as a postfix program.
+       *  @param program The operands and then ExpressionCode::PLUS are appended to this vector.
+       */
+      void Postfix(std::vector<size_t>& program) const;
     private:
       /* Set the parent expression.
        *  In order to be able to evaluate the (different) 
@@ -167,6 +172,12 @@ namespace ICR{
        */
       data_t 
       Evaluate(subcontext_parameter C) const;
+
+      /** Write the product as a postfix program.
+       *  @param program The operands and then ExpressionCode::TIMES are appended to this vector.
+       */
+      void
+      Postfix(std::vector<size_t>& program) const;
     private:
 
 
@@ -231,6 +242,16 @@ ICR::EnsembleLearning::Plus<T>::Evaluate(subcontext_parameter c) const
     m_b -> Evaluate(c);
 }
 
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Plus<T>::Postfix(std::vector<size_t>& program) const
+{
+  m_a->Postfix(program);
+  m_b->Postfix(program);
+  program.push_back(ExpressionCode::PLUS);
+}
+
 template<class T>
 inline
 ICR::EnsembleLearning::Times<T>::Times(expression_parameter a, 
@@ -254,4 +275,14 @@ ICR::EnsembleLearning::Times<T>::Evaluate(subcontext_parameter c) const
     m_b -> Evaluate(c);
 }
 
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Times<T>::Postfix(std::vector<size_t>& program) const
+{
+  m_a->Postfix(program);
+  m_b->Postfix(program);
+  program.push_back(ExpressionCode::TIMES);
+}
+
 #endif  // guard for FUNCTIONS_HPP
@@ -77,6 +77,11 @@ namespace ICR{
      *  
      *  @endcode
      *
+     *  Placeholders are created by an ExpressionFactory, 
+     *  which numbers its placeholders 0,1,2,... 
+     *  so all the placeholders in an expression must come from the same factory
+     *  (Context::Assign throws Exception::IncompatiblePlaceholder otherwise).
+     *
      *  @attention Not thread safe in initialisation.
      */
     template<class T>
@@ -86,20 +91,38 @@ namespace ICR{
       
     public:
       
-      /** Constructor */
-      Placeholder()
+      /** Constructor 
+       *  @param id The id of the placeholder, unique within its ExpressionFactory.
+       *  @param factory The ExpressionFactory that made the placeholder.
+       */
+      explicit
+      Placeholder(size_t id, const ExpressionFactory<T>* factory = 0)
 	: Expression<T>(),
 	  m_parent(0),
-	  m_id(s_count)
+	  m_id(id),
+	  m_factory(factory)
       {
-	++s_count;
       }
       
       /** The id of the placeholder.
-       *  @return a unique id for the given placeholder.
+       *  @return An id that is unique amongst the placeholders from the same ExpressionFactory.
        */
       size_t 
       id() const {return m_id;}
+
+      /** The ExpressionFactory that made the placeholder. */
+      const ExpressionFactory<T>*
+      factory() const {return m_factory;}
+
+      /** Write the placeholder as a postfix program.
+       *  @param program ExpressionCode::PLACEHOLDER and the id are appended to this vector.
+       */
+      void
+      Postfix(std::vector<size_t>& program) const
+      {
+	program.push_back(ExpressionCode::PLACEHOLDER);
+	program.push_back(m_id);
+      }
     private:
       
 
@@ -188,7 +211,7 @@ namespace ICR{
 
       function_t m_parent;
       size_t m_id;
-      static size_t s_count;
+      const ExpressionFactory<T>* m_factory;
       friend class SubContext<T>;
     };
     
@@ -0,0 +1,151 @@
+#pragma once
+#ifndef CHILD_STAGING_HPP
+#define CHILD_STAGING_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+#include <omp.h>
+#include <vector>
+#include <utility>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    //forward
+    template<class T> class VariableNode;
+    template<class T> class FactorNode;
+
+    namespace detail{
+
+      /** The child factors added to the variable nodes while a model is built concurrently.
+       *  Whilst a builder is constructing concurrently (see Builder::begin_concurrent)
+       *  every link between a node and a new child factor is appended to the list of the thread that made it,
+       *  rather than to the node itself, so that the threads never wait on each other.
+       *  The builder gives the nodes their children once construction is over.
+       *  The lists are only used on a thread while the builder is making a node there (see Scope),
+       *  so other models can be built at the same time on other threads.
+       *  A scope can also stop the nodes from initialising their moments when they are given their parent factor,
+       *  for a saved graph whose moments are read once all of it is in place.
+       *  @tparam T The data type (float or double).
+       */
+      template<class T>
+      class ChildStaging
+      {
+      public:
+	/** A child factor of a variable node. */
+	typedef std::pair<VariableNode<T>*, FactorNode<T>*> Link;
+	/** The links made by each thread. */
+	typedef std::vector<std::vector<Link> > Links;
+
+	/** Stage the links made on the calling thread into the lists of a builder, for as long as the scope lasts.
+	 *  The lists that were in use before are restored when the scope ends.
+	 */
+	class Scope
+	{
+	public:
+	  /** Constructor.
+	   *  @param links The lists in which to stage the links, one for each thread
+	   *   (or zero for the nodes to add their children themselves).
+	   *  @param initialise Whether the nodes initialise their moments when they are given their parent factor.
+	   */
+	  explicit
+	  Scope(Links* links, const bool initialise = true)
+	    : m_previous(Current()),
+	      m_initialise(Initialise())
+	  {
+	    Current() = links;
+	    Initialise() = initialise;
+	  }
+
+	  /** Destructor */
+	  ~Scope()
+	  {
+	    Current() = m_previous;
+	    Initialise() = m_initialise;
+	  }
+	private:
+	  Scope(const Scope&);
+	  Scope& operator=(const Scope&);
+	  Links* m_previous;
+	  bool m_initialise;
+	};
+
+	/** Stage a child factor, if a model is being built concurrently on this thread.
+	 *  @param node The parent node.
+	 *  @param factor The child factor.
+	 *  @return Whether the link was staged (if not the node must add the child itself).
+	 */
+	static
+	bool
+	Stage(VariableNode<T>* node, FactorNode<T>* factor)
+	{
+	  Links* links = Current();
+	  if (links == 0)
+	    return false;
+	  //A thread outside the team that the lists were made for adds the child itself (under the node's lock).
+	  const size_t thread = omp_get_thread_num();
+	  if (thread >= links->size())
+	    return false;
+	  (*links)[thread].push_back(Link(node, factor));
+	  return true;
+	}
+
+	/** Whether a node initialises its moments when it is given its parent factor (see Scope).
+	 *  @return False while a saved graph is loaded on the calling thread.
+	 */
+	static
+	bool
+	Initialising()
+	{
+	  return Initialise();
+	}
+
+      private:
+	//Whether the nodes initialise on the calling thread.
+	static
+	bool&
+	Initialise()
+	{
+	  static bool initialise = true;
+#pragma omp threadprivate(initialise)
+	  return initialise;
+	}
+
+	//The lists in use on the calling thread.
+	static
+	Links*&
+	Current()
+	{
+	  static Links* links = 0;
+#pragma omp threadprivate(links)
+	  return links;
+	}
+      };
+    }
+  }
+}
+
+#endif  // guard for CHILD_STAGING_HPP
@@ -29,102 +29,373 @@
 
 
 
-//The msvc versions of these definitions have not been tested, should be easy enough to fix up though if your having problems.
+/* The PARALLEL_* algorithms are used both for sweeps over every node in a model
+ * and for the few elements of a message or the components of a mixture.
+ * Each call therefore decides how to run:
+ *   - serially, if the range is smaller than the minimal size for the algorithm,
+ *     if it is called from within a parallel region (no nesting) or if there is only one thread,
+ *   - otherwise with the selected backend.
+ * The backend is chosen at build time with ENSEMBLE_LEARNING_PARALLEL_BACKEND
+ * (SERIAL, OPENMP_TASKS or WORK_STEALING) and can be changed at run time with set_parallel_backend().
+ * The parallel backends need random access iterators.
+ *
+ * Note that you often need extra compile time directives .e.g. -fopenmp, to make these work
+ */
 
-//Node that you often need extra compile time directives .e.g. -openmp, to make these work
+#include "AlgorithmChecker.hpp"
 
-#ifdef __GNUC__
-#include <parallel/algorithm> 
 #include <algorithm> 
-#elif _MSC_VER
-#include <ppl.h>
-#else  
-#include <algorithm>
-#endif
+#include <numeric>
+#include <iterator>
+#include <vector>
+#include <cstddef>
+#include <omp.h>
 
 #ifdef __GNUC__
+#include <parallel/algorithm> 
 #include <parallel/numeric>
-#include <numeric> 
-#elif _MSC_VER
-#include <ppl.h>
-#else  
-#include <numeric>
 #endif
 
-#include "AlgorithmChecker.hpp"
+#ifndef ENSEMBLE_LEARNING_PARALLEL_BACKEND
+#define ENSEMBLE_LEARNING_PARALLEL_BACKEND WORK_STEALING
+#endif
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** The ways in which the PARALLEL_* algorithms can be run. */
+    struct ParallelBackend
+    {
+      enum Value {
+	SERIAL,        ///< Always run serially.
+	OPENMP_TASKS,  ///< Split the range into OpenMP tasks.
+	WORK_STEALING  ///< The work stealing algorithms of the libstdc++ parallel mode (OpenMP tasks elsewhere).
+      };
+    };
+
+    /** The settings of the PARALLEL_* algorithms (shared by the whole program). */
+    struct ParallelSettings
+    {
+      /** The backend. */
+      ParallelBackend::Value backend;
+      /** The smallest range of cheap elements (e.g. numbers) that is split between threads. */
+      size_t minimal_size;
+      /** The smallest range that is reduced (accumulate, find, max_element, inner_product) in parallel. */
+      size_t minimal_reduction;
+      /** The smallest range of expensive elements (e.g. every node in a model) that is split between threads. */
+      size_t minimal_sweep;
+      /** The number of elements in each task. */
+      size_t grain;
+
+      /** The settings.
+       *  @return A reference to the settings.
+       */
+      static
+      ParallelSettings&
+      get()
+      {
+	static ParallelSettings settings;
+	return settings;
+      }
+
+    private:
+      ParallelSettings()
+	: backend(ParallelBackend::ENSEMBLE_LEARNING_PARALLEL_BACKEND),
+	  minimal_size(1000),
+	  minimal_reduction(1000),
+	  minimal_sweep(2),
+	  grain(64)
+      {}
+    };
 
+    /** Select the backend of the PARALLEL_* algorithms.
+     *  @param backend The backend.
+     */
+    inline
+    void
+    set_parallel_backend(const ParallelBackend::Value backend)
+    {
+      ParallelSettings::get().backend = backend;
+    }
+
+    namespace detail{
+
+      //Should a range of size n be split between threads?
+      inline
+      bool
+      go_parallel(const std::ptrdiff_t n, const size_t minimal)
+      {
+	return ParallelSettings::get().backend != ParallelBackend::SERIAL
+	  && n > 1 && size_t(n) >= minimal
+	  && !omp_in_parallel() && omp_get_max_threads() > 1;
+      }
+
+      inline
+      bool
+      work_stealing()
+      {
 #ifdef __GNUC__
-#define  PARALLEL_FOREACH __gnu_parallel::for_each  //std::for_each
-//#define  PARALLEL_FOREACH  std::for_each
-#elif _MSC_VER
-#define  PARALLEL_FOREACH parallel_for_each //are these in std?
-#else  
-#define  PARALLEL_FOREACH  std::for_each
+	return ParallelSettings::get().backend == ParallelBackend::WORK_STEALING;
+#else
+	return false;
 #endif
+      }
+
+      //Apply f to [first, first+n) in tasks of at most grain elements.
+      template<class RandomAccessIterator, class Function>
+      void
+      for_each_task(RandomAccessIterator first, const std::ptrdiff_t n, Function& f, const std::ptrdiff_t grain)
+      {
+	if (n <= grain) {
+	  for(std::ptrdiff_t i=0;i<n;++i){
+	    f(*(first+i));
+	  }
+	  return;
+	}
+	const std::ptrdiff_t half = n/2;
+#pragma omp task shared(f)
+	for_each_task(first, half, f, grain);
+	for_each_task(first+half, n-half, f, grain);
+#pragma omp taskwait
+      }
+
+      //The tasks hold at most ParallelSettings::grain elements,
+      // and fewer if there would otherwise not be a task for every thread.
+      template<class RandomAccessIterator, class Function>
+      void
+      for_each_tasks(RandomAccessIterator first, const std::ptrdiff_t n, Function& f)
+      {
+	const std::ptrdiff_t per_thread = std::max<std::ptrdiff_t>(n/omp_get_max_threads(), 1);
+	const std::ptrdiff_t grain = std::min<std::ptrdiff_t>(std::max<size_t>(ParallelSettings::get().grain, 1), per_thread);
+#pragma omp parallel
+#pragma omp single
+	for_each_task(first, n, f, grain);
+      }
+
+      //Writes *(out+i) = op(*(in+i))
+      template<class InputIterator, class OutputIterator, class UnaryOperation>
+      struct unary_at
+      {
+	unary_at(InputIterator in, OutputIterator out, UnaryOperation& op) : m_in(in), m_out(out), m_op(op) {}
+	void operator()(const std::ptrdiff_t i) {*(m_out+i) = m_op(*(m_in+i));}
+	InputIterator m_in; OutputIterator m_out; UnaryOperation& m_op;
+      };
+
+      //Writes *(out+i) = op(*(in1+i), *(in2+i))
+      template<class InputIterator1, class InputIterator2, class OutputIterator, class BinaryOperation>
+      struct binary_at
+      {
+	binary_at(InputIterator1 in1, InputIterator2 in2, OutputIterator out, BinaryOperation& op) 
+	  : m_in1(in1), m_in2(in2), m_out(out), m_op(op) {}
+	void operator()(const std::ptrdiff_t i) {*(m_out+i) = m_op(*(m_in1+i), *(m_in2+i));}
+	InputIterator1 m_in1; InputIterator2 m_in2; OutputIterator m_out; BinaryOperation& m_op;
+      };
 
+      //A counting range [0, n) for the index based algorithms.
+      inline
+      std::vector<std::ptrdiff_t>
+      indices(const std::ptrdiff_t n)
+      {
+	std::vector<std::ptrdiff_t> index(n);
+	for(std::ptrdiff_t i=0;i<n;++i) index[i] = i;
+	return index;
+      }
+
+      //The blocks of a reduction (one per thread, in order so that the result is reproducible).
+      inline
+      std::ptrdiff_t
+      reduction_blocks(const std::ptrdiff_t n)
+      {
+	return std::min<std::ptrdiff_t>(n, omp_get_max_threads());
+      }
+
+      template<class InputIterator, class Function>
+      inline
+      Function
+      parallel_for_each(InputIterator first, InputIterator last, Function f, const size_t minimal)
+      {
+	const std::ptrdiff_t n = std::distance(first, last);
+	if (!go_parallel(n, minimal))
+	  return std::for_each(first, last, f);
 #ifdef __GNUC__
-#define  PARALLEL_FIND  __gnu_parallel::find // std::find
-//#define  PARALLEL_FIND  std::find
-#elif _MSC_VER
-#define  PARALLEL_FIND parallel_find //are these in std?
-#else  
-#define  PARALLEL_FIND  std::find
+	//(the parallel mode runs ranges shorter than its own threshold serially, so those are tasks)
+	if (work_stealing() && size_t(n) >= __gnu_parallel::_Settings::get().for_each_minimal_n)
+	  return __gnu_parallel::for_each(first, last, f, __gnu_parallel::parallel_balanced);
 #endif
+	for_each_tasks(first, n, f);
+	return f;
+      }
 
+      /** Apply f to every element of a range.
+       *  Each element is taken to be expensive (such as updating a node),
+       *  so the range is split between threads if it holds at least ParallelSettings::minimal_sweep elements.
+       */
+      template<class InputIterator, class Function>
+      inline
+      Function
+      parallel_for_each(InputIterator first, InputIterator last, Function f)
+      {
+	return parallel_for_each(first, last, f, ParallelSettings::get().minimal_sweep);
+      }
+
+      template<class InputIterator, class OutputIterator, class UnaryOperation>
+      inline
+      OutputIterator
+      parallel_transform(InputIterator first, InputIterator last, OutputIterator result, UnaryOperation op)
+      {
+	const std::ptrdiff_t n = std::distance(first, last);
+	if (!go_parallel(n, ParallelSettings::get().minimal_size))
+	  return std::transform(first, last, result, op);
 #ifdef __GNUC__
-#define  PARALLEL_GENERATE __gnu_parallel::generate //std::generate
-//#define  PARALLEL_GENERATE  std::generate
-#elif _MSC_VER
-#define  PARALLEL_GENERATE parallel_generate //are these in std?
-#else  
-#define  PARALLEL_GENERATE  std::generate
+	if (work_stealing())
+	  return __gnu_parallel::transform(first, last, result, op, __gnu_parallel::parallel_balanced);
 #endif
+	std::vector<std::ptrdiff_t> index = indices(n);
+	unary_at<InputIterator, OutputIterator, UnaryOperation> f(first, result, op);
+	for_each_tasks(index.begin(), n, f);
+	return result + n;
+      }
 
-
+      template<class InputIterator1, class InputIterator2, class OutputIterator, class BinaryOperation>
+      inline
+      OutputIterator
+      parallel_transform(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, 
+			 OutputIterator result, BinaryOperation op)
+      {
+	const std::ptrdiff_t n = std::distance(first1, last1);
+	if (!go_parallel(n, ParallelSettings::get().minimal_size))
+	  return std::transform(first1, last1, first2, result, op);
 #ifdef __GNUC__
-#define  PARALLEL_COPY  std::copy
-#elif _MSC_VER
-#define  PARALLEL_COPY parallel_copy //are these in std?
-#else  
-#define  PARALLEL_COPY  std::copy
+	if (work_stealing())
+	  return __gnu_parallel::transform(first1, last1, first2, result, op, __gnu_parallel::parallel_balanced);
 #endif
+	std::vector<std::ptrdiff_t> index = indices(n);
+	binary_at<InputIterator1, InputIterator2, OutputIterator, BinaryOperation> f(first1, first2, result, op);
+	for_each_tasks(index.begin(), n, f);
+	return result + n;
+      }
 
+      //The generator is called in order (it usually has a state), except by the libstdc++ parallel mode.
+      template<class ForwardIterator, class Generator>
+      inline
+      void
+      parallel_generate(ForwardIterator first, ForwardIterator last, Generator gen)
+      {
+#ifdef __GNUC__
+	if (work_stealing() && go_parallel(std::distance(first, last), ParallelSettings::get().minimal_size)) {
+	  __gnu_parallel::generate(first, last, gen, __gnu_parallel::parallel_balanced);
+	  return;
+	}
+#endif
+	std::generate(first, last, gen);
+      }
 
+      template<class InputIterator, class T>
+      inline
+      T
+      parallel_accumulate(InputIterator first, InputIterator last, T init)
+      {
+	const std::ptrdiff_t n = std::distance(first, last);
+	if (!go_parallel(n, ParallelSettings::get().minimal_reduction))
+	  return std::accumulate_checked(first, last, init);
 #ifdef __GNUC__
-#define  PARALLEL_ACCUMULATE __gnu_parallel::accumulate //std::accumulate_checked
-//#define  PARALLEL_ACCUMULATE  std::accumulate_checked
-#elif _MSC_VER
-#define  PARALLEL_ACCUMULATE parallel_accumulate
-#else  
-#define  PARALLEL_ACCUMULATE  std::accumulate_checked
+	if (work_stealing())
+	  return __gnu_parallel::accumulate(first, last, init);
 #endif
+	const std::ptrdiff_t blocks = reduction_blocks(n);
+	std::vector<T> partial(blocks, T());
+#pragma omp parallel for schedule(static)
+	for(std::ptrdiff_t b=0;b<blocks;++b){
+	  partial[b] = std::accumulate(first + b*n/blocks, first + (b+1)*n/blocks, T());
+	}
+	return std::accumulate(partial.begin(), partial.end(), init);
+      }
 
+      template<class InputIterator1, class InputIterator2, class T>
+      inline
+      T
+      parallel_inner_product(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, T init)
+      {
+	const std::ptrdiff_t n = std::distance(first1, last1);
+	if (!go_parallel(n, ParallelSettings::get().minimal_reduction))
+	  return std::inner_product(first1, last1, first2, init);
 #ifdef __GNUC__
-#define  PARALLEL_TRANSFORM __gnu_parallel::transform //std::transform
-//#define  PARALLEL_TRANSFORM  std::transform
-#elif _MSC_VER
-#define  PARALLEL_TRANSFORM parallel_transform
-#else  
-#define  PARALLEL_TRANSFORM  std::transform
+	if (work_stealing())
+	  return __gnu_parallel::inner_product(first1, last1, first2, init);
 #endif
+	const std::ptrdiff_t blocks = reduction_blocks(n);
+	std::vector<T> partial(blocks, T());
+#pragma omp parallel for schedule(static)
+	for(std::ptrdiff_t b=0;b<blocks;++b){
+	  partial[b] = std::inner_product(first1 + b*n/blocks, first1 + (b+1)*n/blocks, first2 + b*n/blocks, T());
+	}
+	return std::accumulate(partial.begin(), partial.end(), init);
+      }
 
+      template<class InputIterator, class T>
+      inline
+      InputIterator
+      parallel_find(InputIterator first, InputIterator last, const T& value)
+      {
+	const std::ptrdiff_t n = std::distance(first, last);
+	if (!go_parallel(n, ParallelSettings::get().minimal_reduction))
+	  return std::find(first, last, value);
 #ifdef __GNUC__
-#define  PARALLEL_MAX __gnu_parallel::max_element  //std::max_element 
-//#define  PARALLEL_MAX  std::max_element
-#elif _MSC_VER
-#define  PARALLEL_MAX parallel_max_element
-#else  
-#define  PARALLEL_MAX  std::max_element
+	if (work_stealing())
+	  return __gnu_parallel::find(first, last, value);
 #endif
+	const std::ptrdiff_t blocks = reduction_blocks(n);
+	std::vector<std::ptrdiff_t> found(blocks);
+#pragma omp parallel for schedule(static)
+	for(std::ptrdiff_t b=0;b<blocks;++b){
+	  const InputIterator end = first + (b+1)*n/blocks;
+	  found[b] = std::find(first + b*n/blocks, end, value) - first;
+	}
+	//the first block with a match
+	for(std::ptrdiff_t b=0;b<blocks;++b){
+	  if (found[b] != (b+1)*n/blocks)
+	    return first + found[b];
+	}
+	return last;
+      }
 
+      template<class ForwardIterator>
+      inline
+      ForwardIterator
+      parallel_max_element(ForwardIterator first, ForwardIterator last)
+      {
+	const std::ptrdiff_t n = std::distance(first, last);
+	if (!go_parallel(n, ParallelSettings::get().minimal_reduction))
+	  return std::max_element(first, last);
 #ifdef __GNUC__
-#define  PARALLEL_INNERPRODUCT __gnu_parallel::inner_product  //std::max_element 
-//#define  PARALLEL_INNERPRODUCT  std::inner_product
-#elif _MSC_VER
-#define  PARALLEL_INNERPRODUCT parallel_inner_product
-#else  
-#define  PARALLEL_INNERPRODUCT  std::inner_product
+	if (work_stealing())
+	  return __gnu_parallel::max_element(first, last);
 #endif
+	const std::ptrdiff_t blocks = reduction_blocks(n);
+	std::vector<ForwardIterator> best(blocks);
+#pragma omp parallel for schedule(static)
+	for(std::ptrdiff_t b=0;b<blocks;++b){
+	  best[b] = std::max_element(first + b*n/blocks, first + (b+1)*n/blocks);
+	}
+	//the first of the largest (as std::max_element)
+	ForwardIterator max = best[0];
+	for(std::ptrdiff_t b=1;b<blocks;++b){
+	  if (*max < *best[b]) max = best[b];
+	}
+	return max;
+      }
+    }
+  }
+}
+
+#define  PARALLEL_FOREACH       ICR::EnsembleLearning::detail::parallel_for_each
+#define  PARALLEL_FIND          ICR::EnsembleLearning::detail::parallel_find
+#define  PARALLEL_GENERATE      ICR::EnsembleLearning::detail::parallel_generate
+#define  PARALLEL_COPY          std::copy  //memory bound
+#define  PARALLEL_ACCUMULATE    ICR::EnsembleLearning::detail::parallel_accumulate
+#define  PARALLEL_TRANSFORM     ICR::EnsembleLearning::detail::parallel_transform
+#define  PARALLEL_MAX           ICR::EnsembleLearning::detail::parallel_max_element
+#define  PARALLEL_INNERPRODUCT  ICR::EnsembleLearning::detail::parallel_inner_product
 
 
 #endif  // guard for PARALLEL_ALGORITHMS_HPP
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef MPIREDUCER_HPP
+#define MPIREDUCER_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+#include "EnsembleLearning/distributed/Reducer.hpp"
+
+#include <boost/mpi/communicator.hpp>
+#include <boost/mpi/collectives/all_reduce.hpp>
+#include <functional>
+#include <vector>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** A Reducer that sums over the processes of an MPI communicator with Boost.MPI.
+     *  This header (and only this header) requires MPI, 
+     *  the library itself is built without it.
+     *
+     *  Example of use:
+     *  @code
+     *  boost::mpi::environment env(ac, av);
+     *  boost::shared_ptr<MPIReducer> reducer(new MPIReducer());
+     *  Builder<double> build;
+     *  build.set_reducer(reducer);
+     *  //...build the global nodes on every process
+     *  build.begin_partition();
+     *  for(size_t i=reducer->rank(); i<data.size(); i+=reducer->size())
+     *    build.join(mean, precision, data[i]);
+     *  build.end_partition();
+     *  build.run();
+     *  @endcode
+     */
+    class MPIReducer : public Reducer
+    {
+    public:
+      /** Constructor.
+       *  @param comm The communicator of the processes taking part (the default is MPI_COMM_WORLD).
+       */
+      MPIReducer(const boost::mpi::communicator& comm = boost::mpi::communicator())
+	: m_comm(comm),
+	  m_buffer()
+      {}
+      
+      void
+      sum(std::vector<double>& v)
+      {
+	if (v.empty()) return;
+	m_buffer.resize(v.size());
+	boost::mpi::all_reduce(m_comm, &v[0], v.size(), &m_buffer[0], std::plus<double>());
+	v.swap(m_buffer);
+      }
+
+      size_t
+      rank() const {return m_comm.rank();}
+
+      size_t
+      size() const {return m_comm.size();}
+      
+    private:
+      boost::mpi::communicator m_comm;
+      std::vector<double> m_buffer;
+    };
+
+  }
+}
+
+#endif  // guard for MPIREDUCER_HPP
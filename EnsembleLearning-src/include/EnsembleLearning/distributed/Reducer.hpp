@@ -0,0 +1,91 @@
+#pragma once
+#ifndef REDUCER_HPP
+#define REDUCER_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+#include <vector>
+#include <cstddef>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** The interface used by a distributed Builder to combine results across processes.
+     *  Every process builds the same global nodes, 
+     *  but only its own partition of the data (and of the nodes local to the data).
+     *  Once per iteration the partial sums of the messages sent to the global nodes 
+     *  are summed over all the processes with this interface.
+     */
+    class Reducer
+    {
+    public:
+      /** Sum a vector element by element over all processes.
+       *  Every process must call this with a vector of the same size.
+       *  @param v The local values, replaced with the sum over all processes.
+       */
+      virtual
+      void
+      sum(std::vector<double>& v) = 0;
+      
+      /** The index of this process.
+       *  @return The rank of this process, from 0 to size()-1.
+       */
+      virtual
+      size_t
+      rank() const = 0;
+      
+      /** The number of processes.
+       *  @return The number of processes taking part in the inference.
+       */
+      virtual
+      size_t
+      size() const = 0;
+
+      /** Destructor */
+      virtual
+      ~Reducer(){};
+    };
+    
+    /** A Reducer for a single process.
+     *  The sums are left unchanged.
+     */
+    class SerialReducer : public Reducer
+    {
+    public:
+      void
+      sum(std::vector<double>& /*v*/) {}
+
+      size_t
+      rank() const {return 0;}
+
+      size_t
+      size() const {return 1;}
+    };
+
+  }
+}
+
+#endif  // guard for REDUCER_HPP
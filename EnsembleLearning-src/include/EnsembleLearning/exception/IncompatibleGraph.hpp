@@ -0,0 +1,44 @@
+#pragma once
+#ifndef INCOMPATIBLEGRAPH_HPP
+#define INCOMPATIBLEGRAPH_HPP
+
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+namespace ICR{
+  namespace EnsembleLearning{
+    namespace Exception{
+      /** An exception thrown when a model cannot be saved as a graph, or a saved graph cannot be loaded.
+       *  This happens when the file is not a graph file, was written with a different version or data type, 
+       *  or is damaged, or when the model is not empty when the graph is loaded into it.
+       */
+      class IncompatibleGraph
+      {};
+    }
+  }
+}
+#endif  // guard for INCOMPATIBLEGRAPH_HPP
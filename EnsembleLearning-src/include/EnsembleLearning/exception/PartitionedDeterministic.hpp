@@ -0,0 +1,44 @@
+#pragma once
+#ifndef PARTITIONEDDETERMINISTIC_HPP
+#define PARTITIONEDDETERMINISTIC_HPP
+
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+namespace ICR{
+  namespace EnsembleLearning{
+    namespace Exception{
+      /** An exception thrown when a distributed model has a global calculation node with children in the data partition.
+       *  The calculation nodes forward the messages of their children without summing them over the processes,
+       *  so calculation nodes that feed the partitioned data must be created inside the partition.
+       */
+      class PartitionedDeterministic
+      {};
+    }
+  }
+}
+#endif  // guard for PARTITIONEDDETERMINISTIC_HPP
@@ -142,6 +142,14 @@ namespace ICR{
       moments_t
       CalcMoments(NP_parameter NP);
 
+      /** Test whether Natural Parameters describe a valid distribution.
+       *  @param NP The NaturalParameters to test.
+       *  @return True if every concentration is positive.
+       */
+      static
+      bool
+      InDomain(NP_parameter NP);
+
       /** Calculate the Natural Parameters to go the Mixture.
        *  @param Us The moments from the Dirichlet constant Node.
        *  @return The calculated NaturalParameters.  
@@ -311,6 +319,17 @@ ICR::EnsembleLearning::Dirichlet<T>::CalcPrecision(NP_parameter NP)
 }
 
 
+template<class T>
+inline
+bool
+ICR::EnsembleLearning::Dirichlet<T>::InDomain(NP_parameter NP)
+{
+  for(size_t i=0;i<NP.size();++i){
+    if (!(NP[i] > -1)) return false;
+  }
+  return true;
+}
+
 template<class T>
 inline
 typename ICR::EnsembleLearning::Dirichlet<T>::moments_t
@@ -38,6 +38,9 @@
 #include <gsl/gsl_sf_gamma.h> //for gamma function
 
 #include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
 #include <boost/assert.hpp> 
 #include <boost/call_traits.hpp> 
 
@@ -140,6 +143,15 @@ namespace ICR{
       static
       moments_t
       CalcMoments(NP_parameter NP);
+
+      /** Test whether Natural Parameters describe a valid distribution.
+       *  @param NP The NaturalParameters to test.
+       *  @return True if every (unnormalised) log probability is finite.
+       */
+      static
+      bool
+      InDomain(NP_parameter NP);
+
  
       /** Calculate the Natural Parameters to go the Dirichlet Prior.
        *  @param Discrete The moments from the Discrete factor
@@ -176,6 +188,12 @@ namespace ICR{
       static
       data_t
       CalcLogNorm(vector_data_parameter LogProbs) ;
+
+      //The log normalisation of any random access range of unnormalised log probabilities.
+      template<class LogProbs>
+      static
+      data_t
+      LogNorm(const LogProbs& unLogProbs) ;
     };
 
   }
@@ -195,25 +213,7 @@ inline
 typename ICR::EnsembleLearning::Discrete<T>::data_t
 ICR::EnsembleLearning::Discrete<T>::CalcLogNorm(vector_data_parameter unLogProbs) 
 {
-  /* Unnormalised
-   *If all the probs are very small then can easily get servere numerical errors,
-   * eg. norm = 0.
-   * To solve this we subtract most significant log before exponetating 
-   *   (and add it again after).
-   */
-  const data_t LogMax = *PARALLEL_MAX(unLogProbs.begin(),unLogProbs.end());
-
-  std::vector<T> unLogProbsTmp(unLogProbs.size());  
-  PARALLEL_TRANSFORM( unLogProbs.begin(),unLogProbs.end(), unLogProbsTmp.begin(), 
-		      subtract(LogMax));
-  //exponentiate log (prob/max)
-  std::vector<T> unProbs(unLogProbsTmp.size());
-  PARALLEL_TRANSFORM( unLogProbsTmp.begin(),unLogProbsTmp.end(), unProbs.begin(), 
-		      exponentiate());
-  const data_t norm = PARALLEL_ACCUMULATE(unProbs.begin(), unProbs.end(),0.0) ;
-  
-  return -std::log(norm)- LogMax;
-
+  return LogNorm(unLogProbs);
 }
 
 template<class T>
@@ -221,11 +221,8 @@ inline
 typename ICR::EnsembleLearning::Discrete<T>::data_t 
 ICR::EnsembleLearning::Discrete<T>::CalcLogNorm(moments_parameter Dirichlet) 
 {
-  //the log probs are provided by Dirichlet, need to pass them on
-  std::vector<T> unLogProbs(Dirichlet.size());
-  PARALLEL_COPY( Dirichlet.begin(), Dirichlet.end(), unLogProbs.begin());
-  
-  return  CalcLogNorm(unLogProbs);
+  //the log probs are provided by Dirichlet
+  return  LogNorm(Dirichlet);
 }
 
 template<class T>
@@ -234,10 +231,33 @@ typename ICR::EnsembleLearning::Discrete<T>::data_t
 ICR::EnsembleLearning::Discrete<T>::CalcLogNorm(NP_parameter NP) 
 {
   //The NP are the log probs
-  std::vector<T> unLogProbs(NP.size());
-  PARALLEL_COPY( NP.begin(), NP.end(), unLogProbs.begin());
-  
-  return  CalcLogNorm(unLogProbs);
+  return  LogNorm(NP);
+}
+
+template<class T>
+template<class LogProbs>
+inline
+typename ICR::EnsembleLearning::Discrete<T>::data_t
+ICR::EnsembleLearning::Discrete<T>::LogNorm(const LogProbs& unLogProbs) 
+{
+  /* Unnormalised
+   *If all the probs are very small then can easily get servere numerical errors,
+   * eg. norm = 0.
+   * To solve this we subtract most significant log before exponetating 
+   *   (and add it again after).
+   * There is one probability for every component of a mixture, 
+   * so this is done in place without any temporaries.
+   */
+  BOOST_ASSERT(unLogProbs.size() != 0);
+  data_t LogMax = unLogProbs[0];
+  for(size_t i=1;i<unLogProbs.size();++i){
+    LogMax = std::max<data_t>(LogMax, unLogProbs[i]);
+  }
+  double norm = 0;
+  for(size_t i=0;i<unLogProbs.size();++i){
+    norm += std::exp(unLogProbs[i] - LogMax);
+  }
+  return -std::log(norm)- LogMax;
 }
 
 template<class T>
@@ -284,25 +304,37 @@ ICR::EnsembleLearning::Discrete<T>::CalcPrecision(NP_parameter NP)
   return vprec;
 }
 
+template<class T>
+inline
+bool
+ICR::EnsembleLearning::Discrete<T>::InDomain(NP_parameter NP)
+{
+  for(size_t i=0;i<NP.size();++i){
+    if (!(std::fabs(NP[i]) <= std::numeric_limits<T>::max())) return false;
+  }
+  return true;
+}
+
 template<class T>
 inline
 typename ICR::EnsembleLearning::Discrete<T>::moments_t
 ICR::EnsembleLearning::Discrete<T>::CalcMoments(NP_parameter NP)
 {
   //NPs are unnormalised log probabilities.
-
-  std::vector<data_t> unLogProbs(NP.size());  //unnormalised
-  std::vector<data_t> LogProbs(NP.size());    //log normalised
+  //The components that have been excluded by a mixture have (all but) zero probability.
   std::vector<data_t> Probs(NP.size());       //normalised
-  PARALLEL_COPY( NP.begin(), NP.end(), unLogProbs.begin());
-  //calculate the log partition factor, Z.  The normalisation is 1/Z.
-  const data_t LogNorm = -CalcLogNorm(unLogProbs); //Thats why there is a minus here
-  PARALLEL_TRANSFORM(  unLogProbs.begin(),  unLogProbs.end(), 
-		       LogProbs.begin(), subtract(LogNorm));
-  
-  PARALLEL_TRANSFORM(  LogProbs.begin(),  LogProbs.end(), 
-		       Probs.begin(), exponentiate());
-
+  data_t LogMax = NP[0];
+  for(size_t i=1;i<NP.size();++i){
+    LogMax = std::max<data_t>(LogMax, NP[i]);
+  }
+  double norm = 0;
+  for(size_t i=0;i<NP.size();++i){
+    Probs[i] = std::exp(NP[i] - LogMax);
+    norm += Probs[i];
+  }
+  for(size_t i=0;i<NP.size();++i){
+    Probs[i] /= norm;
+  }
   return moments_t(Probs);
 }
 
@@ -178,6 +178,14 @@ namespace ICR{
       moments_t
       CalcMoments(NP_parameter NP);
 
+      /** Test whether Natural Parameters describe a valid distribution.
+       *  @param NP The NaturalParameters to test.
+       *  @return True if the shape and inverse scale are positive.
+       */
+      static
+      bool
+      InDomain(NP_parameter NP);
+
       /** Calculate the Natural Parameters to go the Parent1 (The shape).
        *   @warning 
        *     The shape is NOT conjugate to the Gamma distribution
@@ -343,6 +351,14 @@ ICR::EnsembleLearning::Gamma<T>::CalcMoments(vector_data_param mean,
 		   );
 }
 
+template<class T>
+inline
+bool
+ICR::EnsembleLearning::Gamma<T>::InDomain(NP_parameter NP)
+{
+  return NP[0] < 0 && NP[1] > -1;
+}
+
 template<class T>
 inline
 typename ICR::EnsembleLearning::Gamma<T>::moments_t
@@ -199,6 +199,28 @@ namespace ICR{
       static
       moments_t
       CalcMoments(NP_parameter NP)  ;
+
+      /** Calculate the Moments from the two Natural Paramters without building either.
+       *  @param NP0 The first natural parameter.
+       *  @param NP1 The second natural parameter.
+       *  @param first Set to the first moment.
+       *  @param second Set to the second moment.
+       */
+      static
+      void
+      CalcMoments(data_parameter NP0,
+		  data_parameter NP1,
+		  data_t& first,
+		  data_t& second);
+
+      /** Test whether Natural Parameters describe a valid distribution.
+       *  @param NP The NaturalParameters to test.
+       *  @return True if the precision is positive.
+       */
+      static
+      bool
+      InDomain(NP_parameter NP);
+
       
       /** Calculate the Natural Parameters to go the Parent1 (The mean).
        *  This is evaluated at a Factor from the other two attached Variables.
@@ -263,8 +285,13 @@ namespace ICR{
       CalcNP2Deterministic(expression_parameter Expr,
 			   context_parameter C);
 
-    private:
-      //The Log norm is actually evaluated here.
+      /** Calculate the natural log of the normalisation factor.
+       *  The log norm is actually evaluated here.
+       *  @param mean The (average of the) mean.
+       *  @param mean_squared The (average of the) mean squared.
+       *  @param precision The (average of the) precision.
+       *  @return The log or the normalisation.
+       */
       static
       data_t
       CalcLogNorm(data_parameter mean,
@@ -384,17 +411,39 @@ ICR::EnsembleLearning::Gaussian<T>::CalcMoments(vector_data_param m,
   return  moments_t(mean, mean_squared + var);
 }
 
+template<class T>
+inline
+bool
+ICR::EnsembleLearning::Gaussian<T>::InDomain(NP_parameter NP)
+{
+  return NP[1] < 0;
+}
+
 template<class T>
 inline
 typename ICR::EnsembleLearning::Gaussian<T>::moments_t
 ICR::EnsembleLearning::Gaussian<T>::CalcMoments(NP_parameter NP)
+{
+  moments_t M(0,0);
+  CalcMoments(NP[0], NP[1], M[0], M[1]);
+  return M;
+}
+
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Gaussian<T>::CalcMoments(data_parameter NP0,
+						data_parameter NP1,
+						data_t& first,
+						data_t& second)
 {
   //Get the data from the natural paremetes.
-  const_data_t precision    = -NP[1]*2.0;
-  const_data_t mean         =  NP[0]/precision; 
+  const_data_t precision    = -NP1*2.0;
+  const_data_t mean         =  NP0/precision; 
   //Mean squared on HiddenVariable  is local and not averaged.
   const_data_t mean_squared =  (mean)*(mean);
-  return  moments_t(mean, mean_squared + 1.0 /precision);
+  first  = mean;
+  second = mean_squared + 1.0 /precision;
 }
 
 template<class T> 
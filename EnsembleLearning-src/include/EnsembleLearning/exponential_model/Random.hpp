@@ -3,6 +3,9 @@
 
 #include <gsl/gsl_rng.h>     
 #include <gsl/gsl_randist.h>
+#include <boost/shared_ptr.hpp>
+#include <omp.h>
+#include <vector>
 #include <ctime>
 
 namespace ICR{
@@ -131,6 +134,7 @@ namespace ICR{
 
     /** A Singleton used to store a random number generator throughout the programs lifetime.
      * The singleton is destroyed at the end of the program by the SingletonDestroyer.
+     * After a call to Split() the other threads of a parallel region each have a generator of their own.
      */
     class Random{
     public:
@@ -143,7 +147,7 @@ namespace ICR{
 	if (m_rng == 0)
 	  m_rng = new rng(seed);
 	m_Destroyer.SetSingleton(m_rng); 
-	return m_rng;
+	return Thread();
       }
       
       /** Obtain an instance of the random number generator. 
@@ -154,10 +158,29 @@ namespace ICR{
 	if (m_rng == 0)
 	  m_rng = new rng();
 	m_Destroyer.SetSingleton(m_rng); 
-	return m_rng;
+	return Thread();
+      }
+
+      /** Give each thread a random number generator of its own, 
+       *  so that the threads can draw random numbers at the same time (for example to build a model concurrently).
+       *  The first thread keeps the generator of the singleton,
+       *  the generators of the other threads are seeded from it,
+       *  so that the numbers depend only on the seed and on which thread draws them.
+       *  This must be called outside of a parallel region.
+       *  @param threads The number of threads that need a generator.
+       */
+      static void Split(const size_t threads)
+      {
+	rng* random = Instance();
+	Threads().clear();
+	for(size_t t=1;t<threads;++t){
+	  const unsigned long int seed = static_cast<unsigned long int>(random->uniform()*4294967295.0);
+	  Threads().push_back(boost::shared_ptr<rng>(new rng(seed)));
+	}
       }
       
       
+      
       /** Restart the random number generator
        * @param seed The seed for the random number generator
        * @return A pointer to the rng.
@@ -168,6 +191,7 @@ namespace ICR{
 	  delete m_rng;
 	}
 	m_rng = new rng(seed);
+	Threads().clear();
 	m_Destroyer.SetSingleton(m_rng); 
 	  
 	return m_rng;
@@ -176,6 +200,22 @@ namespace ICR{
       Random(); 
       ~Random(){}
 
+      //The generators of the threads other than the first
+      static std::vector<boost::shared_ptr<rng> >& Threads()
+      {
+	static std::vector<boost::shared_ptr<rng> > threads;
+	return threads;
+      }
+
+      //The generator of this thread
+      static rng* Thread()
+      {
+	const size_t thread = omp_get_thread_num();
+	if (thread == 0 || thread > Threads().size())
+	  return m_rng;
+	return Threads()[thread-1].get();
+      }
+
       friend class SingletonDestroyer<rng>; 
       static rng *m_rng;
       static SingletonDestroyer<rng> m_Destroyer;
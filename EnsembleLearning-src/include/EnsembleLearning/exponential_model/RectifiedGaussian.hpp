@@ -204,6 +204,28 @@ namespace ICR{
       static
       moments_t
       CalcMoments(NP_parameter NP)  ;
+
+      /** Calculate the Moments from the two Natural Paramters without building either.
+       *  @param NP0 The first natural parameter.
+       *  @param NP1 The second natural parameter.
+       *  @param first Set to the first moment.
+       *  @param second Set to the second moment.
+       */
+      static
+      void
+      CalcMoments(data_parameter NP0,
+		  data_parameter NP1,
+		  data_t& first,
+		  data_t& second);
+
+      /** Test whether Natural Parameters describe a valid distribution.
+       *  @param NP The NaturalParameters to test.
+       *  @return True if the precision is positive.
+       */
+      static
+      bool
+      InDomain(NP_parameter NP);
+
       
       
       /** Calculate the Natural Parameters to go the Parent1 (The mean).
@@ -275,6 +297,19 @@ namespace ICR{
       CalcNP2Deterministic(expression_parameter Expr,
 			   context_parameter C);
 
+      /** Calculate the natural log of the normalisation factor.
+       *  The log norm is actually evaluated here.
+       *  @param mean The (average of the) mean.
+       *  @param mean_squared The (average of the) mean squared.
+       *  @param precision The (average of the) precision.
+       *  @return The log or the normalisation.
+       */
+      static
+      data_t
+      CalcLogNorm(data_parameter mean,
+		  data_parameter mean_squared,
+		  data_parameter precision);
+
     private:
       
       struct Erfcx
@@ -285,12 +320,6 @@ namespace ICR{
 	  return std::exp(x*x)*gsl_sf_erfc(x);
 	}
       }; 
-
-      static
-      data_t
-      CalcLogNorm(data_parameter mean,
-		  data_parameter mean_squared,
-		  data_parameter precision);
     };
 
   }
@@ -420,6 +449,14 @@ ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(vector_data_param m,
   
 }
 
+template<class T>
+inline
+bool
+ICR::EnsembleLearning::RectifiedGaussian<T>::InDomain(NP_parameter NP)
+{
+  return NP[1] < 0;
+}
+
 template<class T>
 inline
 typename ICR::EnsembleLearning::RectifiedGaussian<T>::moments_t
@@ -427,8 +464,21 @@ ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(NP_parameter NP)
 {
   //NP must have a size of 2
   BOOST_ASSERT(NP.size() == 2);
-  const data_t precision    =  -NP[1]*2.0;
-  const data_t mean         =  NP[0]/(precision); 
+  moments_t M(0,0);
+  CalcMoments(NP[0], NP[1], M[0], M[1]);
+  return M;
+}
+
+template<class T>
+inline
+void
+ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(data_parameter NP0,
+							 data_parameter NP1,
+							 data_t& first,
+							 data_t& second)
+{
+  const data_t precision    =  -NP1*2.0;
+  const data_t mean         =  NP0/(precision); 
   //Mean squared on HiddenVariable  is local and not averaged.
   const data_t mean_squared =  (mean)*(mean); 
   const data_t precision_squared =  (precision)*(precision); 
@@ -436,7 +486,6 @@ ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(NP_parameter NP)
   //The argument to the erfcx function (scaled complimentary error function).
   const data_t arg = -mean*std::sqrt(precision/2.0);
 
-  moments_t M(0,0);
   /* If the mod(argument) becomes too large then numerical errors can force answer to zero,
    * which breaks the gamma distribution.
    * Therefore approximate the function in these cases.
@@ -451,15 +500,15 @@ ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(NP_parameter NP)
        *  complementary error functions and their applications in
        *  atmospheric science we get (to one approximation better) 
        */
-      return  moments_t(-1.0/(mean*precision) + 2.5/(mean*mean_squared*precision_squared),
-			 ( mean_squared + 1.0 /(precision))*(1.0-1.0/sqrt(2))
-			 + 2.5/(mean_squared*precision_squared));
-
+      first  = -1.0/(mean*precision) + 2.5/(mean*mean_squared*precision_squared);
+      second = ( mean_squared + 1.0 /(precision))*(1.0-1.0/sqrt(2))
+	+ 2.5/(mean_squared*precision_squared);
     }
-  if (arg<-15) 
+  else if (arg<-15) 
     {
       //its tends to a gaussia
-      return  moments_t(mean, mean_squared + 1.0 /(precision));
+      first  = mean;
+      second = mean_squared + 1.0 /(precision);
     }
   else
     {
@@ -468,8 +517,8 @@ ICR::EnsembleLearning::RectifiedGaussian<T>::CalcMoments(NP_parameter NP)
       //The following is expensive to calculate and is used twice.
       const data_t iRpt = 1.0/(std::sqrt(M_PI*precision)*erfcx(arg));
       
-      return  moments_t(mean + std::sqrt(2.0)*iRpt,
-			 mean_squared + 1.0 /(precision) + mean*iRpt);
+      first  = mean + std::sqrt(2.0)*iRpt;
+      second = mean_squared + 1.0 /(precision) + mean*iRpt;
     }
 }
 
@@ -28,18 +28,18 @@
 
 
 
-#include "MomentsIterator.hpp"
-#include "EnsembleLearning/detail/Mutex.hpp"
-#include "EnsembleLearning/detail/parallel_algorithms.hpp"
-
 #include <iostream>
+#include <vector>
 #include <boost/call_traits.hpp>
 
 namespace ICR{
   namespace EnsembleLearning{
     
     
-    /** A threadsafe container for the Moments.
+    /** A container for the Moments.
+     *  The moments are stored contiguously and are not locked:
+     *  the nodes (and the order in which the Builder updates them) 
+     *  ensure that a set of moments is not written while it is being read.
      *  @tparam T The datatype to be used for storing the moments (typically double or float).
      */
     template<class T=double>
@@ -91,10 +91,10 @@ namespace ICR{
       typedef typename boost::call_traits<size_t>::const_reference  
       size_const_reference;
       
-      typedef  MomentsIterator<type, data_type>  
+      typedef typename std::vector<T>::iterator
       iterator;
       
-      typedef  MomentsIterator<const type, const data_type>  
+      typedef typename std::vector<T>::const_iterator
       const_iterator;
       
       ///@}
@@ -128,30 +128,36 @@ namespace ICR{
        */
       reference operator=(parameter other);
       
+      /** Exchange the stored moments with another container (no copies are made).
+       *  @param other The Moments container to swap with.
+       */
+      void
+      swap(reference other);
+      
       /** Obtain an iterator for the first moment.
        *  @return An iterator pointing to the first moment.
-       *  The returned iterator is thread safe 
+       *  The returned iterator is not locked.
        */
       iterator
       begin();
 
       /** Obtain an const_iterator for the first moment.
        *  @return A const_iterator pointing to the first moment.
-       *  The returned iterator is thread safe 
+       *  The returned iterator is not locked.
        */
       const_iterator
       begin() const;
 
       /** Obtain an iterator for the last+1 moment.
        *  @return An iterator pointing to the last+1 moment.
-       *  The returned iterator is thread safe 
+       *  The returned iterator is not locked.
        */
       iterator
       end();
 
       /** Obtain a const_iterator for the last+1 moment.
        *  @return An const_iterator pointing to the last+1 moment.
-       *  The returned iterator is thread safe 
+       *  The returned iterator is not locked.
        */
       const_iterator
       end() const;
@@ -207,43 +213,8 @@ namespace ICR{
 
 
     private:
-      
-      
-      struct plus
-      {
-	typename Moments<T>::data_type
-	operator()(data_parameter i, 
-		   data_parameter j) 
-	{
-	  return i+j;
-	}
-      };
-
-      struct times
-      {
-      	typename Moments<T>::data_type
-      	operator()(data_parameter i, 
-      		   data_parameter j) 
-      	{
-      	  return i*j;
-      	}
-      };
-
-      struct times_by{
-	times_by(data_parameter t) : m_t(t) {};
-  
-	data_type
-	operator()(data_parameter d)
-	{ 
-	  return d*m_t; 
-	}
-      private:
-	T m_t;
-      };
-
 
       std::vector<T> m_data;
-      mutable Mutex m_mutex;
 
     };
 
@@ -316,23 +287,20 @@ namespace ICR{
 template<class T>
 inline
 ICR::EnsembleLearning::Moments<T>::Moments( vector_parameter data)
-  : m_data(data),
-    m_mutex()
+  : m_data(data)
 {}
 
 template<class T> 
 inline   
 ICR::EnsembleLearning::Moments<T>::Moments( size_parameter size)
-  : m_data(std::vector<T>(size)),
-    m_mutex() //non-copiable
+  : m_data(std::vector<T>(size))
 {}
 
 template<class T> 
 inline   
 ICR::EnsembleLearning::Moments<T>::Moments(data_parameter d1,
 			      data_parameter d2)
-  : m_data(2),
-    m_mutex() //non-copiable
+  : m_data(2)
 {
   m_data[0] = d1;
   m_data[1] = d2;
@@ -341,8 +309,7 @@ ICR::EnsembleLearning::Moments<T>::Moments(data_parameter d1,
 template<class T> 
 inline   
 ICR::EnsembleLearning::Moments<T>::Moments(parameter other)
-  : m_data(other.m_data),
-    m_mutex() //non-copiable
+  : m_data(other.m_data)
 {}
       
 template<class T> 
@@ -352,17 +319,24 @@ ICR::EnsembleLearning::Moments<T>::operator=(parameter other)
 {    
   if (this!= &other) {
     m_data = (other.m_data);
-    // m_mutex non-copiable  
   }
   return *this;
 }
 
+template<class T> 
+inline   
+void
+ICR::EnsembleLearning::Moments<T>::swap(reference other)
+{    
+  m_data.swap(other.m_data);
+}
+
 template<class T>  
 inline  
 typename ICR::EnsembleLearning::Moments<T>::iterator
 ICR::EnsembleLearning::Moments<T>::begin()
 {
-  return iterator(this,0);
+  return m_data.begin();
 }
 
 template<class T>
@@ -370,7 +344,7 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::const_iterator
 ICR::EnsembleLearning::Moments<T>::begin() const
 {
-  return const_iterator (this,0);
+  return m_data.begin();
 }
 
 template<class T>
@@ -378,7 +352,7 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::iterator
 ICR::EnsembleLearning::Moments<T>::end()
 {
-  return iterator(this,m_data.size());
+  return m_data.end();
 }
 
 
@@ -387,7 +361,7 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::const_iterator
 ICR::EnsembleLearning::Moments<T>::end() const
 {
-  return const_iterator(this,m_data.size());
+  return m_data.end();
 }
 
 
@@ -396,7 +370,6 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::data_const_reference
 ICR::EnsembleLearning::Moments<T>::operator[](size_parameter index) const
 {
-  Lock lock(m_mutex); 
   return m_data[index];
 }
       
@@ -405,7 +378,6 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::data_reference
 ICR::EnsembleLearning::Moments<T>::operator[](size_parameter index)
 {
-  Lock lock(m_mutex); 
   return m_data[index];
 }
       
@@ -414,9 +386,10 @@ template<class T>
 typename ICR::EnsembleLearning::Moments<T>::reference  
 ICR::EnsembleLearning::Moments<T>::operator+=(parameter other)
 {
-  //This could be called by different threads, so lock
-  Lock lock(m_mutex);  
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(), other.begin(), m_data.begin(), plus());
+  //There are only a few moments, so a plain loop
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] += other.m_data[i];
+  }
   return *this;
 }
       
@@ -425,9 +398,9 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::reference
 ICR::EnsembleLearning::Moments<T>::operator*=(parameter other)
 {
-  //This could be called by different threads, so lock
-  Lock lock(m_mutex); 
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(), other.begin(), m_data.begin(), times() );
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] *= other.m_data[i];
+  }
   return *this;
 }
 
@@ -436,9 +409,9 @@ inline
 typename ICR::EnsembleLearning::Moments<T>::reference
 ICR::EnsembleLearning::Moments<T>::operator*=(data_parameter d)
 {
-  //This could be called by different threads, so lock
-  Lock lock(m_mutex); 
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(),  m_data.begin(), times_by(d));
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] *= d;
+  }
   return *this;
 }
       
@@ -35,6 +35,8 @@
 
 #include <iostream>
 #include<vector>
+#include <algorithm>
+#include <omp.h>
 
 
 namespace ICR{
@@ -198,48 +200,6 @@ namespace ICR{
 		const Moments<U>& b);
     private:
 
-      struct plus
-      {
-	data_type
-	operator()(data_parameter i, 
-		   data_parameter j) 
-	{
-	  return i+j;
-	}
-      };
-
-      struct minus
-      {
-	data_type
-	operator()(data_parameter i, 
-		   data_parameter j) 
-	{
-	  return i-j;
-	}
-      };
-
-      struct times
-      {
-      	data_type
-      	operator()(data_parameter i, 
-      		   data_parameter j) 
-      	{
-      	  return i*j;
-      	}
-      };
-     
-      struct times_by{
-	times_by(data_parameter t) : m_t(t) {};
-  
-	data_type
-	operator()(data_parameter d)
-	{ 
-	  return d*m_t; 
-	}
-      private:
-	data_type m_t;
-      };
-
       std::vector<data_type> m_data;
       
 
@@ -280,6 +240,54 @@ namespace ICR{
       return tmp+=b;
     }  
     
+    /** Sum the Natural Parameters messages f(*i) for each i in [first, last).
+     *  The messages are stored in T, but the sum is accumulated in double, 
+     *  so a model held in float does not lose accuracy over a large number of children.
+     *  The messages are summed in fixed blocks (in parallel) and the blocks are then added in order,
+     *  so the result does not depend upon the number of threads.
+     *  @param first The first element to sum over.
+     *  @param last One past the last element to sum over.
+     *  @param f A function that returns the Natural Parameters for an element.
+     *  @param init The initial value of the sum 
+     *   (if it is empty the size is taken from the messages).
+     *  @return The sum of init and the messages.
+     */
+    template<class T, class RandomAccessIterator, class Function>
+    inline
+    NaturalParameters<T>
+    accumulate_natural_parameters(RandomAccessIterator first,
+				  RandomAccessIterator last,
+				  Function f,
+				  const NaturalParameters<T>& init)
+    {
+      const long block = 256;
+      const long n = last - first;
+      const long blocks = (n + block - 1)/block;
+      std::vector<std::vector<double> > partial(blocks);
+      
+#pragma omp parallel for schedule(static) if(blocks > 1 && !omp_in_parallel())
+      for(long b=0;b<blocks;++b){
+	std::vector<double>& sum = partial[b];
+	const long end = std::min(n, (b+1)*block);
+	for(long i=b*block;i<end;++i){
+	  const NaturalParameters<T> NP = f(*(first+i));
+	  if (sum.size() < NP.size()) sum.resize(NP.size(), 0.0);
+	  for(size_t j=0;j<NP.size();++j){
+	    sum[j] += NP[j];
+	  }
+	}
+      }
+      
+      std::vector<double> total(init.begin(), init.end());
+      for(long b=0;b<blocks;++b){
+	if (total.size() < partial[b].size()) total.resize(partial[b].size(), 0.0);
+	for(size_t j=0;j<partial[b].size();++j){
+	  total[j] += partial[b][j];
+	}
+      }
+      return NaturalParameters<T>(std::vector<T>(total.begin(), total.end()));
+    }
+    
     /** Subtract two Natural Parameters containers.
      *  @param a The first Natural Parameters  container.
      *  @param b The second Natural Parameters container.
@@ -310,11 +318,15 @@ namespace ICR{
     operator*(const NaturalParameters<T>&  a, 
 	      const Moments<T>& b)
     { 
-      std::vector<T> prod(a.size());
-      PARALLEL_TRANSFORM(a.begin(), a.end(), b.begin(), prod.begin(), 
-			 typename NaturalParameters<T>::times());
-      T sum = 0.0;
-      return PARALLEL_ACCUMULATE(prod.begin(), prod.end(), sum);
+      //accumulated in double (whatever T is)
+      //Most of the models have a pair of moments
+      if (a.size() == 2)
+	return double(a[0])*b[0] + double(a[1])*b[1];
+      double sum = 0.0;
+      for(size_t i=0;i<a.size();++i){
+	sum += double(a[i])*b[i];
+      }
+      return sum;
     }  
       
 
@@ -447,10 +459,10 @@ ICR::EnsembleLearning::NaturalParameters<T>::operator+=(parameter other)
   //  boost::lock_guard<boost::mutex> lock(*m_mutex_ptr);  //DO KEEP THIS ONE!
   //  std::cout<<"size = "<<m_data.size()<<"other = "<<m_data.size<<std::endl;
 
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(), other.begin(), m_data.begin(), plus());
-  // for(size_t i=0;i<other.size();++i){
-  //   m_data[i]+=other[i];
-  // }
+  //There are only a few natural parameters, so a plain loop
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] += other.m_data[i];
+  }
 
   return *this;
 }
@@ -463,7 +475,9 @@ ICR::EnsembleLearning::NaturalParameters<T>::operator-=(parameter other)
 {
   //This could be called by different threads, so lock
   //  boost::lock_guard<boost::mutex> lock(*m_mutex_ptr);  //DO KEEP THIS ONE!
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(), other.begin(), m_data.begin(), minus());
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] -= other.m_data[i];
+  }
   return *this;
 }
   
@@ -472,8 +486,9 @@ inline
 typename ICR::EnsembleLearning::NaturalParameters<T>::reference
 ICR::EnsembleLearning::NaturalParameters<T>::operator*=(data_parameter other)
 {
-  
-  PARALLEL_TRANSFORM(m_data.begin(), m_data.end(), m_data.begin(), times_by(other));
+  for(size_t i=0;i<m_data.size();++i){
+    m_data[i] *= other;
+  }
   return *this;
 }    
 
@@ -0,0 +1,172 @@
+#pragma once
+#ifndef COSTLOGGER_HPP
+#define COSTLOGGER_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+#include "EnsembleLearning/monitor/Sink.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** Pass CostRecord's to a set of sinks on a background thread.
+     *  Pushing a record only copies it into a queue, 
+     *  so the inference never waits on the console or the disk.
+     *  The thread is started by the first record that is pushed,
+     *  records pushed while there are no sinks are dropped.
+     */
+    class CostLogger : boost::noncopyable
+    {
+    public:
+      /** Constructor. No thread is started until the first record arrives. */
+      CostLogger()
+	: m_sinks(),
+	  m_queue(),
+	  m_pushed(0),
+	  m_written(0),
+	  m_stop(false),
+	  m_mutex(),
+	  m_work(),
+	  m_done(),
+	  m_thread()
+      {}
+
+      /** Destructor. Any records still queued are written before the thread exits. */
+      ~CostLogger()
+      {
+	{
+	  boost::lock_guard<boost::mutex> lock(m_mutex);
+	  m_stop = true;
+	}
+	m_work.notify_one();
+	if (m_thread)
+	  m_thread->join();
+      }
+
+      /** Add a sink.
+       *  @param sink The sink to which all subsequent records are written.
+       */
+      void
+      add_sink(const boost::shared_ptr<CostSink>& sink)
+      {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_sinks.push_back(sink);
+      }
+
+      /** Remove a sink.
+       *  @param sink The sink to remove, no more records are written to it.
+       */
+      void
+      remove_sink(const boost::shared_ptr<CostSink>& sink)
+      {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+      }
+
+      /** Queue a record to be written.
+       *  @param r The record.
+       */
+      void
+      push(const CostRecord& r)
+      {
+	{
+	  boost::lock_guard<boost::mutex> lock(m_mutex);
+	  //Nobody is listening (a quiet model), so there is no need for a thread.
+	  if (m_sinks.empty())
+	    return;
+	  if (!m_thread) 
+	    m_thread.reset(new boost::thread(boost::bind(&CostLogger::run, this)));
+	  m_queue.push_back(r);
+	  ++m_pushed;
+	}
+	m_work.notify_one();
+      }
+
+      /** Wait until every record pushed so far has been written and the sinks flushed. */
+      void
+      flush()
+      {
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	const size_t target = m_pushed;
+	while(m_written < target)
+	  m_done.wait(lock);
+      }
+      
+    private:
+      void
+      run()
+      {
+	std::vector<CostRecord> batch;
+	std::vector<boost::shared_ptr<CostSink> > sinks;
+	while(true) {
+	  {
+	    boost::unique_lock<boost::mutex> lock(m_mutex);
+	    while(m_queue.empty() && !m_stop)
+	      m_work.wait(lock);
+	    if (m_queue.empty() && m_stop)
+	      return;
+	    batch.swap(m_queue);
+	    sinks = m_sinks;
+	  }
+	  for(size_t s=0;s<sinks.size();++s){
+	    for(size_t i=0;i<batch.size();++i){
+	      sinks[s]->write(batch[i]);
+	    }
+	    sinks[s]->flush();
+	  }
+	  {
+	    boost::lock_guard<boost::mutex> lock(m_mutex);
+	    m_written += batch.size();
+	  }
+	  batch.clear();
+	  m_done.notify_all();
+	}
+      }
+
+      std::vector<boost::shared_ptr<CostSink> > m_sinks;
+      std::vector<CostRecord> m_queue;
+      size_t m_pushed, m_written;
+      bool m_stop;
+      boost::mutex m_mutex;
+      boost::condition_variable m_work, m_done;
+      boost::scoped_ptr<boost::thread> m_thread;
+    };
+
+  }
+}
+
+#endif  // guard for COSTLOGGER_HPP
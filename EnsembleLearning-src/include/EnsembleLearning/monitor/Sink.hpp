@@ -0,0 +1,212 @@
+#pragma once
+#ifndef SINK_HPP
+#define SINK_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+#include <boost/circular_buffer.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace ICR{
+  namespace EnsembleLearning{
+
+    /** The record of a single convergence check made during the inference.
+     */
+    struct CostRecord
+    {
+      /** The number of iterations made on the model (including any skipped ones). */
+      size_t iteration;
+      /** The cost (per data point). */
+      double cost;
+      /** The percentage change in the cost since the previous check. */
+      double delta;
+      /** The wall time (in seconds) since the builder started running. */
+      double time;
+      /** The number of variable nodes that were updated in the iteration. */
+      size_t active_nodes;
+    };
+    
+    /** Output a record as a single tab separated line.
+     *  @param out The output stream.
+     *  @param r The record.
+     *  @return A reference to the output stream.
+     */
+    inline
+    std::ostream&
+    operator<<(std::ostream& out, const CostRecord& r)
+    {
+      out<<r.iteration<<"\t"<<r.cost<<"\t"<<r.delta<<"\t"<<r.time<<"\t"<<r.active_nodes;
+      return out;
+    }
+
+    /** The interface to the destinations of the CostRecord's.
+     *  The sinks are only ever written to by the single background thread of the CostLogger,
+     *  so an implementation need not be thread safe unless it is also read from elsewhere.
+     */
+    class CostSink
+    {
+    public:
+      /** Write a record.
+       *  @param r The record to write.
+       */
+      virtual
+      void
+      write(const CostRecord& r) = 0;
+
+      /** Flush any buffered output. */
+      virtual
+      void
+      flush() {};
+
+      /** Destructor */
+      virtual
+      ~CostSink() {};
+    };
+
+    /** Print the cost to the console, in the same form as it has always been printed.
+     */
+    class ConsoleSink : public CostSink
+    {
+    public:
+      void
+      write(const CostRecord& r)
+      {
+	std::cout<<"COST = "<<r.cost<<"\t% difference = "<<r.delta<<std::endl;
+      }
+    };
+
+    /** Write the records to a file.
+     *  The file is opened once and written through a buffer.
+     */
+    class FileSink : public CostSink
+    {
+    public:
+      /** Constructor.
+       *  @param filename The file to write to (it is truncated).
+       *  @param full_record If false (the default) only the cost is written, one per line, 
+       *   which is the format of the cost file.
+       *   Otherwise the full record is written as tab separated columns.
+       */
+      FileSink(const std::string& filename, bool full_record = false)
+	: m_file(filename.c_str()),
+	  m_full_record(full_record)
+      {
+	if (m_full_record) 
+	  m_file<<"#iteration\tcost\tdelta\ttime\tnodes\n";
+	else
+	  m_file<<"#Data\n";
+      }
+
+      void
+      write(const CostRecord& r)
+      {
+	if (m_full_record)
+	  m_file<<r<<"\n";
+	else
+	  m_file<<r.cost<<"\n";
+      }
+
+      void
+      flush()
+      {
+	m_file.flush();
+      }
+    private:
+      std::ofstream m_file;
+      bool m_full_record;
+    };
+
+    /** Keep the most recent records in memory.
+     */
+    class RingBufferSink : public CostSink
+    {
+    public:
+      /** Constructor.
+       *  @param capacity The number of records kept.
+       *   Once full, the oldest records are overwritten.
+       */
+      RingBufferSink(size_t capacity = 1000)
+	: m_records(capacity),
+	  m_mutex()
+      {}
+
+      void
+      write(const CostRecord& r)
+      {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_records.push_back(r);
+      }
+
+      /** Copy the stored records.
+       *  @return The stored records, oldest first.
+       */
+      std::vector<CostRecord>
+      records() const
+      {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return std::vector<CostRecord>(m_records.begin(), m_records.end());
+      }
+
+    private:
+      boost::circular_buffer<CostRecord> m_records;
+      mutable boost::mutex m_mutex;
+    };
+
+    /** Pass each record to a user supplied function.
+     *  The function is called from the background thread of the CostLogger.
+     */
+    class CallbackSink : public CostSink
+    {
+    public:
+      /** The type of the function that is called. */
+      typedef boost::function<void (const CostRecord&)> callback_type;
+      
+      /** Constructor.
+       *  @param callback The function to be called with every record.
+       */
+      CallbackSink(const callback_type& callback)
+	: m_callback(callback)
+      {}
+
+      void
+      write(const CostRecord& r)
+      {
+	m_callback(r);
+      }
+    private:
+      callback_type m_callback;
+    };
+
+  }
+}
+
+#endif  // guard for SINK_HPP
@@ -31,6 +31,7 @@
 #include "EnsembleLearning/message/Coster.hpp"
 #include <boost/call_traits.hpp>
 #include <vector>
+#include <set>
 #include <iostream>
 
 namespace ICR{
@@ -61,12 +62,30 @@ namespace ICR{
       const Moments<T>&
       GetMoments()  = 0;
 
+      /** Overwrite the moments stored in this node.
+       *  This is used to restore a previously saved state of the model,
+       *  nodes whose moments are not inferred (the observed nodes) ignore the request.
+       *  @param m The moments to store.
+       */
+      virtual
+      void
+      SetMoments(const Moments<T>& m) = 0;
+
       /** Initialise the moments to this node.
        *  The moments are random based upon the prior moments (of the parent nodes)*/
       virtual
       void
       InitialiseMoments()  = 0;
 
+      /** A count of the changes to the moments of the node.
+       *  It changes whenever the moments do (and only increases),
+       *  so that a calculation can tell whether its parents have moved since it last read them.
+       *  @return The version of the moments.
+       */
+      virtual
+      size_t
+      GetVersion() = 0;
+
       /** Set the parent factor for a node.
        *  Every variable node has only one parent factor, 
        *  which composes the messages from parent nodes.
@@ -89,6 +108,16 @@ namespace ICR{
       virtual
       void
       AddChildFactor(FactorNode<T>* f) = 0;
+
+      /** Add several child factors to a node at once.
+       *  This is used by the builder to hand over the children staged while building concurrently,
+       *  when no other thread is adding to this node, so no lock is taken.
+       *  @param first A pointer to the first child factor.
+       *  @param last One past the last child factor.
+       */
+      virtual
+      void
+      AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last) = 0;
       
       /** Collect a vector of means from the node.
        *  @return A vector containing all the means of the node.
@@ -115,6 +144,102 @@ namespace ICR{
       void
       Iterate(Coster& Cost) = 0;
 
+      /** Update the stored moments as Iterate() does, but without evaluating the cost.
+       *  @return The largest change in a natural parameter of the node, 
+       *   relative to its previous size (zero for nodes that are not updated).
+       */
+      virtual
+      T
+      Update() = 0;
+
+      /** Evaluate the contribution of this node to the cost.
+       *  This uses the natural parameters of the last update 
+       *  and the current moments of the adjacent nodes,
+       *  so that after a sweep of Update() the total is the bound of the current model.
+       *  @param Cost The total cost of the approximation to which this node contributes.
+       */
+      virtual
+      void
+      EvaluateCost(Coster& Cost) = 0;
+
+      /** @name Distributed inference.
+       *  When the data is partitioned across processes 
+       *  the messages from the child factors in the partition are summed over all the processes.
+       */
+      ///@{
+      
+      /** Separate the child factors that belong to the partition of the data.
+       *  @param partitioned The set of factors that are in the partition.
+       *  @return The number of child factors that are in the partition.
+       */
+      virtual
+      size_t
+      PartitionChildren(const std::set<FactorNode<T>*>& partitioned) = 0;
+      
+      /** The sum of the messages from the child factors in this processes partition.
+       *  @return The local partial sum of the natural parameters.
+       */
+      virtual
+      NaturalParameters<T>
+      GetPartitionedNP() = 0;
+      
+      /** Set the sum of the partitioned messages over all processes.
+       *  This is added to the messages from the other factors in the next update.
+       *  @param NP The natural parameters summed over all the processes.
+       */
+      virtual
+      void
+      SetReducedNP(const NaturalParameters<T>& NP) = 0;
+      ///@}
+
+      /** @name Synchronous updates.
+       *  In a synchronous sweep every node reads the moments of the previous sweep 
+       *  and writes its own into a second buffer, 
+       *  so the nodes can be updated in any order (and in parallel) without locks.
+       *  The buffers are exchanged once every node has been updated.
+       */
+      ///@{
+
+      /** Switch the synchronous updates on or off.
+       *  @param synchronous If true Iterate() writes the moments of the next sweep
+       *   and GetMoments() returns the moments of the current sweep until SwapMoments() is called.
+       */
+      virtual
+      void
+      SetSynchronous(const bool synchronous) = 0;
+
+      /** Make the moments of the next sweep current.
+       *  This must be called for every node, in the order that they were built, between sweeps.
+       */
+      virtual
+      void
+      SwapMoments() = 0;
+      ///@}
+
+      /** @name Acceleration.
+       *  The natural parameters of the hidden nodes, stacked in build order,
+       *  are extrapolated between sweeps to speed up the convergence.
+       */
+      ///@{
+
+      /** Append the natural parameters found in the last update to a stack.
+       *  @param stack The stack of natural parameters.
+       *  Nodes that are not inferred append nothing.
+       */
+      virtual
+      void
+      GetNaturalParameters(std::vector<double>& stack) = 0;
+
+      /** Set the moments from natural parameters taken from a stack.
+       *  @param it The position in the stack, which is moved past this node's parameters.
+       *  @return False if the parameters do not describe a valid distribution, 
+       *   in which case the node is left unchanged.
+       */
+      virtual
+      bool
+      SetNaturalParameters(std::vector<double>::const_iterator& it) = 0;
+      ///@}
+
       /** Destructor. */
       virtual 
       ~VariableNode(){};
@@ -178,6 +303,13 @@ namespace ICR{
       Moments<T>
       InitialiseMoments() const  = 0;
 
+      /** Collect the variable nodes adjacent to this factor (its parents and its child).
+       *  @param nodes The adjacent nodes are appended to this vector, the child last.
+       */
+      virtual
+      void
+      GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const = 0;
+
       /** Destructor */
       virtual 
       ~FactorNode(){};
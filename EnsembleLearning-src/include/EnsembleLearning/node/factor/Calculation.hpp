@@ -29,6 +29,8 @@
 
 #include "EnsembleLearning/node/Node.hpp"
 #include "EnsembleLearning/calculation_tree/Context.hpp"
+#include "EnsembleLearning/message/NaturalParameters.hpp"
+#include "EnsembleLearning/detail/Mutex.hpp"
 
 #include <boost/call_traits.hpp> 
 
@@ -46,6 +48,9 @@ namespace ICR{
       
       /** A Deterministic Factor.
        *  The Calculation Nodes pass existing moments through an expression.
+       *  A calculation shared by many children is asked for its moments by each of them,
+       *  so the message to the child is kept, and only worked out again once a parent has changed
+       *  (the versions of the parents are summed, and each only increases).
        *  @tparam Model  The model to use for the data data.
        *  @tparam T The data type (float or double)
        */
@@ -75,7 +80,11 @@ namespace ICR{
 		       DeterministicNode<Model<T>,T>* Child)
 	  : m_expr(Expr),
 	    m_context(context),
-	    m_child_node(Child)
+	    m_child_node(Child),
+	    m_forward(),
+	    m_version(0),
+	    m_cached(false),
+	    m_mutex()
 	{
 
 	  Child->SetParentFactor(this);
@@ -100,7 +109,15 @@ namespace ICR{
 	{
 	  if (v == m_child_node) 
 	    {
-	      return Model<T>::CalcNP2Deterministic(m_expr,m_context);
+	      const size_t version = ParentVersion();
+	      //(one child works the message out while the others wait for it)
+	      Lock lock(m_mutex);
+	      if (!m_cached || version != m_version) {
+		m_forward = Model<T>::CalcNP2Deterministic(m_expr,m_context);
+		m_version = version;
+		m_cached = true;
+	      }
+	      return m_forward;
 	    }
 	  else
 	    {
@@ -110,10 +127,48 @@ namespace ICR{
 	}
 	T
 	CalcLogNorm() const {return 0;}
+
+	/** The expression evaluated by the factor. */
+	Expression<T>*
+	GetExpression() const {return m_expr;}
+
+	/** The context (the parent nodes) of the expression. */
+	const Context<T>&
+	GetContext() const {return m_context;}
+
+	/** Collect the adjacent nodes.
+	 *  @param nodes The nodes in the context and the child are appended to this vector.
+	 */
+	void
+	GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+	{
+	  typename Context<T>::DataContainer::const_iterator it;
+	  for(it = m_context.m_map.begin(); it != m_context.m_map.end(); ++it){
+	    nodes.push_back(it->first);
+	  }
+	  nodes.push_back(m_child_node);
+	}
+
       private: 
+	//The sum of the versions of the parents.
+	size_t
+	ParentVersion() const
+	{
+	  size_t version = 0;
+	  typename Context<T>::DataContainer::const_iterator it;
+	  for(it = m_context.m_map.begin(); it != m_context.m_map.end(); ++it){
+	    version += it->first->GetVersion();
+	  }
+	  return version;
+	}
+
 	Expression<T>* m_expr;
 	Context<T> m_context;
 	mutable DeterministicNode<Model<T>,T> *m_child_node;
+	mutable NaturalParameters<T> m_forward;
+	mutable size_t m_version;
+	mutable bool m_cached;
+	mutable Mutex m_mutex;
       
       };
     
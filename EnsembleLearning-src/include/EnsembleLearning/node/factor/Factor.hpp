@@ -163,6 +163,17 @@ namespace ICR{
 	  }
       }
 
+      /** Collect the adjacent nodes.
+       *  @param nodes The parents and the child are appended to this vector.
+       */
+      void
+      GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+      {
+	nodes.push_back(m_parent1_node);
+	nodes.push_back(m_parent2_node);
+	nodes.push_back(m_child_node);
+      }
+
     private: 
       variable_t m_parent1_node, m_parent2_node, m_child_node;
       mutable data_t m_LogNorm;  //no need for mutex to protect this variable.
@@ -261,6 +272,16 @@ namespace ICR{
 	return Dirichlet<T>::CalcNP2Data(prior);
       }
       
+      /** Collect the adjacent nodes.
+       *  @param nodes The parents and the child are appended to this vector.
+       */
+      void
+      GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+      {
+	nodes.push_back(m_prior_node);
+	nodes.push_back(m_child_node);
+      }
+
     private: 
       variable_t m_prior_node,  m_child_node;
       
@@ -368,6 +389,16 @@ namespace ICR{
 	  }
       }
       
+      /** Collect the adjacent nodes.
+       *  @param nodes The parents and the child are appended to this vector.
+       */
+      void
+      GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+      {
+	nodes.push_back(m_prior_node);
+	nodes.push_back(m_child_node);
+      }
+
     private: 
       variable_t m_prior_node, m_child_node;
       mutable T  m_LogNorm; //no need for mutex to protect this variable.
@@ -35,6 +35,11 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/none.hpp>
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
 
 namespace ICR{
   namespace EnsembleLearning{
@@ -49,6 +54,76 @@ namespace ICR{
     
     namespace detail{
 
+    /** The components that the data points of a truncated mixture choose between in a sweep.
+     *  It is shared by every factor of the mixture and refreshed (by the builder) before each sweep.
+     *  It holds the components with the largest expected log weights,
+     *  and as many others from a window that moves on every sweep,
+     *  so that in time every point tries every component.
+     */
+    template<class T>
+    class Shortlist
+    {
+    public:
+      Shortlist() : m_keep(0), m_offset(0), m_components(), m_log_weights() {}
+
+      /** Widen the shortlist.
+       *  @param keep The number of components kept for each point by a mixture that shares it.
+       */
+      void
+      Keep(const size_t keep) {m_keep = std::max(m_keep, keep);}
+
+      /** Choose the components for the next sweep.
+       *  @param log_weights The moments of the weights (the expected log weight of each component).
+       *  @param active The components that have not been pruned.
+       */
+      void
+      Refresh(const Moments<T>& log_weights, const std::vector<size_t>& active);
+
+      /** The components to choose from, in order. */
+      const std::vector<size_t>&
+      components() const {return m_components;}
+
+      /** The expected log weight of every component when the shortlist was refreshed (empty before). */
+      const std::vector<T>&
+      log_weights() const {return m_log_weights;}
+
+    private:
+      size_t m_keep, m_offset;
+      std::vector<size_t> m_components;
+      std::vector<T> m_log_weights;
+    };
+
+    template<class T>
+    inline
+    void
+    Shortlist<T>::Refresh(const Moments<T>& log_weights, const std::vector<size_t>& active)
+    {
+      m_log_weights.assign(log_weights.begin(), log_weights.end());
+      if (active.size() <= 2*m_keep) {
+	m_components = active;
+	return;
+      }
+      //The heaviest components (the first of any that tie)
+      std::vector<std::pair<T, size_t> > ranked(active.size());
+      for(size_t a=0;a<active.size();++a){
+	ranked[a] = std::make_pair(-m_log_weights[active[a]], active[a]);
+      }
+      std::partial_sort(ranked.begin(), ranked.begin() + m_keep, ranked.end());
+      m_components.clear();
+      for(size_t a=0;a<m_keep;++a){
+	m_components.push_back(ranked[a].second);
+      }
+      std::sort(m_components.begin(), m_components.end());
+      //and the window.
+      for(size_t j=0;j<active.size() && m_components.size() < 2*m_keep;++j){
+	const size_t i = active[(m_offset + j)%active.size()];
+	if (!std::binary_search(m_components.begin(), m_components.begin() + m_keep, i))
+	  m_components.push_back(i);
+      }
+      m_offset = (m_offset + m_keep)%active.size();
+      std::sort(m_components.begin(), m_components.end());
+    }
+
     /******************************************************************************
      * Default Specialisation
      ******************************************************************************/
@@ -80,6 +155,18 @@ namespace ICR{
       typedef typename boost::call_traits<HiddenNode<Discrete,T >*>::value_type
       discrete_parameter;
 
+      /** The indices of the components that are still active (shared by every factor of the mixture). */
+      typedef boost::shared_ptr<std::vector<size_t> > 
+      active_t;
+
+      /** The components that a truncated mixture chooses between in a sweep (shared by every factor of the mixture). */
+      typedef boost::shared_ptr<Shortlist<T> > 
+      shortlist_t;
+
+      /** A component that a data point is assigned to, and its responsibility. */
+      typedef std::pair<size_t, T>
+      kept_t;
+
       ///@}
       
       /** Construct a mixture node.
@@ -88,21 +175,44 @@ namespace ICR{
        * @param Weights The Weights on each of the vectors 
        *   (The size of the weights need to be the same as sthe size of the vectors)
        * @param child The child node.
+       * @param active The indices of the active components.
+       *   Components that have been pruned from this list are skipped: 
+       *   the child is never assigned to them and they receive no messages.
+       *   If none is given every component is active.
+       * @param keep The number of components the child can be assigned to (zero for all of them).
+       *   Only the most responsible components are kept,
+       *   the responsibility of the others is zero and they are skipped by the messages.
+       * @param shortlist The components that are tried for the child in each sweep, 
+       *   as well as the ones it was assigned to in the last.
+       *   If none is given (or before it is first refreshed) every active component is tried.
        */
       Mixture(variable_vector_parameter Parent1, 
 	      variable_vector_parameter Parent2,  
 	      discrete_parameter Weights,
-	      variable_parameter child
-	      
+	      variable_parameter child,
+	      const active_t& active = active_t(),
+	      const size_t keep = 0,
+	      const shortlist_t& shortlist = shortlist_t()
 	       )
 	:  m_parent1_nodes(Parent1), 
 	   m_parent2_nodes(Parent2),
 	   m_weights_node(Weights),
 	   m_child_node(child),
+	   m_active(active),
+	   m_keep(keep),
+	   m_shortlist(shortlist),
+	   m_kept(),
+	   m_tail(0),
 	   m_LogNorm(0)
       {
 	//Need to be as many parents to both.
 	BOOST_ASSERT(Parent1.size() == Parent2.size());
+	if (!m_active) {
+	  m_active.reset(new std::vector<size_t>(Parent1.size()));
+	  for(size_t i=0;i<Parent1.size();++i){
+	    (*m_active)[i] = i;
+	  }
+	}
 	
     	child->SetParentFactor(this);
 	for(size_t i=0;i<Parent1.size();++i){
@@ -159,12 +269,44 @@ namespace ICR{
        */
       NaturalParameters<T>
       GetNaturalNot( variable_parameter v) const;
+
+      /** Collect the adjacent nodes.
+       *  @param nodes The parents of every component, the weights and the child are appended to this vector.
+       */
+      void
+      GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+      {
+	nodes.insert(nodes.end(), m_parent1_nodes.begin(), m_parent1_nodes.end());
+	nodes.insert(nodes.end(), m_parent2_nodes.begin(), m_parent2_nodes.end());
+	nodes.push_back(m_weights_node);
+	nodes.push_back(m_child_node);
+      }
+
+      /** The number of components the child can be assigned to (zero for all of them). */
+      size_t
+      keep() const {return m_keep;}
+
+      /** The components the child was assigned to when the mixture was last truncated, 
+       *  with their responsibilities (renormalised over them).
+       *  This is empty if the mixture is not truncated.
+       */
+      const std::vector<kept_t>&
+      kept() const {return m_kept;}
+
+      /** The responsibility of the components that were tried but not kept, before the renormalisation. */
+      T
+      tail() const {return m_tail;}
       
     private: 
 
       variable_vector_t m_parent1_nodes, m_parent2_nodes;
       discrete_t m_weights_node;
       variable_t  m_child_node;
+      active_t m_active;
+      size_t m_keep;
+      shortlist_t m_shortlist;
+      mutable std::vector<kept_t> m_kept;
+      mutable T m_tail;
       
       mutable T m_LogNorm;
     };
@@ -191,7 +333,11 @@ namespace ICR{
 	  m_LogNorm = 0;
 	  
 	  const Moments<T>& weights = m_weights_node->GetMoments();
-	  for(size_t i=0;i<m_parent1_nodes.size();++i){
+	  const std::vector<size_t>& active = *m_active;
+	  for(size_t a=0;a<active.size();++a){
+	    const size_t i = active[a];
+	    if (weights[i] == 0)
+	      continue; //truncated
 	    const Moments<T>& parent1 = m_parent1_nodes[i]->GetMoments();
 	    const Moments<T>& parent2 = m_parent2_nodes[i]->GetMoments();
 	    NP2Child
@@ -204,15 +350,71 @@ namespace ICR{
 	}
       else if (v == m_weights_node) 
 	{
-	  NaturalParameters<T> NP2Weights(m_parent1_nodes.size());
-	  
+	  //The pruned components are (all but) impossible.
+	  NaturalParameters<T> NP2Weights(std::vector<T>(m_parent1_nodes.size(), 
+							 -std::numeric_limits<T>::max()/4));
 
 	  const Moments<T>& child = m_child_node->GetMoments();
-	  for(size_t i=0;i<m_parent1_nodes.size();++i){
-	    const Moments<T>& parent1 = m_parent1_nodes[i]->GetMoments();
-	    const Moments<T>& parent2 = m_parent2_nodes[i]->GetMoments();
-	    NP2Weights[i] = Model::CalcAvLog(parent1, parent2,child);
+	  const std::vector<size_t>& active = *m_active;
+	  if (m_keep == 0 || m_keep >= active.size())
+	    {
+	      m_kept.clear();
+	      for(size_t a=0;a<active.size();++a){
+		const size_t i = active[a];
+		const Moments<T>& parent1 = m_parent1_nodes[i]->GetMoments();
+		const Moments<T>& parent2 = m_parent2_nodes[i]->GetMoments();
+		NP2Weights[i] = Model::CalcAvLog(parent1, parent2,child);
+	      }
+	      return NP2Weights;
+	    }
+
+	  //Only the shortlist and the components kept last time are tried
+	  // (every active one the first time).
+	  const std::vector<T> none;
+	  const std::vector<T>& log_weights = m_shortlist ? m_shortlist->log_weights() : none;
+	  std::vector<size_t> candidates;
+	  if (m_kept.empty() || log_weights.empty()) 
+	    candidates = active;
+	  else {
+	    std::vector<size_t> tried(m_shortlist->components());
+	    for(size_t k=0;k<m_kept.size();++k){
+	      tried.push_back(m_kept[k].first);
+	    }
+	    std::sort(tried.begin(), tried.end());
+	    //(the pruned components are dropped, the active ones are in order)
+	    std::set_intersection(tried.begin(), std::unique(tried.begin(), tried.end()),
+				  active.begin(), active.end(), std::back_inserter(candidates));
+	  }
+
+	  //Keep the most responsible (the first of any that tie).
+	  std::vector<std::pair<T, size_t> > ranked(candidates.size());
+	  std::vector<T> AvLog(candidates.size());
+	  for(size_t c=0;c<candidates.size();++c){
+	    const size_t i = candidates[c];
+	    AvLog[c] = Model::CalcAvLog(m_parent1_nodes[i]->GetMoments(), m_parent2_nodes[i]->GetMoments(), child);
+	    ranked[c] = std::make_pair(-(AvLog[c] + (log_weights.empty() ? 0 : log_weights[i])), c);
+	  }
+	  const size_t keep = std::min(m_keep, ranked.size());
+	  std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end());
+
+	  //The responsibilities of the kept components, and of the rest (which are dropped).
+	  const T LogMax = -ranked[0].first;
+	  double mass = 0, tail = 0;
+	  m_kept.resize(keep);
+	  for(size_t c=0;c<ranked.size();++c){
+	    const T r = std::exp(-ranked[c].first - LogMax);
+	    if (c < keep) {
+	      m_kept[c] = kept_t(candidates[ranked[c].second], r);
+	      NP2Weights[m_kept[c].first] = AvLog[ranked[c].second];
+	      mass += r;
+	    }
+	    else 
+	      tail += r;
+	  }
+	  for(size_t k=0;k<keep;++k){
+	    m_kept[k].second /= mass;
 	  }
+	  m_tail = tail/(mass + tail);
 	  return NP2Weights;
 	}
       else 
@@ -223,6 +425,9 @@ namespace ICR{
 	    {
 	      size_t i = it-m_parent1_nodes.begin();
 	      const Moments<T>& weights = m_weights_node->GetMoments();
+	      //A component with no responsibility for this point sends nothing.
+	      if (weights[i] == 0)
+		return NaturalParameters<T>(v->GetMoments().size());
 	      const Moments<T>& parent2 = m_parent2_nodes[i]->GetMoments();
 	      const Moments<T>& child = m_child_node->GetMoments();
 	      return Model::CalcNP2Parent1(parent2,child)  * weights[i];
@@ -232,6 +437,8 @@ namespace ICR{
 	      it = PARALLEL_FIND(m_parent2_nodes.begin(), m_parent2_nodes.end(), v);
 	      size_t i = it-m_parent2_nodes.begin();
 	      const Moments<T>& weights = m_weights_node->GetMoments();
+	      if (weights[i] == 0)
+		return NaturalParameters<T>(v->GetMoments().size());
 	      const Moments<T>& parent1 = m_parent1_nodes[i]->GetMoments();
 	      const Moments<T>& child = m_child_node->GetMoments();
 	      return Model::CalcNP2Parent2(parent1,child) * weights[i];
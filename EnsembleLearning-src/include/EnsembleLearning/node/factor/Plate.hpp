@@ -0,0 +1,524 @@
+#pragma once
+#ifndef FACTOR_PLATE_HPP
+#define FACTOR_PLATE_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+#include "EnsembleLearning/node/factor/Factor.hpp"
+#include "EnsembleLearning/exponential_model/Discrete.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <set>
+#include <limits>
+
+namespace ICR{
+  namespace EnsembleLearning{
+    
+    namespace detail{
+      
+      /** A Factor that joins a plate of observations to a common pair of parents.
+       *  The N observations are held by a single ObservedNode as their average moments.
+       *  Every message in the conjugate-exponential family is linear in the moments of the child,
+       *  so the sum of the N messages to a parent is N times the message from the average.
+       *  The same holds for the cost, so the message sent to the child (which only uses it for the cost)
+       *  is scaled by N too.
+       *  One factor and one node then replace N of each.
+       *  The observations of a mixture, or of a plate of hidden nodes, are not interchangeable like this,
+       *  and are held one after another instead (see MixturePlate and InstancePlate).
+       *  @tparam Model The model of the data: Gaussian, RectifiedGaussian or Gamma.
+       *  @tparam T The data type used - either float or double.
+       */
+      template<template<class> class Model, class T>
+      class Plate : public Factor<Model,T>
+      {
+      public:
+	/** @name Useful typdefs for types that are exposed to the user.
+	 */
+	///@{
+	typedef typename Factor<Model,T>::variable_parameter variable_parameter;
+	typedef typename Factor<Model,T>::NP_t               NP_t;
+	typedef typename Factor<Model,T>::data_t             data_t;
+	///@}
+
+	/** Constructor.
+	 *  @param Parent1 The first parent (the mean, or the shape for the Gamma model).
+	 *  @param Parent2 The second parent (the precision, or the inverse scale for the Gamma model).
+	 *  @param Child The ObservedNode holding the average moments of the observations.
+	 *  @param count The number of observations in the plate.
+	 */
+	Plate( variable_parameter Parent1,  
+	       variable_parameter Parent2,  
+	       variable_parameter Child,
+	       const size_t count)
+	  : Factor<Model,T>(Parent1, Parent2, Child),
+	    m_count(count)
+	{}
+	
+	/** The log normalisation summed over the plate.
+	 *  @return The log normalisation.
+	 */
+	data_t
+	CalcLogNorm() const 
+	{
+	  return data_t(m_count)*Factor<Model,T>::CalcLogNorm();
+	}
+	
+	/** The Natural Parameters summed over the plate.
+	 *  @param v The VariableNode where the NaturalParameter is sent.
+	 *  @return The NaturalParameter.
+	 */
+	NP_t
+	GetNaturalNot(variable_parameter v) const
+	{
+	  NP_t NP = Factor<Model,T>::GetNaturalNot(v);
+	  NP *= data_t(m_count);
+	  return NP;
+	}
+
+	/** The number of observations in the plate. */
+	size_t
+	size() const {return m_count;}
+
+      private:
+	size_t m_count;
+      };
+
+      /** The moments of one instance of a plate (see HiddenPlate).
+       *  @param moments The moments of every instance, one after another.
+       *  @param size The number of moments of each instance.
+       *  @param n The instance.
+       *  @return The moments of instance n.
+       */
+      template<class T>
+      inline
+      Moments<T>
+      instance_moments(const Moments<T>& moments, const size_t size, const size_t n)
+      {
+	return Moments<T>(std::vector<T>(moments.begin() + n*size, moments.begin() + (n+1)*size));
+      }
+
+      /** A Factor that joins a plate of Discrete nodes (a HiddenPlate) to their common Dirichlet weights.
+       *  Every instance receives the same message from the weights,
+       *  and the weights receive the sum of the moments of the instances.
+       *  @tparam T The data type used - either float or double.
+       */
+      template<class T>
+      class DiscretePlate : public FactorNode<T>
+      {
+      public:
+	/** @name Useful typdefs for types that are exposed to the user.
+	 */
+	///@{
+	typedef typename FactorNode<T>::variable_parameter variable_parameter;
+	typedef typename FactorNode<T>::variable_t         variable_t;
+	///@}
+
+	/** Constructor.
+	 *  @param Prior The Dirichlet weights.
+	 *  @param Child The plate of Discrete nodes.
+	 *  @param count The number of instances in the plate.
+	 */
+	DiscretePlate( variable_parameter Prior,  
+		       variable_parameter Child,
+		       const size_t count)
+	  : m_prior_node(Prior),
+	    m_child_node(Child),
+	    m_count(count),
+	    m_LogNorm(0)
+	{
+	  Child->SetParentFactor(this);
+	  Prior->AddChildFactor(this);
+	}
+
+	Moments<T>
+	InitialiseMoments() const
+	{
+	  const Moments<T> sample = Discrete<T>::CalcSample(m_prior_node->GetMoments());
+	  std::vector<T> moments;
+	  for(size_t n=0;n<m_count;++n){
+	    moments.insert(moments.end(), sample.begin(), sample.end());
+	  }
+	  return Moments<T>(moments);
+	}
+
+	/** The log normalisation summed over the plate. */
+	T
+	CalcLogNorm() const 
+	{
+	  return m_LogNorm;
+	}
+
+	NaturalParameters<T>
+	GetNaturalNot(variable_parameter v) const
+	{
+	  const Moments<T>& prior = m_prior_node->GetMoments();
+	  const size_t size = prior.size();
+	  if (v == m_prior_node)
+	    {
+	      //(the responsibilities of every instance, added up in double precision)
+	      const Moments<T>& child = m_child_node->GetMoments();
+	      std::vector<double> sum(size, 0.0);
+	      for(size_t n=0;n<m_count;++n){
+		for(size_t k=0;k<size;++k){
+		  sum[k] += child[n*size + k];
+		}
+	      }
+	      return Discrete<T>::CalcNP2Prior(Moments<T>(std::vector<T>(sum.begin(), sum.end())));
+	    }
+	  BOOST_ASSERT(v == m_child_node);
+	  m_LogNorm = T(m_count)*Discrete<T>::CalcLogNorm(prior);
+	  const NaturalParameters<T> NP = Discrete<T>::CalcNP2Data(prior);
+	  std::vector<T> plate;
+	  plate.reserve(m_count*size);
+	  for(size_t n=0;n<m_count;++n){
+	    plate.insert(plate.end(), NP.begin(), NP.end());
+	  }
+	  return NaturalParameters<T>(plate);
+	}
+
+	void
+	GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+	{
+	  nodes.push_back(m_prior_node);
+	  nodes.push_back(m_child_node);
+	}
+
+	/** The number of instances in the plate. */
+	size_t
+	size() const {return m_count;}
+
+      private:
+	variable_t m_prior_node, m_child_node;
+	size_t m_count;
+	mutable T m_LogNorm;
+      };
+
+      /** A Factor that joins a plate of children to a mixture.
+       *  Each instance of the child plate is drawn from the components 
+       *  in proportion to the responsibilities of the same instance of a plate of Discrete nodes
+       *  (see DiscretePlate), as Mixture does for a single child.
+       *  The child is either a HiddenPlate or an ObservedNode that holds the moments of every observation.
+       *  The messages to the parameters of the components are summed over the plate.
+       *  @tparam Model The model of the components: Gaussian<T> or RectifiedGaussian<T>.
+       *  @tparam T The data type used - either float or double.
+       */
+      template<class Model, class T>
+      class MixturePlate : public FactorNode<T>
+      {
+      public:
+	/** @name Useful typdefs for types that are exposed to the user.
+	 */
+	///@{
+	typedef typename FactorNode<T>::variable_parameter variable_parameter;
+	typedef typename FactorNode<T>::variable_t         variable_t;
+	
+	/** The indices of the components that are still active (shared by every factor of the mixture). */
+	typedef boost::shared_ptr<std::vector<size_t> > 
+	active_t;
+	///@}
+
+	/** Constructor.
+	 *  @param Parent1 The first parent of each component (for example the means).
+	 *  @param Parent2 The second parent of each component (for example the precisions).
+	 *  @param Catagory The plate of Discrete nodes that holds the responsibilities.
+	 *  @param Child The plate of children.
+	 *  @param count The number of instances in the plates.
+	 *  @param active The indices of the active components (every component if none is given).
+	 */
+	MixturePlate( const std::vector<VariableNode<T>*>& Parent1,  
+		      const std::vector<VariableNode<T>*>& Parent2,  
+		      variable_parameter Catagory,
+		      variable_parameter Child,
+		      const size_t count,
+		      const active_t& active = active_t())
+	  : m_parent1_nodes(Parent1),
+	    m_parent2_nodes(Parent2),
+	    m_catagory_node(Catagory),
+	    m_child_node(Child),
+	    m_count(count),
+	    m_active(active),
+	    m_LogNorm(0)
+	{
+	  BOOST_ASSERT(Parent1.size() == Parent2.size());
+	  if (!m_active) {
+	    m_active.reset(new std::vector<size_t>(Parent1.size()));
+	    for(size_t k=0;k<Parent1.size();++k){
+	      (*m_active)[k] = k;
+	    }
+	  }
+	  Child->SetParentFactor(this);
+	  //(a parent shared by several components is sent the sum of their messages, once)
+	  std::set<VariableNode<T>*> parents;
+	  for(size_t k=0;k<Parent1.size();++k){
+	    if (parents.insert(Parent1[k]).second) Parent1[k]->AddChildFactor(this);
+	    if (parents.insert(Parent2[k]).second) Parent2[k]->AddChildFactor(this);
+	  }
+	  Catagory->AddChildFactor(this);
+	}
+
+	Moments<T>
+	InitialiseMoments() const
+	{
+	  //Initialise up the tree first (once for the whole plate)
+	  std::vector<Moments<T> > moments1(m_parent1_nodes.size()), moments2(m_parent2_nodes.size());
+	  for(size_t k=0;k<m_parent1_nodes.size();++k){
+	    m_parent1_nodes[k]->InitialiseMoments();
+	    m_parent2_nodes[k]->InitialiseMoments();
+	  }
+	  m_catagory_node->InitialiseMoments();
+	  for(size_t k=0;k<m_parent1_nodes.size();++k){
+	    moments1[k] = m_parent1_nodes[k]->GetMoments();
+	    moments2[k] = m_parent2_nodes[k]->GetMoments();
+	  }
+	  const Moments<T>& catagory = m_catagory_node->GetMoments();
+	  std::vector<T> moments;
+	  for(size_t n=0;n<m_count;++n){
+	    const Moments<T> sample 
+	      = Model::CalcSample(moments1, moments2, instance_moments(catagory, m_parent1_nodes.size(), n));
+	    moments.insert(moments.end(), sample.begin(), sample.end());
+	  }
+	  return Moments<T>(moments);
+	}
+
+	/** The log normalisation summed over the plate. */
+	T
+	CalcLogNorm() const 
+	{
+	  return m_LogNorm;
+	}
+
+	NaturalParameters<T>
+	GetNaturalNot(variable_parameter v) const;
+
+	void
+	GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+	{
+	  nodes.insert(nodes.end(), m_parent1_nodes.begin(), m_parent1_nodes.end());
+	  nodes.insert(nodes.end(), m_parent2_nodes.begin(), m_parent2_nodes.end());
+	  nodes.push_back(m_catagory_node);
+	  nodes.push_back(m_child_node);
+	}
+
+	/** The number of instances in the plate. */
+	size_t
+	size() const {return m_count;}
+
+      private:
+	std::vector<VariableNode<T>*> m_parent1_nodes, m_parent2_nodes;
+	variable_t m_catagory_node, m_child_node;
+	size_t m_count;
+	active_t m_active;
+	mutable T m_LogNorm;
+      };
+
+      template<class Model, class T>
+      inline
+      NaturalParameters<T>
+      MixturePlate<Model,T>::GetNaturalNot(variable_parameter v) const
+      {
+	const size_t components = m_parent1_nodes.size();
+	const std::vector<size_t>& active = *m_active;
+	const Moments<T>& catagory = m_catagory_node->GetMoments();
+	const Moments<T>& child = m_child_node->GetMoments();
+	const size_t size = child.size()/m_count;
+	if (v == m_child_node) 
+	  {
+	    //The message and log normalisation of every component, weighted by each instance's responsibilities
+	    std::vector<T> plate(child.size(), 0);
+	    m_LogNorm = 0;
+	    for(size_t a=0;a<active.size();++a){
+	      const size_t k = active[a];
+	      const Moments<T>& parent1 = m_parent1_nodes[k]->GetMoments();
+	      const Moments<T>& parent2 = m_parent2_nodes[k]->GetMoments();
+	      const NaturalParameters<T> NP = Model::CalcNP2Data(parent1, parent2);
+	      const T LogNorm = Model::CalcLogNorm(parent1, parent2);
+	      for(size_t n=0;n<m_count;++n){
+		const T r = catagory[n*components + k];
+		if (r == 0)
+		  continue;
+		for(size_t j=0;j<size;++j){
+		  plate[n*size + j] += NP[j]*r;
+		}
+		m_LogNorm += LogNorm*r;
+	      }
+	    }
+	    return NaturalParameters<T>(plate);
+	  }
+	if (v == m_catagory_node)
+	  {
+	    //The pruned components are (all but) impossible.
+	    std::vector<T> plate(m_count*components, -std::numeric_limits<T>::max()/4);
+	    for(size_t a=0;a<active.size();++a){
+	      const size_t k = active[a];
+	      const Moments<T>& parent1 = m_parent1_nodes[k]->GetMoments();
+	      const Moments<T>& parent2 = m_parent2_nodes[k]->GetMoments();
+	      for(size_t n=0;n<m_count;++n){
+		plate[n*components + k] = Model::CalcAvLog(parent1, parent2, instance_moments(child, size, n));
+	      }
+	    }
+	    return NaturalParameters<T>(plate);
+	  }
+	//The parent of one or more components
+	NaturalParameters<T> NP(v->GetMoments().size());
+	for(size_t a=0;a<active.size();++a){
+	  const size_t k = active[a];
+	  const bool first = m_parent1_nodes[k] == v, second = m_parent2_nodes[k] == v;
+	  if (!first && !second)
+	    continue;
+	  const Moments<T>& parent1 = m_parent1_nodes[k]->GetMoments();
+	  const Moments<T>& parent2 = m_parent2_nodes[k]->GetMoments();
+	  for(size_t n=0;n<m_count;++n){
+	    const T r = catagory[n*components + k];
+	    if (r == 0)
+	      continue;
+	    const Moments<T> instance = instance_moments(child, size, n);
+	    if (first)
+	      NP += Model::CalcNP2Parent1(parent2, instance)*r;
+	    if (second)
+	      NP += Model::CalcNP2Parent2(parent1, instance)*r;
+	  }
+	}
+	return NP;
+      }
+
+      /** A Factor that joins every instance of a plate to its parents, as Factor does for a single child.
+       *  Each parent is either a plate of the same size, whose instances are paired with those of the child,
+       *  or a single node shared by every instance, which is sent the sum of their messages.
+       *  The child is either a HiddenPlate or an ObservedNode that holds the moments of every observation.
+       *  @tparam Model The model of the child: Gaussian, RectifiedGaussian or Gamma.
+       *  @tparam T The data type used - either float or double.
+       */
+      template<template<class> class Model, class T>
+      class InstancePlate : public FactorNode<T>
+      {
+      public:
+	/** @name Useful typdefs for types that are exposed to the user.
+	 */
+	///@{
+	typedef typename FactorNode<T>::variable_parameter variable_parameter;
+	typedef typename FactorNode<T>::variable_t         variable_t;
+	///@}
+
+	/** Constructor.
+	 *  @param Parent1 The first parent (the mean, or the shape for the Gamma model), or a plate of them.
+	 *  @param Parent2 The second parent (the precision, or the inverse scale for the Gamma model), or a plate of them.
+	 *  @param Child The plate of children.
+	 *  @param count The number of instances in the plate.
+	 */
+	InstancePlate( variable_parameter Parent1,  
+		       variable_parameter Parent2,  
+		       variable_parameter Child,
+		       const size_t count)
+	  : m_parent1_node(Parent1),
+	    m_parent2_node(Parent2),
+	    m_child_node(Child),
+	    m_count(count),
+	    m_LogNorm(0)
+	{
+	  Child->SetParentFactor(this);
+	  Parent1->AddChildFactor(this);
+	  Parent2->AddChildFactor(this);
+	}
+
+	Moments<T>
+	InitialiseMoments() const
+	{
+	  const Moments<T>& parent1 = m_parent1_node->GetMoments();
+	  const Moments<T>& parent2 = m_parent2_node->GetMoments();
+	  std::vector<T> moments;
+	  for(size_t n=0;n<m_count;++n){
+	    const Moments<T> sample = Model<T>::CalcSample(instance(parent1, n), instance(parent2, n));
+	    moments.insert(moments.end(), sample.begin(), sample.end());
+	  }
+	  return Moments<T>(moments);
+	}
+
+	/** The log normalisation summed over the plate. */
+	T
+	CalcLogNorm() const 
+	{
+	  return m_LogNorm;
+	}
+
+	NaturalParameters<T>
+	GetNaturalNot(variable_parameter v) const
+	{
+	  const Moments<T>& parent1 = m_parent1_node->GetMoments();
+	  const Moments<T>& parent2 = m_parent2_node->GetMoments();
+	  const Moments<T>& child = m_child_node->GetMoments();
+	  const bool plate = v->GetMoments().size() != 2;
+	  std::vector<T> NP(plate ? 2*m_count : 2, 0);
+	  if (v == m_child_node)
+	    m_LogNorm = 0;
+	  for(size_t n=0;n<m_count;++n){
+	    NaturalParameters<T> np;
+	    if (v == m_parent1_node)
+	      np = Model<T>::CalcNP2Parent1(instance(parent2, n), instance(child, n));
+	    else if (v == m_parent2_node)
+	      np = Model<T>::CalcNP2Parent2(instance(parent1, n), instance(child, n));
+	    else {
+	      BOOST_ASSERT(v == m_child_node);
+	      np = Model<T>::CalcNP2Data(instance(parent1, n), instance(parent2, n));
+	      m_LogNorm += Model<T>::CalcLogNorm(instance(parent1, n), instance(parent2, n));
+	    }
+	    for(size_t j=0;j<2;++j){
+	      NP[(plate ? 2*n : 0) + j] += np[j];
+	    }
+	  }
+	  return NaturalParameters<T>(NP);
+	}
+
+	void
+	GetAdjacentNodes(std::vector<VariableNode<T>*>& nodes) const
+	{
+	  nodes.push_back(m_parent1_node);
+	  nodes.push_back(m_parent2_node);
+	  nodes.push_back(m_child_node);
+	}
+
+	/** The number of instances in the plate. */
+	size_t
+	size() const {return m_count;}
+
+      private:
+	//(the moments of a node shared by every instance are the same for each)
+	Moments<T>
+	instance(const Moments<T>& moments, const size_t n) const
+	{
+	  return moments.size() == 2 ? moments : instance_moments(moments, 2, n);
+	}
+
+	variable_t m_parent1_node, m_parent2_node, m_child_node;
+	size_t m_count;
+	mutable T m_LogNorm;
+      };
+    }
+  }
+}
+
+#endif  // guard for FACTOR_PLATE_HPP
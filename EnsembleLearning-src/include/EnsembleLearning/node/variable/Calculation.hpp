@@ -32,10 +32,13 @@
 #include "EnsembleLearning/message/Moments.hpp"
 #include "EnsembleLearning/message/NaturalParameters.hpp"
 #include "EnsembleLearning/detail/Mutex.hpp"
+#include "EnsembleLearning/detail/ChildStaging.hpp"
 #include "EnsembleLearning/detail/parallel_algorithms.hpp"
+#include "EnsembleLearning/exception/PartitionedDeterministic.hpp"
 
 #include <boost/assert.hpp> 
 #include <boost/bind.hpp>
+#include <algorithm>
 #include <vector>
 
 namespace ICR{
@@ -66,12 +69,35 @@ namespace ICR{
       void
       AddChildFactor(FactorNode<T>* f);
 
+      void
+      AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last);
+
       void 
       Iterate(Coster& C);
 
+      /** The moments are worked out from the parents when they are read, there is nothing to update.
+       *  @return Zero.
+       */
+      T
+      Update() {return 0;}
+
+      /** Deterministic nodes add nothing to the cost. */
+      void
+      EvaluateCost(Coster& C) {}
+
       const Moments<T>&
       GetMoments() ;
 
+      void
+      SetMoments(const Moments<T>& m) ;
+
+      /** The version changes whenever the calculated moments do,
+       *  so they are brought up to date first.
+       *  @return The version of the moments.
+       */
+      size_t
+      GetVersion() ;
+
       //should make a const version of this 
       /** Forward moments to the deterministic function.
        *  @return The moments from the child node.
@@ -92,16 +118,49 @@ namespace ICR{
       void
       InitialiseMoments()
       {
-	m_Moments = m_parent->InitialiseMoments();
+	const Moments<T> moments = m_parent->InitialiseMoments();
+	Lock lock(m_mutex);
+	m_Moments = moments;
+	++m_version;
       }
 
+      /** The forwarded moments are not reduced over processes,
+       *  so a global deterministic node may not have children in the partition.
+       *  @throw Exception::PartitionedDeterministic If any of the children are in the partition.
+       */
+      size_t
+      PartitionChildren(const std::set<FactorNode<T>*>& partitioned);
+
+      NaturalParameters<T>
+      GetPartitionedNP(){return NaturalParameters<T>(m_Moments.size());}
+      
+      void
+      SetReducedNP(const NaturalParameters<T>& NP){}
+
+      /** In a synchronous sweep the moments are calculated once, in SwapMoments(), 
+       *  rather than every time that they are requested.
+       *  @param synchronous True for a synchronous sweep.
+       */
+      void
+      SetSynchronous(const bool synchronous);
+
+      void
+      SwapMoments();
+
+      /** Deterministic nodes are not inferred, so they have no parameters to extrapolate. */
+      void
+      GetNaturalParameters(std::vector<double>& stack) {}
 
+      bool
+      SetNaturalParameters(std::vector<double>::const_iterator& it) {return true;}
       
     private:
       
       FactorNode<T>* m_parent;
       std::vector<FactorNode<T>*> m_children;
       mutable Moments<T> m_Moments;
+      bool m_synchronous;
+      size_t m_version;
       mutable Mutex m_mutex;
     };
 
@@ -111,7 +170,7 @@ namespace ICR{
 
 template<class Model,class T>
 ICR::EnsembleLearning::DeterministicNode<Model,T>::DeterministicNode(const size_t moment_size) 
-  :   m_parent(0), m_children(), m_Moments(moment_size) //, m_ForwardedMoments(moment_size)
+  :   m_parent(0), m_children(), m_Moments(moment_size), m_synchronous(false), m_version(0) //, m_ForwardedMoments(moment_size)
 {
 }
 
@@ -123,8 +182,9 @@ ICR::EnsembleLearning::DeterministicNode<Model,T>::SetParentFactor(FactorNode<T>
 {
   //This should only be called once, so should get no collisions here
   m_parent=f;
-  // Can now initialise
-  InitialiseMoments();
+  // Can now initialise (unless the moments are to be loaded)
+  if (detail::ChildStaging<T>::Initialising())
+    InitialiseMoments();
 }
    
 template<class Model,class T>
@@ -132,6 +192,9 @@ inline
 void
 ICR::EnsembleLearning::DeterministicNode<Model,T>::AddChildFactor(FactorNode<T>* f)
 { 
+  //While the model is built concurrently the builder collects the children.
+  if (detail::ChildStaging<T>::Stage(this, f))
+    return;
   //Could be many factors, potentially added with many threads,
   //therefore make the following critical
 #pragma omp critical
@@ -140,24 +203,90 @@ ICR::EnsembleLearning::DeterministicNode<Model,T>::AddChildFactor(FactorNode<T>*
   }
 }
 
+template<class Model,class T>
+inline
+void
+ICR::EnsembleLearning::DeterministicNode<Model,T>::AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last)
+{ 
+  m_children.insert(m_children.end(), first, last);
+}
+
 template<class Model,class T>
 inline
 const ICR::EnsembleLearning::Moments<T>&
 ICR::EnsembleLearning::DeterministicNode<Model,T>::GetMoments() 
 {
 
+  //In a synchronous sweep the moments of the parents do not change until the sweep is over.
+  if (m_synchronous)
+    return m_Moments;
   /*This value is update in Iterate and called to evaluate other Hidden Nodes
    * (also in iterate mode).  It therefore needs to be protected by a mutex.
    */
-  //first get the NP from the parent
+  //first get the NP from the parent (which keeps it until a parent of the calculation changes)
   NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
   //Calcualate the moments
+  const Moments<T> moments = Model::CalcMoments(ParentNP);
   Lock lock(m_mutex);
-  m_Moments =  Model::CalcMoments(ParentNP);  
+  if (!std::equal(moments.begin(), moments.end(), m_Moments.begin())) {
+    m_Moments = moments;
+    ++m_version;
+  }
   return m_Moments;
 }
+
+template<class Model,class T>
+inline
+size_t
+ICR::EnsembleLearning::DeterministicNode<Model,T>::GetVersion() 
+{
+  GetMoments();
+  Lock lock(m_mutex);
+  return m_version;
+}
+   
+
+template<class Model,class T>
+inline
+void
+ICR::EnsembleLearning::DeterministicNode<Model,T>::SetMoments(const Moments<T>& m) 
+{
+  //The moments are recalculated from the parents whenever they are requested,
+  //so this only matters for GetMean() before the next call to GetMoments().
+  Lock lock(m_mutex);
+  m_Moments = m;
+  ++m_version;
+}
    
 
+template<class Model,class T>
+inline
+void
+ICR::EnsembleLearning::DeterministicNode<Model,T>::SetSynchronous(const bool synchronous) 
+{
+  m_synchronous = false;
+  if (synchronous) {
+    //calculate the current moments (the parents have been set first)
+    GetMoments();
+    m_synchronous = true;
+  }
+}
+
+template<class Model,class T>
+inline
+void
+ICR::EnsembleLearning::DeterministicNode<Model,T>::SwapMoments() 
+{
+  //The parents were built first, so their moments are already those of the new sweep.
+  if (m_synchronous) {
+    const Moments<T> moments = Model::CalcMoments(m_parent->GetNaturalNot(this));
+    if (!std::equal(moments.begin(), moments.end(), m_Moments.begin())) {
+      m_Moments = moments;
+      ++m_version;
+    }
+  }
+}
+
 template<class Model,class T>
 inline
 const ICR::EnsembleLearning::Moments<T>
@@ -169,15 +298,12 @@ ICR::EnsembleLearning::DeterministicNode<Model,T>::GetForwardedMoments()
   //Need to collect this fresh, the moments from other parts 
   //of the graph may have been updated since the last call.
 
-  std::vector<NaturalParameters<T> > vChildrenNP(m_children.size());
-
-  PARALLEL_TRANSFORM(m_children.begin(), m_children.end(), 
-  		     vChildrenNP.begin(), 
-		     boost::bind(&FactorNode<T>::GetNaturalNot, _1, this)
-  		     ); 
-
-  BOOST_ASSERT(vChildrenNP.size() >0);
-  NaturalParameters<T> ChildrenNP = PARALLEL_ACCUMULATE(vChildrenNP.begin(), vChildrenNP.end(), NaturalParameters<T>(vChildrenNP[0].size() )); 
+  BOOST_ASSERT(m_children.size() >0);
+  //(summed in double precision)
+  const NaturalParameters<T> ChildrenNP 
+    = accumulate_natural_parameters(m_children.begin(), m_children.end(), 
+				    boost::bind(&FactorNode<T>::GetNaturalNot, _1, this),
+				    NaturalParameters<T>()); 
   const Moments<T> ForwardedMoments = Model::CalcMoments(ChildrenNP);// ;  //update the moments and the model
 
   return ForwardedMoments;
@@ -209,4 +335,15 @@ void
 ICR::EnsembleLearning::DeterministicNode<Model,T>::Iterate(Coster& C)
 {}
 
+template<class Model,class T>
+size_t
+ICR::EnsembleLearning::DeterministicNode<Model,T>::PartitionChildren(const std::set<FactorNode<T>*>& partitioned)
+{
+  for(size_t i=0;i<m_children.size();++i){
+    if (partitioned.count(m_children[i]))
+      throw Exception::PartitionedDeterministic();
+  }
+  return 0;
+}
+
 #endif  // guard for VARIABLE_CALCULATION_HPP
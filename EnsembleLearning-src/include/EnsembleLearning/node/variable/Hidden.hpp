@@ -33,10 +33,14 @@
 #include "EnsembleLearning/message/NaturalParameters.hpp"
 #include "EnsembleLearning/detail/parallel_algorithms.hpp"
 #include "EnsembleLearning/detail/Mutex.hpp"
+#include "EnsembleLearning/detail/ChildStaging.hpp"
 
 #include <boost/assert.hpp> 
 #include <boost/bind.hpp>
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 
 
@@ -65,19 +69,36 @@ namespace ICR{
       void
       AddChildFactor(FactorNode<T>* f);
 
+      void
+      AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last);
+
       void 
       Iterate(Coster& C);
 
+      T
+      Update();
+
+      void
+      EvaluateCost(Coster& C);
+
       void
       InitialiseMoments()
       {
-	m_Moments = m_parent->InitialiseMoments();
+	const Moments<T> moments = m_parent->InitialiseMoments();
+	Lock lock(m_mutex);
+	m_Moments = moments;
+	++m_version;
       }
 
+      size_t
+      GetVersion() ;
 
       const Moments<T>&
       GetMoments() ;
 
+      void
+      SetMoments(const Moments<T>& m) ;
+
       const std::vector<T>
       GetMean() ;
       
@@ -92,6 +113,27 @@ namespace ICR{
 
       
 
+      size_t
+      PartitionChildren(const std::set<FactorNode<T>*>& partitioned);
+      
+      NaturalParameters<T>
+      GetPartitionedNP();
+      
+      void
+      SetReducedNP(const NaturalParameters<T>& NP);
+
+      void
+      SetSynchronous(const bool synchronous);
+
+      void
+      SwapMoments();
+
+      void
+      GetNaturalParameters(std::vector<double>& stack);
+
+      bool
+      SetNaturalParameters(std::vector<double>::const_iterator& it);
+
       /** The number of elements in the stored Moments */
       size_t 
       size() const {return m_Moments.size();}
@@ -103,7 +145,13 @@ namespace ICR{
 
       FactorNode<T>* m_parent;
       std::vector<FactorNode<T>*> m_children;
+      std::vector<FactorNode<T>*> m_partitioned_children;
+      NaturalParameters<T> m_reduced_NP;
       Moments<T> m_Moments;
+      Moments<T> m_NextMoments;
+      NaturalParameters<T> m_NP;
+      bool m_synchronous;
+      size_t m_version;
       mutable Mutex m_mutex;
     };
 
@@ -113,7 +161,8 @@ namespace ICR{
 
 template<template<class> class Model,class T>
 ICR::EnsembleLearning::HiddenNode<Model,T>::HiddenNode(const size_t moment_size) 
-  :   m_parent(0), m_children(), m_Moments(moment_size)
+  :   m_parent(0), m_children(), m_partitioned_children(), m_reduced_NP(), m_Moments(moment_size),
+      m_NextMoments(), m_NP(), m_synchronous(false), m_version(0)
 {}
 
 
@@ -124,8 +173,9 @@ ICR::EnsembleLearning::HiddenNode<Model,T>::SetParentFactor(FactorNode<T>* f)
 {
   //This should only be called once, so should get no collisions here
   m_parent=f;
-  // Can now initialise
-  InitialiseMoments();
+  // Can now initialise (unless the moments are to be loaded)
+  if (detail::ChildStaging<T>::Initialising())
+    InitialiseMoments();
   
 }
 
@@ -137,6 +187,9 @@ inline
 void
 ICR::EnsembleLearning::HiddenNode<Model,T>::AddChildFactor(FactorNode<T>* f)
 { 
+  //While the model is built concurrently the builder collects the children.
+  if (detail::ChildStaging<T>::Stage(this, f))
+    return;
   //This could be called simultaneously by different threads, so call it critical
 #pragma omp critical
   {
@@ -144,11 +197,22 @@ ICR::EnsembleLearning::HiddenNode<Model,T>::AddChildFactor(FactorNode<T>* f)
   }
 }
 
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last)
+{ 
+  m_children.insert(m_children.end(), first, last);
+}
+
 template<template<class> class Model,class T>
 inline
 const ICR::EnsembleLearning::Moments<T>&
 ICR::EnsembleLearning::HiddenNode<Model,T>::GetMoments() 
 {
+  //In a synchronous sweep only the next moments are written, so no lock is needed.
+  if (m_synchronous)
+    return m_Moments;
   /*This value is update in Iterate and called to evaluate other Hidden Nodes
    * (also in iterate mode).  It therefore needs to be protected by a mutex.
    */
@@ -156,6 +220,31 @@ ICR::EnsembleLearning::HiddenNode<Model,T>::GetMoments()
   return m_Moments;
 }
    
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::SetMoments(const Moments<T>& m) 
+{
+  BOOST_ASSERT(m.size() == m_Moments.size());
+  Lock lock(m_mutex);
+  m_Moments = m;
+  ++m_version;
+  if (m_synchronous)
+    m_NextMoments = m;
+}
+
+template<template<class> class Model,class T>
+inline
+size_t
+ICR::EnsembleLearning::HiddenNode<Model,T>::GetVersion() 
+{
+  //(as GetMoments(), the version is changed after the moments, under the lock)
+  if (m_synchronous)
+    return m_version;
+  Lock lock(m_mutex);
+  return m_version;
+}
+   
 template<template<class> class Model,class T>
 inline
 const ICR::EnsembleLearning::NaturalParameters<T>
@@ -165,23 +254,101 @@ ICR::EnsembleLearning::HiddenNode<Model,T>::GetNP()
   BOOST_ASSERT(m_parent != 0);
   //first get the NP from the parent
   const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
-  //The initial value in the total
-  NaturalParameters<T> NP = ParentNP; //total
-
-  //get the Natural parameters from all the children.
-  std::vector<NaturalParameters<T> > ChildrenNP(m_children.size());
-  //and put them in the vector
-  PARALLEL_TRANSFORM(m_children.begin(), m_children.end(), 
-		     ChildrenNP.begin(), boost::bind(&FactorNode<T>::GetNaturalNot, _1, this)
-		     ); //from children
-
-  //Add them up
-  //(Note: Bug 48750 in gcc in parallel accumulate causes crash at next line: 
-  //  fixed in 4.6.1)
-  NP = PARALLEL_ACCUMULATE(ChildrenNP.begin(), ChildrenNP.end(), NP ); 
+  //Add up the Natural parameters from all the children 
+  // (in double precision) to the parent's.
+  NaturalParameters<T> NP 
+    = accumulate_natural_parameters(m_children.begin(), m_children.end(), 
+				    boost::bind(&FactorNode<T>::GetNaturalNot, _1, this),
+				    ParentNP);
+
+  //The messages from the partitioned children, summed over all processes.
+  if (!m_partitioned_children.empty())
+    NP += m_reduced_NP;
   return NP;
 }
 
+template<template<class> class Model,class T>
+inline
+size_t
+ICR::EnsembleLearning::HiddenNode<Model,T>::PartitionChildren(const std::set<FactorNode<T>*>& partitioned)
+{
+  std::vector<FactorNode<T>*> children;
+  for(size_t i=0;i<m_children.size();++i){
+    if (partitioned.count(m_children[i]))
+      m_partitioned_children.push_back(m_children[i]);
+    else
+      children.push_back(m_children[i]);
+  }
+  m_children.swap(children);
+  m_reduced_NP = NaturalParameters<T>(m_Moments.size());
+  return m_partitioned_children.size();
+}
+
+template<template<class> class Model,class T>
+inline
+ICR::EnsembleLearning::NaturalParameters<T>
+ICR::EnsembleLearning::HiddenNode<Model,T>::GetPartitionedNP()
+{
+  return accumulate_natural_parameters(m_partitioned_children.begin(), m_partitioned_children.end(), 
+				       boost::bind(&FactorNode<T>::GetNaturalNot, _1, this),
+				       NaturalParameters<T>(m_Moments.size()));
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::SetReducedNP(const NaturalParameters<T>& NP)
+{
+  m_reduced_NP = NP;
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::SetSynchronous(const bool synchronous)
+{
+  m_synchronous = synchronous;
+  //The next moments are only needed (and so allocated) in a synchronous sweep.
+  m_NextMoments = synchronous ? m_Moments : Moments<T>();
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::SwapMoments()
+{
+  if (m_synchronous) {
+    m_Moments.swap(m_NextMoments);
+    ++m_version;
+  }
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenNode<Model,T>::GetNaturalParameters(std::vector<double>& stack)
+{
+  stack.insert(stack.end(), m_NP.begin(), m_NP.end());
+}
+
+template<template<class> class Model,class T>
+inline
+bool
+ICR::EnsembleLearning::HiddenNode<Model,T>::SetNaturalParameters(std::vector<double>::const_iterator& it)
+{
+  if (m_NP.size() == 0) //not updated yet
+    return true;
+  NaturalParameters<T> NP(m_NP.size());
+  for(size_t i=0;i<NP.size();++i, ++it){
+    NP[i] = *it;
+  }
+  if (!Model<T>::InDomain(NP))
+    return false;
+  m_NP = NP;
+  SetMoments(Model<T>::CalcMoments(NP));
+  return true;
+}
+
 template<template<class> class Model,class T>
 inline
 const std::vector<T>
@@ -208,7 +375,7 @@ inline
 void
 ICR::EnsembleLearning::HiddenNode<Model,T>::SetMean(const std::vector<T>& m) 
 {
-  m_Moments = Model<T>::CalcMoments(m,GetVariance());
+  SetMoments(Model<T>::CalcMoments(m,GetVariance()));
 }
    
 template<template<class> class Model,class T>
@@ -216,7 +383,7 @@ inline
 void
 ICR::EnsembleLearning::HiddenNode<Model,T>::SetVariance(const std::vector<T>& v) 
 {
-  m_Moments = Model<T>::CalcMoments(GetMean(),v);
+  SetMoments(Model<T>::CalcMoments(GetMean(),v));
 }
 
 template<template<class> class Model,class T>
@@ -225,16 +392,57 @@ void
 ICR::EnsembleLearning::HiddenNode<Model,T>::Iterate(Coster& C)
 {
   const NaturalParameters<T> NP = GetNP();
+  m_NP = NP;
   //Get the moments and update the model
   const T LogNorm = Model<T>::CalcLogNorm(NP);
-  {
+  if (m_synchronous) {
+    //Nobody reads the next moments until the sweep is over
+    m_NextMoments = Model<T>::CalcMoments(NP);
+  }
+  else {
     Lock lock(m_mutex);
     m_Moments = Model<T>::CalcMoments(NP);  //update the moments and the model
+    ++m_version;
   }
   //first get the NP from the parent
   const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
-  C +=  (ParentNP - NP)*m_Moments +m_parent->CalcLogNorm() -  LogNorm;
+  C +=  (ParentNP - NP)*(m_synchronous ? m_NextMoments : m_Moments) +m_parent->CalcLogNorm() -  LogNorm;
+
+}
+
+template<template<class> class Model,class T>
+inline
+T
+ICR::EnsembleLearning::HiddenNode<Model,T>::Update()
+{
+  const NaturalParameters<T> NP = GetNP();
+  //The first update has nothing to compare with.
+  T change = m_NP.size() == NP.size() ? 0 : std::numeric_limits<T>::max();
+  for(size_t i=0;i<m_NP.size() && i<NP.size();++i){
+    change = std::max<T>(change, std::fabs(NP[i] - m_NP[i])/(1 + std::fabs(m_NP[i])));
+  }
+  m_NP = NP;
+  if (m_synchronous) {
+    //Nobody reads the next moments until the sweep is over
+    m_NextMoments = Model<T>::CalcMoments(NP);
+  }
+  else {
+    Lock lock(m_mutex);
+    m_Moments = Model<T>::CalcMoments(NP);
+    ++m_version;
+  }
+  return change;
+}
 
+template<template<class> class Model,class T>
+inline
+void 
+ICR::EnsembleLearning::HiddenNode<Model,T>::EvaluateCost(Coster& C)
+{
+  if (m_NP.size() == 0) //not updated yet
+    return;
+  const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
+  C +=  (ParentNP - m_NP)*m_Moments +m_parent->CalcLogNorm() -  Model<T>::CalcLogNorm(m_NP);
 }
 
 #endif  // guard for HIDDEN_HPP
@@ -30,12 +30,14 @@
 
 
 #include "EnsembleLearning/message/Moments.hpp"
+#include "EnsembleLearning/message/NaturalParameters.hpp"
 #include "EnsembleLearning/node/Node.hpp"
 #include "EnsembleLearning/exponential_model/Gaussian.hpp"
 #include "EnsembleLearning/exponential_model/RectifiedGaussian.hpp"
 #include "EnsembleLearning/exponential_model/Gamma.hpp"
 #include "EnsembleLearning/exponential_model/Discrete.hpp"
 #include "EnsembleLearning/exponential_model/Dirichlet.hpp"
+#include "EnsembleLearning/detail/ChildStaging.hpp"
 
 
 
@@ -115,6 +117,19 @@ namespace ICR{
 	  m_children()
       {}
 
+      /** A Constructor for a plate of observations.
+       *  The node holds the average of the moments of the values 
+       *  (accumulated in double precision).
+       *  It should be joined to its parents with a Plate factor.
+       *  @param values The observed values.
+       *  This constructor is not available for Discrete or Dirichlet models.
+       */
+      ObservedNode( const std::vector<T>& values )
+	: m_Moments(average_Moments(values)), 
+	  m_parent(0),
+	  m_children()
+      {}
+
       /** A Constructor.
        * @param  elements The number of elements in the observed node.
        * @param  value The value of each of the elements 
@@ -126,6 +141,17 @@ namespace ICR{
 	  m_parent(0), 
 	  m_children()
       {}
+
+      /** A Constructor from the moments themselves.
+       *  This is used to rebuild a saved node (see Builder::load_graph()).
+       *  @param moments The moments of the observations.
+       */
+      explicit
+      ObservedNode(const Moments<T>& moments)
+	: m_Moments(moments), 
+	  m_parent(0), 
+	  m_children()
+      {}
       
       
       void
@@ -133,12 +159,23 @@ namespace ICR{
 
       void
       AddChildFactor(FactorNode<T>* f);
+
+      void
+      AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last);
       
       void
       InitialiseMoments(){};
 
       const Moments<T>&
       GetMoments() ;
+
+      /** The observed moments are constant, so this does nothing. */
+      void
+      SetMoments(const Moments<T>& m){};
+
+      /** The observed moments are constant, so they keep their first version. */
+      size_t
+      GetVersion() {return 0;}
       
       const std::vector<T>
       GetMean() ;
@@ -148,11 +185,64 @@ namespace ICR{
 
       void 
       Iterate(Coster& C);
+
+      /** Observed nodes are not updated.
+       *  @return Zero.
+       */
+      T
+      Update() {return 0;}
+
+      /** The cost of the observations (as Iterate()).
+       *  @param C The total cost.
+       */
+      void
+      EvaluateCost(Coster& C) {Iterate(C);}
+
+      /** Observed nodes receive no messages, so there is nothing to partition. */
+      size_t
+      PartitionChildren(const std::set<FactorNode<T>*>& partitioned){return 0;}
+      
+      NaturalParameters<T>
+      GetPartitionedNP(){return NaturalParameters<T>(m_Moments.size());}
+
+      /** The observed moments never change, so there is nothing to do. */
+      void
+      SetSynchronous(const bool synchronous) {}
+      
+      void
+      SwapMoments() {}
+
+      void
+      GetNaturalParameters(std::vector<double>& stack) {}
+
+      bool
+      SetNaturalParameters(std::vector<double>::const_iterator& it) {return true;}
+      
+      void
+      SetReducedNP(const NaturalParameters<T>& NP){}
       
     private:
       friend struct detail::GetMean_impl<Model,T>;
       friend struct detail::GetVariance_impl< Model,T >;
       
+      Moments<T>
+      average_Moments(const std::vector<T>& values)
+      {
+	BOOST_ASSERT(!values.empty());
+	std::vector<double> sum;
+	for(size_t i=0;i<values.size();++i){
+	  const Moments<T> m = make_Moments(values[i], Model<T>());
+	  sum.resize(m.size(), 0.0);
+	  for(size_t j=0;j<m.size();++j){
+	    sum[j] += m[j];
+	  }
+	}
+	std::vector<T> average(sum.size());
+	for(size_t j=0;j<sum.size();++j){
+	  average[j] = sum[j]/values.size();
+	}
+	return Moments<T>(average);
+      }
       Moments<T>
       make_Moments(const T& d, const Gaussian<T> )
       {
@@ -275,6 +365,9 @@ ICR::EnsembleLearning::ObservedNode<Model,T,
 		       typename boost::enable_if<ICR::EnsembleLearning::detail::is_observable<Model,T> >::type>
 ::AddChildFactor(FactorNode<T>* f)
 {
+  //While the model is built concurrently the builder collects the children.
+  if (detail::ChildStaging<T>::Stage(this, f))
+    return;
   //Could be many factors, potentially added with many threads,
   //therefore make the following critical
 #pragma omp critical
@@ -283,6 +376,16 @@ ICR::EnsembleLearning::ObservedNode<Model,T,
   }
 }
 
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::ObservedNode<Model,T,
+		       typename boost::enable_if<ICR::EnsembleLearning::detail::is_observable<Model,T> >::type>
+::AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last)
+{
+  m_children.insert(m_children.end(), first, last);
+}
+
 
 template<template<class> class Model, class T>
 inline
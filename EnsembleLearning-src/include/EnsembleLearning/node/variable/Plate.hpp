@@ -0,0 +1,463 @@
+#pragma once
+#ifndef VARIABLE_PLATE_HPP
+#define VARIABLE_PLATE_HPP
+
+
+/***********************************************************************************
+ ***********************************************************************************
+ **                                                                               **
+ **  Copyright (C) 2011 Tom Shorrock <t.h.shorrock@gmail.com> 
+ **                                                                               **
+ **                                                                               **
+ **  This program is free software; you can redistribute it and/or                **
+ **  modify it under the terms of the GNU General Public License                  **
+ **  as published by the Free Software Foundation; either version 2               **
+ **  of the License, or (at your option) any later version.                       **
+ **                                                                               **
+ **  This program is distributed in the hope that it will be useful,              **
+ **  but WITHOUT ANY WARRANTY; without even the implied warranty of               **
+ **  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                **
+ **  GNU General Public License for more details.                                 **
+ **                                                                               **
+ **  You should have received a copy of the GNU General Public License            **
+ **  along with this program; if not, write to the Free Software                  **
+ **  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.  **
+ **                                                                               **
+ ***********************************************************************************
+ ***********************************************************************************/
+
+
+
+#include "EnsembleLearning/node/Node.hpp"
+#include "EnsembleLearning/message/Moments.hpp"
+#include "EnsembleLearning/message/NaturalParameters.hpp"
+#include "EnsembleLearning/detail/Mutex.hpp"
+#include "EnsembleLearning/detail/ChildStaging.hpp"
+
+#include <boost/assert.hpp> 
+#include <boost/bind.hpp>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+
+namespace ICR{
+  namespace EnsembleLearning{
+    
+    /** A plate of Hidden Variable Nodes.
+     *  The node stands for count independent instances of a HiddenNode that share their factors:
+     *  the moments of every instance are held one after another in a single array,
+     *  and the messages to and from the node are laid out in the same way
+     *  (see detail::DiscretePlate and detail::MixturePlate).
+     *  One node then replaces count of them, and the sweep visits them together.
+     *  @tparam Model  The model of each instance (for example Gaussian or Discrete).
+     *  @tparam T The data type (float or double)
+     */
+    template <template<class> class Model, class T>
+    class HiddenPlate : public VariableNode<T>
+    {
+    public:
+      /** A constructor.
+       *  @param count The number of instances.
+       *  @param moment_size The number of moments of each instance.
+       *  This is usually two but varies for discrete nodes.
+       */
+      HiddenPlate(const size_t count, const size_t moment_size = 2);
+
+      void
+      SetParentFactor(FactorNode<T>* f);
+      
+      void
+      AddChildFactor(FactorNode<T>* f);
+
+      void
+      AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last);
+
+      void 
+      Iterate(Coster& C);
+
+      T
+      Update();
+
+      void
+      EvaluateCost(Coster& C);
+
+      void
+      InitialiseMoments()
+      {
+	const Moments<T> moments = m_parent->InitialiseMoments();
+	Lock lock(m_mutex);
+	m_Moments = moments;
+	++m_version;
+      }
+
+      size_t
+      GetVersion() ;
+
+      /** The moments of every instance, one after another. */
+      const Moments<T>&
+      GetMoments() ;
+
+      void
+      SetMoments(const Moments<T>& m) ;
+
+      /** The mean of every instance. */
+      const std::vector<T>
+      GetMean() ;
+      
+      /** The variance of every instance. */
+      const std::vector<T>
+      GetVariance() ;
+
+      size_t
+      PartitionChildren(const std::set<FactorNode<T>*>& partitioned);
+      
+      NaturalParameters<T>
+      GetPartitionedNP();
+      
+      void
+      SetReducedNP(const NaturalParameters<T>& NP);
+
+      void
+      SetSynchronous(const bool synchronous);
+
+      void
+      SwapMoments();
+
+      void
+      GetNaturalParameters(std::vector<double>& stack);
+
+      bool
+      SetNaturalParameters(std::vector<double>::const_iterator& it);
+
+      /** The number of instances in the plate. */
+      size_t 
+      count() const {return m_count;}
+
+      /** The number of moments of each instance. */
+      size_t 
+      size() const {return m_size;}
+      
+    private:
+      
+      const NaturalParameters<T>
+      GetNP();
+
+      NaturalParameters<T>
+      Instance(const NaturalParameters<T>& NP, const size_t n) const;
+
+      Moments<T>
+      CalcMoments(const NaturalParameters<T>& NP, T& LogNorm) const;
+
+      size_t m_count, m_size;
+      FactorNode<T>* m_parent;
+      std::vector<FactorNode<T>*> m_children;
+      std::vector<FactorNode<T>*> m_partitioned_children;
+      NaturalParameters<T> m_reduced_NP;
+      Moments<T> m_Moments;
+      Moments<T> m_NextMoments;
+      NaturalParameters<T> m_NP;
+      bool m_synchronous;
+      size_t m_version;
+      mutable Mutex m_mutex;
+    };
+
+  }
+}
+
+
+template<template<class> class Model,class T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::HiddenPlate(const size_t count, const size_t moment_size) 
+  :   m_count(count), m_size(moment_size), 
+      m_parent(0), m_children(), m_partitioned_children(), m_reduced_NP(), m_Moments(count*moment_size),
+      m_NextMoments(), m_NP(), m_synchronous(false), m_version(0)
+{}
+
+template<template<class> class Model,class T>
+inline 
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SetParentFactor(FactorNode<T>* f)
+{
+  //This should only be called once, so should get no collisions here
+  m_parent=f;
+  if (detail::ChildStaging<T>::Initialising())
+    InitialiseMoments();
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::AddChildFactor(FactorNode<T>* f)
+{ 
+  //While the model is built concurrently the builder collects the children.
+  if (detail::ChildStaging<T>::Stage(this, f))
+    return;
+#pragma omp critical
+  {
+    m_children.push_back(f);
+  }
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::AddChildFactors(FactorNode<T>* const* first, FactorNode<T>* const* last)
+{ 
+  m_children.insert(m_children.end(), first, last);
+}
+
+template<template<class> class Model,class T>
+inline
+const ICR::EnsembleLearning::Moments<T>&
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetMoments() 
+{
+  //(as HiddenNode::GetMoments())
+  if (m_synchronous)
+    return m_Moments;
+  Lock lock(m_mutex);
+  return m_Moments;
+}
+   
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SetMoments(const Moments<T>& m) 
+{
+  BOOST_ASSERT(m.size() == m_Moments.size());
+  Lock lock(m_mutex);
+  m_Moments = m;
+  ++m_version;
+  if (m_synchronous)
+    m_NextMoments = m;
+}
+
+template<template<class> class Model,class T>
+inline
+size_t
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetVersion() 
+{
+  //(as HiddenNode::GetVersion())
+  if (m_synchronous)
+    return m_version;
+  Lock lock(m_mutex);
+  return m_version;
+}
+   
+   
+template<template<class> class Model,class T>
+inline
+const ICR::EnsembleLearning::NaturalParameters<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetNP()
+{
+  BOOST_ASSERT(m_parent != 0);
+  //The messages hold a natural parameter for every instance, so they add up as they do for a single node.
+  const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
+  NaturalParameters<T> NP 
+    = accumulate_natural_parameters(m_children.begin(), m_children.end(), 
+				    boost::bind(&FactorNode<T>::GetNaturalNot, _1, this),
+				    ParentNP);
+  if (!m_partitioned_children.empty())
+    NP += m_reduced_NP;
+  return NP;
+}
+
+template<template<class> class Model,class T>
+inline
+ICR::EnsembleLearning::NaturalParameters<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::Instance(const NaturalParameters<T>& NP, const size_t n) const
+{
+  return NaturalParameters<T>(std::vector<T>(NP.begin() + n*m_size, NP.begin() + (n+1)*m_size));
+}
+
+template<template<class> class Model,class T>
+inline
+ICR::EnsembleLearning::Moments<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::CalcMoments(const NaturalParameters<T>& NP, T& LogNorm) const
+{
+  std::vector<T> moments(m_count*m_size);
+  LogNorm = 0;
+  for(size_t n=0;n<m_count;++n){
+    const NaturalParameters<T> np = Instance(NP, n);
+    const Moments<T> m = Model<T>::CalcMoments(np);
+    std::copy(m.begin(), m.end(), moments.begin() + n*m_size);
+    LogNorm += Model<T>::CalcLogNorm(np);
+  }
+  return Moments<T>(moments);
+}
+
+template<template<class> class Model,class T>
+inline
+size_t
+ICR::EnsembleLearning::HiddenPlate<Model,T>::PartitionChildren(const std::set<FactorNode<T>*>& partitioned)
+{
+  std::vector<FactorNode<T>*> children;
+  for(size_t i=0;i<m_children.size();++i){
+    if (partitioned.count(m_children[i]))
+      m_partitioned_children.push_back(m_children[i]);
+    else
+      children.push_back(m_children[i]);
+  }
+  m_children.swap(children);
+  m_reduced_NP = NaturalParameters<T>(m_Moments.size());
+  return m_partitioned_children.size();
+}
+
+template<template<class> class Model,class T>
+inline
+ICR::EnsembleLearning::NaturalParameters<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetPartitionedNP()
+{
+  return accumulate_natural_parameters(m_partitioned_children.begin(), m_partitioned_children.end(), 
+				       boost::bind(&FactorNode<T>::GetNaturalNot, _1, this),
+				       NaturalParameters<T>(m_Moments.size()));
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SetReducedNP(const NaturalParameters<T>& NP)
+{
+  m_reduced_NP = NP;
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SetSynchronous(const bool synchronous)
+{
+  m_synchronous = synchronous;
+  m_NextMoments = synchronous ? m_Moments : Moments<T>();
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SwapMoments()
+{
+  if (m_synchronous) {
+    m_Moments.swap(m_NextMoments);
+    ++m_version;
+  }
+}
+
+template<template<class> class Model,class T>
+inline
+void
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetNaturalParameters(std::vector<double>& stack)
+{
+  stack.insert(stack.end(), m_NP.begin(), m_NP.end());
+}
+
+template<template<class> class Model,class T>
+inline
+bool
+ICR::EnsembleLearning::HiddenPlate<Model,T>::SetNaturalParameters(std::vector<double>::const_iterator& it)
+{
+  if (m_NP.size() == 0) //not updated yet
+    return true;
+  NaturalParameters<T> NP(m_NP.size());
+  for(size_t i=0;i<NP.size();++i, ++it){
+    NP[i] = *it;
+  }
+  for(size_t n=0;n<m_count;++n){
+    if (!Model<T>::InDomain(Instance(NP, n)))
+      return false;
+  }
+  m_NP = NP;
+  T LogNorm;
+  SetMoments(CalcMoments(NP, LogNorm));
+  return true;
+}
+
+template<template<class> class Model,class T>
+inline
+const std::vector<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetMean() 
+{
+  const NaturalParameters<T> NP = GetNP();
+  std::vector<T> mean(m_count);
+  for(size_t n=0;n<m_count;++n){
+    mean[n] = Model<T>::CalcMean(Instance(NP, n))[0];
+  }
+  return mean;
+}
+   
+template<template<class> class Model,class T>
+inline
+const std::vector<T>
+ICR::EnsembleLearning::HiddenPlate<Model,T>::GetVariance() 
+{
+  const NaturalParameters<T> NP = GetNP();
+  std::vector<T> var(m_count);
+  for(size_t n=0;n<m_count;++n){
+    var[n] = 1.0/Model<T>::CalcPrecision(Instance(NP, n))[0];
+  }
+  return var;
+}
+
+template<template<class> class Model,class T>
+inline
+void 
+ICR::EnsembleLearning::HiddenPlate<Model,T>::Iterate(Coster& C)
+{
+  const NaturalParameters<T> NP = GetNP();
+  m_NP = NP;
+  T LogNorm;
+  if (m_synchronous) {
+    //Nobody reads the next moments until the sweep is over
+    m_NextMoments = CalcMoments(NP, LogNorm);
+  }
+  else {
+    const Moments<T> moments = CalcMoments(NP, LogNorm);
+    Lock lock(m_mutex);
+    m_Moments = moments;
+    ++m_version;
+  }
+  //(the parent's log normalisation is summed over the instances)
+  const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
+  C +=  (ParentNP - NP)*(m_synchronous ? m_NextMoments : m_Moments) +m_parent->CalcLogNorm() -  LogNorm;
+}
+
+template<template<class> class Model,class T>
+inline
+T
+ICR::EnsembleLearning::HiddenPlate<Model,T>::Update()
+{
+  const NaturalParameters<T> NP = GetNP();
+  //The first update has nothing to compare with.
+  T change = m_NP.size() == NP.size() ? 0 : std::numeric_limits<T>::max();
+  for(size_t i=0;i<m_NP.size() && i<NP.size();++i){
+    change = std::max<T>(change, std::fabs(NP[i] - m_NP[i])/(1 + std::fabs(m_NP[i])));
+  }
+  m_NP = NP;
+  T LogNorm;
+  if (m_synchronous) {
+    m_NextMoments = CalcMoments(NP, LogNorm);
+  }
+  else {
+    const Moments<T> moments = CalcMoments(NP, LogNorm);
+    Lock lock(m_mutex);
+    m_Moments = moments;
+    ++m_version;
+  }
+  return change;
+}
+
+template<template<class> class Model,class T>
+inline
+void 
+ICR::EnsembleLearning::HiddenPlate<Model,T>::EvaluateCost(Coster& C)
+{
+  if (m_NP.size() == 0) //not updated yet
+    return;
+  T LogNorm = 0;
+  for(size_t n=0;n<m_count;++n){
+    LogNorm += Model<T>::CalcLogNorm(Instance(m_NP, n));
+  }
+  const NaturalParameters<T> ParentNP = (m_parent->GetNaturalNot(this));
+  C +=  (ParentNP - m_NP)*m_Moments +m_parent->CalcLogNorm() -  LogNorm;
+}
+
+#endif  // guard for VARIABLE_PLATE_HPP
@@ -26,10 +26,12 @@
 
 //builder
 #include "EnsembleLearning/Builder.hpp"
+#include "EnsembleLearning/Batch.hpp"
 //factors
 #include "EnsembleLearning/node/factor/Calculation.hpp"
 #include "EnsembleLearning/node/factor/Factor.hpp"
 #include "EnsembleLearning/node/factor/Mixture.hpp"
+#include "EnsembleLearning/node/factor/Plate.hpp"
 //nodes
 #include "EnsembleLearning/node/variable/Hidden.hpp"
 #include "EnsembleLearning/node/variable/Observed.hpp"
@@ -38,26 +40,146 @@
 #include "EnsembleLearning/detail/parallel_algorithms.hpp"
 //messages
 #include "EnsembleLearning/message/Coster.hpp"
-
+#include "EnsembleLearning/message/Moments.hpp"
+//expressions (rebuilt by load_graph)
+#include "EnsembleLearning/calculation_tree/Factory.hpp"
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <omp.h>
+#include <unistd.h>
 //stream
 #include <fstream>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <iterator>
+
+namespace{
+  /* The layout of a saved state is
+   *   header:  magic (8 chars), version (uint32), sizeof(T) (uint32),
+   *            number of nodes (uint64), number of iterations (uint64),
+   *            previous cost (double), length of cost history (uint64),
+   *            cost history (doubles)
+   *   nodes:   for each node in order of creation, 
+   *            number of moments (uint64) followed by the moments (T)
+   * All values are written in the native byte order.
+   */
+  const char state_magic[8] = {'E','L','S','T','A','T','E','\0'};
+  const boost::uint32_t state_version = 1;
+
+  template<class D>
+  inline
+  void
+  write_binary(std::ostream& out, const D& d)
+  {
+    out.write(reinterpret_cast<const char*>(&d), sizeof(D));
+  }
+
+  template<class D>
+  inline
+  void
+  read_binary(std::istream& in, D& d)
+  {
+    in.read(reinterpret_cast<char*>(&d), sizeof(D));
+  }
+
+  //Replace filename with the completely written tmp_filename.
+  //(rename replaces the target atomically, so there is always a complete file)
+  inline
+  void
+  move_into_place(const std::string& tmp_filename, const std::string& filename)
+  {
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      std::cout<<"Unable to move "<<tmp_filename<<" to "<<filename<<std::endl;
+      throw("EXITING");
+    }
+  }
+
+  //The Gaussian moments of every value, one after another, for a plate of observations.
+  template<class T>
+  ICR::EnsembleLearning::Moments<T>
+  plate_moments(const std::vector<T>& data)
+  {
+    ICR::EnsembleLearning::Moments<T> m(2*data.size());
+    for(size_t n=0;n<data.size();++n){
+      m[2*n]   = data[n];
+      m[2*n+1] = data[n]*data[n];
+    }
+    return m;
+  }
+}
 
 template<class T>
 ICR::EnsembleLearning::Builder<T>::Builder(const std::string& cost_file)
   : m_PrevCost(-1.0/0.0), // minus infty
     m_Factors(),
     m_Nodes(),
+    m_calculations(),
     m_initialised(false),
     m_data_nodes(0),
-    m_cost_file(cost_file)
+    m_cost_file(""),
+    m_iterations(0),
+    m_cost_history(),
+    m_checkpoint_file(""),
+    m_checkpoint_interval(10),
+    m_logger(new CostLogger()),
+    m_console_sink(new ConsoleSink()),
+    m_file_sink(),
+    m_start_time(omp_get_wtime()),
+    m_parallel(true),
+    m_synchronous(false),
+    m_synchronous_nodes(0),
+    m_node_costs(),
+    m_acceleration(Acceleration::NONE),
+    m_extrapolated(false),
+    m_accepted_cost(0),
+    m_relaxation(1),
+    m_squarem_step(0),
+    m_theta0(),
+    m_theta1(),
+    m_theta_plain(),
+    m_iterations_saved(0),
+    m_prune_weight(0),
+    m_prune_precision(0),
+    m_verify_pruning(true),
+    m_mixtures(),
+    m_precision_rules(),
+    m_pruned(),
+    m_unpruned_nodes(),
+    m_pruned_cost(0),
+    m_reorder(false),
+    m_sweep(),
+    m_compiled(),
+    m_kinds(),
+    m_compiled_nodes(0),
+    m_compiled_valid(false),
+    m_bound_interval(1),
+    m_bound_change(1e-4),
+    m_node_changes(),
+    m_mixture_truncation(0),
+    m_reducer(),
+    m_partitioning(false),
+    m_partition_begin(0),
+    m_partitioned_nodes(),
+    m_partitioned_factors(),
+    m_partition_factor_begin(0),
+    m_distributed(false),
+    m_local_nodes(),
+    m_global_nodes(),
+    m_reduced_nodes(),
+    m_concurrent(false),
+    m_staging(),
+    m_staged_links(),
+    m_graph_expressions()
 {
-  //clear it
-  if (m_cost_file != "") { 
-    std::ofstream CostFile(m_cost_file.c_str());
-    CostFile<<"#Data";
-  }
-  // CostFile = new std::ofstream("Cost.txt");
-  // CostFile.close();
+  m_logger->add_sink(m_console_sink);
+  set_cost_file(cost_file);
 }  
 
 template<class T>
@@ -65,11 +187,96 @@ void
 ICR::EnsembleLearning::Builder<T>::set_cost_file(const std::string& cost_file)
 {
   m_cost_file = cost_file;
+  if (m_file_sink) {
+    m_logger->remove_sink(m_file_sink);
+    m_file_sink.reset();
+  }
   if (m_cost_file != "") { 
-    std::ofstream CostFile(m_cost_file.c_str());
-    CostFile<<"#Data";
+    //The file is opened (and cleared) here and kept open while running
+    m_file_sink.reset(new FileSink(m_cost_file));
+    m_logger->add_sink(m_file_sink);
   }
-  
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_quiet(const bool quiet)
+{
+  m_logger->remove_sink(m_console_sink);
+  if (!quiet)
+    m_logger->add_sink(m_console_sink);
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_parallel(const bool parallel)
+{
+  m_parallel = parallel;
+}
+
+template<class T>
+bool
+ICR::EnsembleLearning::Builder<T>::is_parallel() const
+{
+  return m_parallel;
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_synchronous(const bool synchronous)
+{
+  m_synchronous = synchronous;
+  if (!synchronous) {
+    //back to updating the moments in place
+    for(size_t i=0;i<m_synchronous_nodes;++i){
+      m_Nodes[i]->SetSynchronous(false);
+    }
+    m_synchronous_nodes = 0;
+    m_node_costs.clear();
+  }
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_reordering(const bool reorder)
+{
+  m_reorder = reorder;
+  if (!reorder)
+    m_sweep.clear();
+  m_compiled_valid = false;
+  //(the order is worked out before the next sweep)
+  if (!m_pruned.empty())
+    collect_unpruned();
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_bound_interval(const size_t interval, const double change)
+{
+  m_bound_interval = (interval == 0) ? 1 : interval;
+  m_bound_change = change;
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::add_sink(const boost::shared_ptr<CostSink>& sink)
+{
+  m_logger->add_sink(sink);
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::remove_sink(const boost::shared_ptr<CostSink>& sink)
+{
+  m_logger->remove_sink(sink);
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_checkpoint_file(const std::string& filename, const size_t interval)
+{
+  m_checkpoint_file = filename;
+  m_checkpoint_interval = (interval == 0) ? 1 : interval;
 }
 
 template<class T>
@@ -81,13 +288,14 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::WeightsNode
 ICR::EnsembleLearning::Builder<T>::weights(const size_t size)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   boost::shared_ptr<DirichletConstType > DirichletPrior(new DirichletConstType(size,1.0));
   boost::shared_ptr<DirichletType >      Dirichlet(new DirichletType(size));
   boost::shared_ptr<DirichletFactor >    DirichletF(new DirichletFactor(DirichletPrior.get(), Dirichlet.get()));
-  m_Nodes.push_back(DirichletPrior);
-  m_Nodes.push_back(Dirichlet);
+  add_node(DirichletPrior);
+  add_node(Dirichlet);
 
-  m_Factors.push_back(DirichletF);
+  add_factor(DirichletF);
 
   return Dirichlet.get();
 
@@ -98,12 +306,13 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::GaussianNode
 ICR::EnsembleLearning::Builder<T>::gaussian(Variable Mean, Variable Precision)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 	
   boost::shared_ptr<GaussianType > Gaussian(new GaussianType());
   boost::shared_ptr<GaussianFactor > GaussianF(new GaussianFactor(Mean, Precision, Gaussian.get()));
 	
-  m_Factors.push_back(GaussianF);
-  m_Nodes.push_back(Gaussian);
+  add_factor(GaussianF);
+  add_node(Gaussian);
 	
   return Gaussian.get();
 }
@@ -114,7 +323,7 @@ ICR::EnsembleLearning::Builder<T>::gaussian(GaussianNode Mean, const T& precisio
 {
 	
   boost::shared_ptr<GammaConstType > Precision(new GammaConstType(precision));
-  m_Nodes.push_back(Precision);
+  add_node(Precision);
   return gaussian(Mean,Precision.get());
 }
     
@@ -124,7 +333,7 @@ ICR::EnsembleLearning::Builder<T>::gaussian(const T& mean, GammaNode Precision)
 {
 	
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
-  m_Nodes.push_back(Mean);
+  add_node(Mean);
   return gaussian(Mean.get(),Precision);
 }
   
@@ -136,8 +345,8 @@ ICR::EnsembleLearning::Builder<T>::gaussian(const T& mean, const T& precision)
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
   boost::shared_ptr<GammaConstType > Precision(new GammaConstType(precision));
 	
-  m_Nodes.push_back(Mean);
-  m_Nodes.push_back(Precision);
+  add_node(Mean);
+  add_node(Precision);
 	
   return gaussian(Mean.get(),Precision.get());
 }
@@ -147,12 +356,13 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::RectifiedGaussianNode
 ICR::EnsembleLearning::Builder<T>::rectified_gaussian(Variable Mean,Variable  Precision)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 	
   boost::shared_ptr<RectifiedGaussianType > RectifiedGaussian(new RectifiedGaussianType());
   boost::shared_ptr<RectifiedGaussianFactor > RectifiedGaussianF(new RectifiedGaussianFactor(Mean, Precision, RectifiedGaussian.get()));
 	
-  m_Factors.push_back(RectifiedGaussianF);
-  m_Nodes.push_back(RectifiedGaussian);
+  add_factor(RectifiedGaussianF);
+  add_node(RectifiedGaussian);
 	
   return RectifiedGaussian.get();
 }
@@ -163,7 +373,7 @@ ICR::EnsembleLearning::Builder<T>::rectified_gaussian(GaussianNode Mean, const T
 {
 	
   boost::shared_ptr<GammaConstType > Precision(new GammaConstType(precision));
-  m_Nodes.push_back(Precision);
+  add_node(Precision);
   return rectified_gaussian(Mean,Precision.get());
 }
     
@@ -173,7 +383,7 @@ ICR::EnsembleLearning::Builder<T>::rectified_gaussian(const T& mean, GammaNode P
 {
 	
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
-  m_Nodes.push_back(Mean);
+  add_node(Mean);
   return rectified_gaussian(Mean.get(),Precision);
 }
   
@@ -185,8 +395,8 @@ ICR::EnsembleLearning::Builder<T>::rectified_gaussian(const T& mean, const T& pr
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
   boost::shared_ptr<GammaConstType > Precision(new GammaConstType(precision));
 	
-  m_Nodes.push_back(Mean);
-  m_Nodes.push_back(Precision);
+  add_node(Mean);
+  add_node(Precision);
 	
   return rectified_gaussian(Mean.get(),Precision.get());
 }
@@ -197,21 +407,47 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::GaussianNode
 ICR::EnsembleLearning::Builder<T>::gaussian_mixture(std::vector<Variable>& vMean, std::vector<Variable>& vPrecision, WeightsNode Weights)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   const size_t number = Weights->size();
 	
   boost::shared_ptr<CatagoryType>         Catagory(new CatagoryType(number));
   boost::shared_ptr<DiscreteFactor >      CatagoryF(new DiscreteFactor(Weights, Catagory.get()));
-  m_Nodes.push_back(Catagory);
-  m_Factors.push_back(CatagoryF);
+  add_node(Catagory);
+  add_factor(CatagoryF);
 	
 
   boost::shared_ptr<GaussianType> Child(new GaussianType());
 
-  m_Nodes.push_back(Child);
+  add_node(Child);
+	
+  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Child.get(),
+										    mixture_components(Weights, vMean, vPrecision),
+										    m_mixture_truncation,
+										    mixture_shortlist(Weights, m_mixture_truncation)));
+	
+  add_factor(MixtureF);
+  return Child.get();
+}
+
+template<class T>
+typename ICR::EnsembleLearning::Builder<T>::GaussianPlateNode
+ICR::EnsembleLearning::Builder<T>::gaussian_mixture(std::vector<Variable>& vMean, std::vector<Variable>& vPrecision, WeightsNode Weights,
+						    const size_t count)
+{
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  const size_t number = Weights->size();
 	
-  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Child.get()));
+  boost::shared_ptr<CatagoryPlateType>    Catagory(new CatagoryPlateType(count, number));
+  boost::shared_ptr<DiscretePlateFactor > CatagoryF(new DiscretePlateFactor(Weights, Catagory.get(), count));
+  add_node(Catagory);
+  add_factor(CatagoryF);
+
+  boost::shared_ptr<GaussianPlateType> Child(new GaussianPlateType(count));
+  add_node(Child);
 	
-  m_Factors.push_back(MixtureF);
+  boost::shared_ptr<GaussianMixturePlateFactor> MixtureF(new GaussianMixturePlateFactor(vMean, vPrecision, Catagory.get(), Child.get(), count,
+											  mixture_components(Weights, vMean, vPrecision)));
+  add_factor(MixtureF);
   return Child.get();
 }
 
@@ -219,21 +455,25 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::RectifiedGaussianNode
 ICR::EnsembleLearning::Builder<T>::rectified_gaussian_mixture(std::vector<Variable>& vMean, std::vector<Variable>& vPrecision, WeightsNode Weights)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   const size_t number = Weights->size();
 	
   boost::shared_ptr<CatagoryType>         Catagory(new CatagoryType(number));
   boost::shared_ptr<DiscreteFactor >      CatagoryF(new DiscreteFactor(Weights, Catagory.get()));
-  m_Nodes.push_back(Catagory);
-  m_Factors.push_back(CatagoryF);
+  add_node(Catagory);
+  add_factor(CatagoryF);
 	
 
   boost::shared_ptr<RectifiedGaussianType> Child(new RectifiedGaussianType());
 
-  m_Nodes.push_back(Child);
+  add_node(Child);
 	
-  boost::shared_ptr<RectifiedGaussianMixtureFactor> MixtureF(new RectifiedGaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Child.get()));
+  boost::shared_ptr<RectifiedGaussianMixtureFactor> MixtureF(new RectifiedGaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Child.get(),
+						mixture_components(Weights, vMean, vPrecision),
+						m_mixture_truncation,
+						mixture_shortlist(Weights, m_mixture_truncation)));
 	
-  m_Factors.push_back(MixtureF);
+  add_factor(MixtureF);
   return Child.get();
 }
 
@@ -241,6 +481,7 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::GammaNode
 ICR::EnsembleLearning::Builder<T>::gamma(const T& shape, const T& iscale)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   if ((shape<=0) || (iscale <=0)) {
     std::cout<<"Shape and iscale must be greater than zero"<<std::endl;
     throw("EXITING");
@@ -255,10 +496,10 @@ ICR::EnsembleLearning::Builder<T>::gamma(const T& shape, const T& iscale)
   boost::shared_ptr<GammaType > Gamma(new GammaType());
   boost::shared_ptr<GammaFactor > GammaF(new GammaFactor(Shape.get(), IScale.get(), Gamma.get()));
 	
-  m_Factors.push_back(GammaF);
-  m_Nodes.push_back(Shape);
-  m_Nodes.push_back(IScale);
-  m_Nodes.push_back(Gamma);
+  add_factor(GammaF);
+  add_node(Shape);
+  add_node(IScale);
+  add_node(Gamma);
 	
   return Gamma.get();
 }
@@ -269,7 +510,7 @@ typename ICR::EnsembleLearning::Builder<T>::GaussianConstNode
 ICR::EnsembleLearning::Builder<T>::gaussian_const(const T value)
 {
   boost::shared_ptr<GaussianConstType > Const(new GaussianConstType(value));
-  m_Nodes.push_back(Const);
+  add_node(Const);
 	
   return Const.get();
 }
@@ -286,7 +527,7 @@ ICR::EnsembleLearning::Builder<T>::gamma_const(const T value)
   BOOST_ASSERT(value>0);
 	
   boost::shared_ptr<GammaConstType > Const(new GammaConstType(value));
-  m_Nodes.push_back(Const);
+  add_node(Const);
 	
   return Const.get();
 }
@@ -297,8 +538,8 @@ ICR::EnsembleLearning::Builder<T>::gaussian_data(const T data)
 {
 	
   boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(data));
-  ++m_data_nodes;
-  m_Nodes.push_back(Data);
+  add_data_nodes(1);
+  add_node(Data);
 	
   return Data.get();
 }
@@ -310,8 +551,8 @@ ICR::EnsembleLearning::Builder<T>::gamma_data(const T data)
 {
 	
   boost::shared_ptr<GammaDataType > Data(new GammaDataType(data));
-  ++m_data_nodes;
-  m_Nodes.push_back(Data);
+  add_data_nodes(1);
+  add_node(Data);
 	
   return Data.get();
 }
@@ -320,12 +561,29 @@ template<class T>
 typename ICR::EnsembleLearning::Builder<T>::GaussianResultNode
 ICR::EnsembleLearning::Builder<T>::calc_gaussian(Expression<T>* Expr,  Context<T>& context)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  //The same calculation already exists, share it.
+  //(Two threads making the same calculation at once may both make it, which is harmless.)
+  GaussianResultNode shared = 0;
+#pragma omp critical(EnsembleLearning_calculations)
+  {
+    typename std::map<CalculationKey, GaussianResultNode, CalculationOrder>::const_iterator it
+      = m_calculations.find(CalculationKey(Expr, &context));
+    if (it != m_calculations.end())
+      shared = it->second;
+  }
+  if (shared != 0)
+    return shared;
+
   boost::shared_ptr<GaussianResultType > Child(new GaussianResultType());
   boost::shared_ptr<DeterministicFactor> ChildF
     (new DeterministicFactor(Expr, context,Child.get()));
 	
-  m_Nodes.push_back(Child);
-  m_Factors.push_back(ChildF);
+  add_node(Child);
+  add_factor(ChildF);
+  //(keyed on the factor's own copy of the context)
+#pragma omp critical(EnsembleLearning_calculations)
+  m_calculations[CalculationKey(Expr, &ChildF->GetContext())] = Child.get();
   return Child.get();
 }
 
@@ -334,16 +592,17 @@ template<class T>
 void 
 ICR::EnsembleLearning::Builder<T>::join(T& shape, GammaNode IScale ,  const T& data)
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GammaDataType > Data(new GammaDataType(data));
-  ++m_data_nodes;
+  add_data_nodes(1);
   boost::shared_ptr<NormalConstType > Shape(new NormalConstType(shape));
 	
   boost::shared_ptr<GammaFactor > GammaF (new GammaFactor(Shape.get(), IScale, Data.get()));
 	 
-  m_Factors.push_back(GammaF);
-  m_Nodes.push_back(Data);
-  m_Nodes.push_back(Shape);
+  add_factor(GammaF);
+  add_node(Data);
+  add_node(Shape);
   
 	
 }
@@ -351,15 +610,16 @@ template<class T>
 void
 ICR::EnsembleLearning::Builder<T>::join(T& shape, T& iscale, GammaDataNode Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<NormalConstType > Shape(new NormalConstType(shape));
   boost::shared_ptr<GammaConstType > IScale(new GammaConstType(iscale));
 	
   boost::shared_ptr<GammaFactor > GammaF (new GammaFactor(Shape.get(), IScale.get(), Data));
 	 
-  m_Factors.push_back(GammaF);
-  m_Nodes.push_back(Shape);
-  m_Nodes.push_back(IScale);
+  add_factor(GammaF);
+  add_node(Shape);
+  add_node(IScale);
 	
 }
 
@@ -367,50 +627,54 @@ template<class T>
 void 
 ICR::EnsembleLearning::Builder<T>::join(T& shape, GammaNode IScale, GammaDataNode Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   boost::shared_ptr<NormalConstType > Shape (new NormalConstType(shape));
   boost::shared_ptr<GammaFactor > GammaF (new GammaFactor(Shape.get(), IScale, Data));
 	 
-  m_Factors.push_back(GammaF);
-  m_Nodes.push_back(Shape);
+  add_factor(GammaF);
+  add_node(Shape);
 }
 
 template<class T>
 void 
 ICR::EnsembleLearning::Builder<T>::join(T& mean, T& precision, GaussianDataNode Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
   boost::shared_ptr<GammaConstType > Precision(new GammaConstType(precision));
 	
   boost::shared_ptr<GaussianFactor > GaussianF(new GaussianFactor (Mean.get(), Precision.get(), Data));
 	
-  m_Factors.push_back(GaussianF);
-  m_Nodes.push_back(Mean);
-  m_Nodes.push_back(Precision);
+  add_factor(GaussianF);
+  add_node(Mean);
+  add_node(Precision);
 }
    
 template<class T>   
 void 
 ICR::EnsembleLearning::Builder<T>::join(Variable Mean, T& precision, GaussianDataNode Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GaussianConstType > Precision(new GaussianConstType(precision));
   boost::shared_ptr<GaussianFactor > GaussianF(new GaussianFactor (Mean, Precision.get(), Data));
 	
-  m_Factors.push_back(GaussianF);
-  m_Nodes.push_back(Precision);
+  add_factor(GaussianF);
+  add_node(Precision);
 }
   
 template<class T>    
 void 
 ICR::EnsembleLearning::Builder<T>::join(T& mean, GammaNode Precision, GaussianDataNode Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GaussianConstType > Mean(new GaussianConstType(mean));
   boost::shared_ptr<GaussianFactor > GaussianF(new GaussianFactor(Mean.get(), Precision, Data));
 	
-  m_Factors.push_back(GaussianF);
-  m_Nodes.push_back(Mean);
+  add_factor(GaussianF);
+  add_node(Mean);
 }
       
   
@@ -418,29 +682,73 @@ template<class T>
 void 
 ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode& Precision, GaussianDataNode& Data  )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
   boost::shared_ptr<GaussianFactor> GaussianF(new GaussianFactor(Mean,Precision,Data));
-  m_Factors.push_back(GaussianF);
+  add_factor(GaussianF);
 }
 
 template<class T>
 void 
 ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode Precision, const T data )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 	
   boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(data));
-  ++m_data_nodes;
+  add_data_nodes(1);
   boost::shared_ptr<GaussianFactor> GaussianF(new GaussianFactor(Mean,Precision,Data.get()));
-  m_Factors.push_back(GaussianF);
-  m_Nodes.push_back(Data);
+  add_factor(GaussianF);
+  add_node(Data);
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode Precision, const std::vector<T>& data )
+{
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  if (data.empty()) return;
+  boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(data));
+  add_data_nodes(data.size());
+  boost::shared_ptr<GaussianPlateFactor> PlateF(new GaussianPlateFactor(Mean,Precision,Data.get(),data.size()));
+  add_factor(PlateF);
+  add_node(Data);
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::join(T& shape, GammaNode IScale, const std::vector<T>& data )
+{
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  if (data.empty()) return;
+  boost::shared_ptr<GammaDataType > Data(new GammaDataType(data));
+  add_data_nodes(data.size());
+  boost::shared_ptr<NormalConstType > Shape(new NormalConstType(shape));
+  boost::shared_ptr<GammaPlateFactor> PlateF(new GammaPlateFactor(Shape.get(),IScale,Data.get(),data.size()));
+  add_factor(PlateF);
+  add_node(Data);
+  add_node(Shape);
 }
 
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::join(GaussianPlateNode Mean, GammaNode Precision, const std::vector<T>& data )
+{
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  BOOST_ASSERT(data.size() == Mean->count());
+  if (data.empty()) return;
+  //(the moments of every value, one after another)
+  boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(plate_moments(data)));
+  add_data_nodes(data.size());
+  boost::shared_ptr<GaussianInstancePlateFactor> PlateF(new GaussianInstancePlateFactor(Mean,Precision,Data.get(),data.size()));
+  add_factor(PlateF);
+  add_node(Data);
+}
 
 // template<class T>
 // void 
 // ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode& Precision, GammaNode& Child  )
 // {
 //   boost::shared_ptr<GammaFactor> GammaF(new GammaFactor(Mean,Precision,Child));
-//   m_Factors.push_back(GammaF);
+//   add_factor(GammaF);
 // }
 
    
@@ -449,7 +757,7 @@ ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode Precision, cons
 // ICR::EnsembleLearning::Builder<T>::join(Variable Mean, GammaNode& Precision, GaussianNode& Child  )
 // {
 //   boost::shared_ptr<GaussianFactor> GaussianF(new GaussianFactor(Mean,Precision,Child));
-//   m_Factors.push_back(GaussianF);
+//   add_factor(GaussianF);
 // }
 
       
@@ -458,9 +766,10 @@ template<class T>
 void
 ICR::EnsembleLearning::Builder<T>::join( std::vector<Variable>& vMean, GammaNode& Precision, WeightsNode Weights,const T data )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(data));
-  ++m_data_nodes;
+  add_data_nodes(1);
 
 
   const size_t number = Weights->size();
@@ -468,41 +777,73 @@ ICR::EnsembleLearning::Builder<T>::join( std::vector<Variable>& vMean, GammaNode
 	
   boost::shared_ptr<CatagoryType>         Catagory(new CatagoryType(number));
   boost::shared_ptr<DiscreteFactor >      CatagoryF(new DiscreteFactor(Weights, Catagory.get()));
-  m_Nodes.push_back(Catagory);
-  m_Factors.push_back(CatagoryF);
+  add_node(Catagory);
+  add_factor(CatagoryF);
   //make the vector of precision nodes and CatagoryNodes
   for(size_t i=0;i<number;++i){
     vPrecision[i] = Precision;
   }
 	
-  m_Nodes.push_back(Data);
+  add_node(Data);
 	
-  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Data.get()));
+  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Data.get(),
+										    mixture_components(Weights, vMean, vPrecision),
+										    m_mixture_truncation,
+										    mixture_shortlist(Weights, m_mixture_truncation)));
 	
-  m_Factors.push_back(MixtureF);
+  add_factor(MixtureF);
 }
 
 template<class T>	
 void
 ICR::EnsembleLearning::Builder<T>::join( std::vector<Variable>& vMean, std::vector<Variable>& vPrecision, WeightsNode Weights,const T data )
 {
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
 
   boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(data));
-  ++m_data_nodes;
+  add_data_nodes(1);
 
   const size_t number = Weights->size();
 	
   boost::shared_ptr<CatagoryType>         Catagory(new CatagoryType(number));
   boost::shared_ptr<DiscreteFactor >      CatagoryF(new DiscreteFactor(Weights, Catagory.get()));
-  m_Nodes.push_back(Catagory);
-  m_Factors.push_back(CatagoryF);
+  add_node(Catagory);
+  add_factor(CatagoryF);
   //make the vector of precision nodes and CatagoryNodes
 	
-  m_Nodes.push_back(Data);
+  add_node(Data);
+	
+  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Data.get(),
+										    mixture_components(Weights, vMean, vPrecision),
+										    m_mixture_truncation,
+										    mixture_shortlist(Weights, m_mixture_truncation)));
 	
-  boost::shared_ptr<GaussianMixtureFactor> MixtureF(new GaussianMixtureFactor(vMean, vPrecision, Catagory.get() , Data.get()));
+  add_factor(MixtureF);
+}
+
+template<class T>	
+void
+ICR::EnsembleLearning::Builder<T>::join( std::vector<Variable>& vMean, std::vector<Variable>& vPrecision, WeightsNode Weights,const std::vector<T>& data )
+{
+  const typename detail::ChildStaging<T>::Scope staging(staged_links());
+  if (data.empty()) return;
+  const size_t count = data.size();
+
+  boost::shared_ptr<GaussianDataType > Data(new GaussianDataType(plate_moments(data)));
+  add_data_nodes(count);
+
+  const size_t number = Weights->size();
 	
-  m_Factors.push_back(MixtureF);
+  boost::shared_ptr<CatagoryPlateType>    Catagory(new CatagoryPlateType(count, number));
+  boost::shared_ptr<DiscretePlateFactor > CatagoryF(new DiscretePlateFactor(Weights, Catagory.get(), count));
+  add_node(Catagory);
+  add_factor(CatagoryF);
+	
+  add_node(Data);
+	
+  boost::shared_ptr<GaussianMixturePlateFactor> MixtureF(new GaussianMixturePlateFactor(vMean, vPrecision, Catagory.get(), Data.get(), count,
+											  mixture_components(Weights, vMean, vPrecision)));
+  add_factor(MixtureF);
 }
 	
 
@@ -522,89 +863,2365 @@ ICR::EnsembleLearning::Builder<T>::number_of_factors() const
 
 
 template<class T>
-void
-ICR::EnsembleLearning::Builder<T>::perturb()
+size_t
+ICR::EnsembleLearning::Builder<T>::number_of_iterations() const
+{
+  return m_iterations;
+}
+
+template<class T>
+const std::vector<double>&
+ICR::EnsembleLearning::Builder<T>::cost_history() const
 {
-  PARALLEL_FOREACH(m_Nodes.begin(), m_Nodes.end(),
-		   boost::bind(&VariableNode<T>::InitialiseMoments, _1)
-		   );
+  return m_cost_history;
 }
 
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::save_state(const std::string& filename) const
+{
+  //Write to a temporary file and then move it into place,
+  //so that a crash while checkpointing never leaves a truncated state behind.
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream out(tmp_filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    if (!out) {
+      std::cout<<"Unable to open "<<tmp_filename<<" to save the state"<<std::endl;
+      throw("EXITING");
+    }
+    
+    out.write(state_magic, sizeof(state_magic));
+    write_binary(out, state_version);
+    write_binary(out, boost::uint32_t(sizeof(T)));
+    write_binary(out, boost::uint64_t(m_Nodes.size()));
+    write_binary(out, boost::uint64_t(m_iterations));
+    write_binary(out, double(m_PrevCost));
+    write_binary(out, boost::uint64_t(m_cost_history.size()));
+    if (!m_cost_history.empty())
+      out.write(reinterpret_cast<const char*>(&m_cost_history[0]), 
+		m_cost_history.size()*sizeof(double));
+
+    std::vector<T> buffer;
+    for(size_t i=0;i<m_Nodes.size();++i){
+      const Moments<T>& m = m_Nodes[i]->GetMoments();
+      buffer.assign(m.size(), 0);
+      for(size_t j=0;j<m.size();++j){
+	buffer[j] = m[j];
+      }
+      write_binary(out, boost::uint64_t(buffer.size()));
+      if (!buffer.empty())
+	out.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size()*sizeof(T));
+    }
+    if (!out) {
+      std::cout<<"Failed to write the state to "<<tmp_filename<<std::endl;
+      throw("EXITING");
+    }
+  }
+  move_into_place(tmp_filename, filename);
+}
 
 template<class T>
-double
-ICR::EnsembleLearning::Builder<T>::iterate()
+void
+ICR::EnsembleLearning::Builder<T>::load_state(const std::string& filename)
 {
-  // Initialise();
-  if (m_Factors.size() == 0)
+  end_concurrent();
+  std::ifstream in(filename.c_str(), std::ios_base::binary);
+  if (!in) {
+    std::cout<<"Unable to open "<<filename<<" to load the state"<<std::endl;
+    throw("EXITING");
+  }
+
+  char magic[sizeof(state_magic)];
+  boost::uint32_t version, type_size;
+  boost::uint64_t nodes, iterations, history_size;
+  double prev_cost;
+  in.read(magic, sizeof(magic));
+  read_binary(in, version);
+  read_binary(in, type_size);
+  read_binary(in, nodes);
+  read_binary(in, iterations);
+  read_binary(in, prev_cost);
+  read_binary(in, history_size);
+  if (!in 
+      || std::memcmp(magic, state_magic, sizeof(magic)) != 0
+      || version != state_version
+      || type_size != sizeof(T)
+      || nodes != m_Nodes.size()) {
+    throw Exception::IncompatibleState();
+  }
+  
+  std::vector<double> history(history_size);
+  if (history_size != 0)
+    in.read(reinterpret_cast<char*>(&history[0]), history_size*sizeof(double));
+
+  //Read everything before touching the model, 
+  // so that a mismatched file leaves the current state intact.
+  std::vector<std::vector<T> > moments(m_Nodes.size());
+  for(size_t i=0;i<m_Nodes.size();++i){
+    boost::uint64_t size;
+    read_binary(in, size);
+    if (!in || size != m_Nodes[i]->GetMoments().size()) {
+      throw Exception::IncompatibleState();
+    }
+    moments[i].resize(size);
+    if (size != 0)
+      in.read(reinterpret_cast<char*>(&moments[i][0]), size*sizeof(T));
+  }
+  if (!in) {
+    throw Exception::IncompatibleState();
+  }
+
+  for(size_t i=0;i<m_Nodes.size();++i){
+    m_Nodes[i]->SetMoments(Moments<T>(moments[i]));
+  }
+  m_iterations   = iterations;
+  m_PrevCost     = prev_cost;
+  m_cost_history.swap(history);
+}
+
+namespace{
+  /* The layout of a saved graph is a sequence of 64 bit words
+   *   header:      magic (8 chars), version (uint32), sizeof(T) (uint32),
+   *                number of nodes, number of expressions, number of factors, number of data points
+   *   nodes:       for each node in order of creation, 
+   *                its type (GraphNode), the number of instances of a plate, the number of moments and the moments (double)
+   *   expressions: for each expression, the length of its postfix program and the program (see Expression::Postfix)
+   *   factors:     for each factor in order of creation, 
+   *                its type (GraphFactor), the number of arguments and the arguments.
+   *                The arguments are the indices of the adjacent nodes (the child last), preceded by 
+   *                the size of a plate, the number of components kept by a mixture, or the expression of a calculation.
+   *                The index of each parent of a calculation is followed by the id of its placeholder.
+   * Nodes and expressions are referred to by their index, so the file can be mapped anywhere.
+   * All values are written in the native byte order.
+   */
+  const char graph_magic[8] = {'E','L','G','R','A','P','H','\0'};
+  const boost::uint32_t graph_version = 1;
+
+  struct GraphNode
+  {
+    enum Value {
+      GAUSSIAN, RECTIFIED_GAUSSIAN, GAMMA, DIRICHLET, DISCRETE,
+      GAUSSIAN_OBSERVED, GAMMA_OBSERVED, DIRICHLET_OBSERVED,
+      GAUSSIAN_RESULT,
+      GAUSSIAN_PLATE, DISCRETE_PLATE
+    };
+  };
+
+  struct GraphFactor
+  {
+    enum Value {
+      GAUSSIAN, RECTIFIED_GAUSSIAN, GAMMA, DIRICHLET, DISCRETE,
+      GAUSSIAN_PLATE, GAMMA_PLATE,
+      GAUSSIAN_MIXTURE, RECTIFIED_GAUSSIAN_MIXTURE,
+      CALCULATION,
+      DISCRETE_PLATE, GAUSSIAN_MIXTURE_PLATE, GAUSSIAN_INSTANCE_PLATE
+    };
+  };
+
+  inline
+  boost::uint64_t
+  double_word(const double d)
+  {
+    boost::uint64_t w;
+    std::memcpy(&w, &d, sizeof(w));
+    return w;
+  }
+
+  //Reads a mapped graph in turn, 
+  // throwing if it ends early.
+  class GraphReader
+  {
+  public:
+    GraphReader(const char* begin, const size_t size)
+      : m_next(begin), m_end(begin + size)
+    {}
+
+    template<class D>
+    D
+    read()
     {
-      std::cout<<"No graph has been built, cannot iterate"<<std::endl;
-      return -1.0/0.0;
+      if (size_t(m_end - m_next) < sizeof(D))
+	throw ICR::EnsembleLearning::Exception::IncompatibleGraph();
+      D d;
+      std::memcpy(&d, m_next, sizeof(D));
+      m_next += sizeof(D);
+      return d;
     }
-	
-  Coster Cost;
-  for(size_t i=0;i<1;++i){
+
+    //A count of the words that follow, which cannot be more than are left.
+    size_t
+    count()
     {
-      // std::cout<<"ITERATE"<<std::endl;
-      Cost = 0;
+      const boost::uint64_t n = read<boost::uint64_t>();
+      if (n > size_t(m_end - m_next)/sizeof(boost::uint64_t))
+	throw ICR::EnsembleLearning::Exception::IncompatibleGraph();
+      return n;
+    }
 
-      // PARALLEL_FOREACH(m_Factors.begin(), m_Factors.end(),
-      // 		     boost::bind(&FactorNode<T>::Iterate, _1 )
-      // 		     );
-	    
-      // std::cout<<"ITERATE Nodes"<<std::endl;
-      PARALLEL_FOREACH(m_Nodes.begin(), m_Nodes.end(),
-		       boost::bind(&VariableNode<T>::Iterate, _1, boost::ref(Cost))
-		       );
+    //The moments that follow (preceded by their number).
+    template<class T>
+    ICR::EnsembleLearning::Moments<T>
+    moments()
+    {
+      ICR::EnsembleLearning::Moments<T> m(count());
+      for(size_t j=0;j<m.size();++j){
+	m[j] = read<double>();
+      }
+      return m;
+    }
+
+    //Skip the moments that follow.
+    void
+    skip_moments()
+    {
+      m_next += count()*sizeof(double);
+    }
+
+    //Skip the words that follow (preceded by their number).
+    void
+    skip_words()
+    {
+      m_next += count()*sizeof(boost::uint64_t);
+    }
 
+    //Where the reader is, to come back to with seek().
+    const char*
+    position() const {return m_next;}
+
+    void
+    seek(const char* position) {m_next = position;}
+
+    //An index less than size.
+    size_t
+    index(const size_t size)
+    {
+      const boost::uint64_t i = read<boost::uint64_t>();
+      if (i >= size)
+	throw ICR::EnsembleLearning::Exception::IncompatibleGraph();
+      return i;
     }
+
+    bool
+    finished() const {return m_next == m_end;}
+  private:
+    const char* m_next;
+    const char* m_end;
+  };
+
+  //The node at index i of nodes, which must be of type Node.
+  template<class Node, class T>
+  Node*
+  graph_node(const std::vector<boost::shared_ptr<ICR::EnsembleLearning::VariableNode<T> > >& nodes, 
+	     const size_t i)
+  {
+    Node* node = i < nodes.size() ? dynamic_cast<Node*>(nodes[i].get()) : 0;
+    if (node == 0)
+      throw ICR::EnsembleLearning::Exception::IncompatibleGraph();
+    return node;
   }
-  return Cost;
 
+  //A number of objects of one type in a single allocation, built in place one after another.
+  //(the nodes and factors can not be copied, so they can not be held in a vector)
+  template<class Object>
+  class Block
+  {
+  public:
+    explicit
+    Block(const size_t capacity)
+      : m_begin(static_cast<Object*>(::operator new(capacity*sizeof(Object)))),
+	m_size(0),
+	m_capacity(capacity)
+    {}
+
+    ~Block()
+    {
+      while (m_size != 0) 
+	m_begin[--m_size].~Object();
+      ::operator delete(m_begin);
+    }
+
+    //Where the next object is built (with placement new).
+    void*
+    next() const
+    {
+      if (m_size == m_capacity)
+	throw ICR::EnsembleLearning::Exception::IncompatibleGraph();
+      return m_begin + m_size;
+    }
+
+    //The object just built at next(), which now belongs to the block.
+    Object*
+    add(Object* object)
+    {
+      BOOST_ASSERT(object == m_begin + m_size);
+      ++m_size;
+      return object;
+    }
+  private:
+    Block(const Block&);
+    Block& operator=(const Block&);
+    Object* m_begin;
+    size_t m_size, m_capacity;
+  };
+
+  //The object just built in a block, which is kept alive for as long as any of its objects are.
+  template<class Base, class Object>
+  boost::shared_ptr<Base>
+  in_block(const boost::shared_ptr<Block<Object> >& block, Object* object)
+  {
+    return boost::shared_ptr<Base>(block, block->add(object));
+  }
 }
 
 template<class T>
-bool
-ICR::EnsembleLearning::Builder<T>::run(const double& epsilon, const size_t& max_iterations , size_t skip)
+void
+ICR::EnsembleLearning::Builder<T>::save_graph(const std::string& filename) const
 {
-  //std::cout<<"initialising"<<std::endl;
-  for(size_t i=0;i<skip;++i){
-    iterate();
-  }
-	
-  for(size_t i=0;i<max_iterations;++i){
-    double Cost = iterate()/m_data_nodes;
-	  
-    if (HasConverged(Cost, epsilon))
-      return true;
+  //The index of every node, sorted by its address to be looked up.
+  typedef std::pair<VariableNode<T>*, boost::uint64_t> Index;
+  std::vector<Index> index(m_Nodes.size());
+  std::vector<boost::uint64_t> nodes;
+  for(size_t i=0;i<m_Nodes.size();++i){
+    VariableNode<T>* node = m_Nodes[i].get();
+    index[i] = Index(node, i);
+    GraphNode::Value type;
+    if (dynamic_cast<GaussianResultType*>(node))
+      type = GraphNode::GAUSSIAN_RESULT;
+    else if (dynamic_cast<GaussianType*>(node))
+      type = GraphNode::GAUSSIAN;
+    else if (dynamic_cast<RectifiedGaussianType*>(node))
+      type = GraphNode::RECTIFIED_GAUSSIAN;
+    else if (dynamic_cast<GammaType*>(node))
+      type = GraphNode::GAMMA;
+    else if (dynamic_cast<DirichletType*>(node))
+      type = GraphNode::DIRICHLET;
+    else if (dynamic_cast<CatagoryType*>(node))
+      type = GraphNode::DISCRETE;
+    else if (dynamic_cast<GaussianDataType*>(node))
+      type = GraphNode::GAUSSIAN_OBSERVED;
+    else if (dynamic_cast<GammaDataType*>(node))
+      type = GraphNode::GAMMA_OBSERVED;
+    else if (dynamic_cast<DirichletConstType*>(node))
+      type = GraphNode::DIRICHLET_OBSERVED;
+    else if (dynamic_cast<GaussianPlateType*>(node))
+      type = GraphNode::GAUSSIAN_PLATE;
+    else if (dynamic_cast<CatagoryPlateType*>(node))
+      type = GraphNode::DISCRETE_PLATE;
+    else 
+      throw Exception::IncompatibleGraph();
+    const Moments<T>& m = node->GetMoments();
+    nodes.push_back(type);
+    if (type == GraphNode::GAUSSIAN_PLATE)
+      nodes.push_back(static_cast<GaussianPlateType*>(node)->count());
+    else if (type == GraphNode::DISCRETE_PLATE)
+      nodes.push_back(static_cast<CatagoryPlateType*>(node)->count());
+    nodes.push_back(m.size());
+    for(size_t j=0;j<m.size();++j){
+      nodes.push_back(double_word(m[j]));
+    }
   }
 
-  return false;
+  std::sort(index.begin(), index.end());
+
+  //Each expression is written once, however many calculations share it.
+  std::map<Expression<T>*, boost::uint64_t> expression_index;
+  std::vector<boost::uint64_t> expressions, factors;
+  std::vector<size_t> program;
+  std::vector<VariableNode<T>*> adjacent;
+  std::vector<boost::uint64_t> args;
+  for(size_t f=0;f<m_Factors.size();++f){
+    FactorNode<T>* factor = m_Factors[f].get();
+    DeterministicFactor* calculation = 0;
+    GraphFactor::Value type;
+    args.clear();
+    //(the plates are also factors, so they are tried first)
+    if (GaussianPlateFactor* plate = dynamic_cast<GaussianPlateFactor*>(factor)) {
+      type = GraphFactor::GAUSSIAN_PLATE;
+      args.push_back(plate->size());
+    }
+    else if (GammaPlateFactor* plate = dynamic_cast<GammaPlateFactor*>(factor)) {
+      type = GraphFactor::GAMMA_PLATE;
+      args.push_back(plate->size());
+    }
+    else if (dynamic_cast<GaussianFactor*>(factor))
+      type = GraphFactor::GAUSSIAN;
+    else if (dynamic_cast<RectifiedGaussianFactor*>(factor))
+      type = GraphFactor::RECTIFIED_GAUSSIAN;
+    else if (dynamic_cast<GammaFactor*>(factor))
+      type = GraphFactor::GAMMA;
+    else if (dynamic_cast<DirichletFactor*>(factor))
+      type = GraphFactor::DIRICHLET;
+    else if (dynamic_cast<DiscreteFactor*>(factor))
+      type = GraphFactor::DISCRETE;
+    else if (GaussianMixtureFactor* mixture = dynamic_cast<GaussianMixtureFactor*>(factor)) {
+      type = GraphFactor::GAUSSIAN_MIXTURE;
+      args.push_back(mixture->keep());
+    }
+    else if (RectifiedGaussianMixtureFactor* mixture = dynamic_cast<RectifiedGaussianMixtureFactor*>(factor)) {
+      type = GraphFactor::RECTIFIED_GAUSSIAN_MIXTURE;
+      args.push_back(mixture->keep());
+    }
+    else if (DiscretePlateFactor* plate = dynamic_cast<DiscretePlateFactor*>(factor)) {
+      type = GraphFactor::DISCRETE_PLATE;
+      args.push_back(plate->size());
+    }
+    else if (GaussianMixturePlateFactor* plate = dynamic_cast<GaussianMixturePlateFactor*>(factor)) {
+      type = GraphFactor::GAUSSIAN_MIXTURE_PLATE;
+      args.push_back(plate->size());
+    }
+    else if (GaussianInstancePlateFactor* plate = dynamic_cast<GaussianInstancePlateFactor*>(factor)) {
+      type = GraphFactor::GAUSSIAN_INSTANCE_PLATE;
+      args.push_back(plate->size());
+    }
+    else if ((calculation = dynamic_cast<DeterministicFactor*>(factor))) {
+      type = GraphFactor::CALCULATION;
+      Expression<T>* Expr = calculation->GetExpression();
+      if (expression_index.count(Expr) == 0) {
+	const boost::uint64_t e = expression_index.size();
+	expression_index[Expr] = e;
+	program.clear();
+	Expr->Postfix(program);
+	expressions.push_back(program.size());
+	expressions.insert(expressions.end(), program.begin(), program.end());
+      }
+      args.push_back(expression_index[Expr]);
+    }
+    else 
+      throw Exception::IncompatibleGraph();
+
+    adjacent.clear();
+    factor->GetAdjacentNodes(adjacent);
+    for(size_t j=0;j<adjacent.size();++j){
+      typename std::vector<Index>::const_iterator it 
+	= std::lower_bound(index.begin(), index.end(), Index(adjacent[j], 0));
+      if (it == index.end() || it->first != adjacent[j]) 
+	throw Exception::IncompatibleGraph();
+      args.push_back(it->second);
+      if (calculation != 0 && j+1 != adjacent.size())
+	args.push_back(calculation->GetContext().Lookup(adjacent[j])->id());
+    }
+    factors.push_back(type);
+    factors.push_back(args.size());
+    factors.insert(factors.end(), args.begin(), args.end());
+  }
 
+  //(written as save_state() is)
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream out(tmp_filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    if (!out) {
+      std::cout<<"Unable to open "<<tmp_filename<<" to save the graph"<<std::endl;
+      throw("EXITING");
+    }
+    out.write(graph_magic, sizeof(graph_magic));
+    write_binary(out, graph_version);
+    write_binary(out, boost::uint32_t(sizeof(T)));
+    write_binary(out, boost::uint64_t(m_Nodes.size()));
+    write_binary(out, boost::uint64_t(expression_index.size()));
+    write_binary(out, boost::uint64_t(m_Factors.size()));
+    write_binary(out, boost::uint64_t(m_data_nodes));
+    if (!nodes.empty())
+      out.write(reinterpret_cast<const char*>(&nodes[0]), nodes.size()*sizeof(boost::uint64_t));
+    if (!expressions.empty())
+      out.write(reinterpret_cast<const char*>(&expressions[0]), expressions.size()*sizeof(boost::uint64_t));
+    if (!factors.empty())
+      out.write(reinterpret_cast<const char*>(&factors[0]), factors.size()*sizeof(boost::uint64_t));
+    if (!out) {
+      std::cout<<"Failed to write the graph to "<<tmp_filename<<std::endl;
+      throw("EXITING");
+    }
+  }
+  move_into_place(tmp_filename, filename);
 }
-    
-     
-      
+
 template<class T>
-bool
-ICR::EnsembleLearning::Builder<T>::HasConverged(const T Cost, const T epsilon)
+void
+ICR::EnsembleLearning::Builder<T>::load_graph(const std::string& filename)
 {
-#pragma omp critical
-  {
-    std::cout<<"COST = "<<Cost<<"\t% difference = "<<100.0*(((Cost-m_PrevCost)/std::fabs(Cost)))<<std::endl;
-    if (m_cost_file != "") { 
-      std::ofstream CostFile(m_cost_file.c_str(),std::ios_base::app);
-      CostFile<<Cost<<"\n";
+  end_concurrent();
+  if (!m_Nodes.empty() || !m_Factors.empty()) 
+    throw Exception::IncompatibleGraph();
+  if (!std::ifstream(filename.c_str())) {
+    std::cout<<"Unable to open "<<filename<<" to load the graph"<<std::endl;
+    throw("EXITING");
+  }
+  namespace ip = boost::interprocess;
+  boost::shared_ptr<ip::mapped_region> region;
+  try {
+    ip::file_mapping file(filename.c_str(), ip::read_only);
+    region.reset(new ip::mapped_region(file, ip::read_only));
+  }
+  catch(ip::interprocess_exception&) {
+    //(an empty file cannot be mapped)
+    throw Exception::IncompatibleGraph();
+  }
+  GraphReader in(static_cast<const char*>(region->get_address()), region->get_size());
+
+  char magic[sizeof(graph_magic)];
+  for(size_t i=0;i<sizeof(magic);++i){
+    magic[i] = in.read<char>();
+  }
+  const boost::uint32_t version   = in.read<boost::uint32_t>();
+  const boost::uint32_t type_size = in.read<boost::uint32_t>();
+  if (std::memcmp(magic, graph_magic, sizeof(magic)) != 0
+      || version != graph_version
+      || type_size != sizeof(T)) {
+    throw Exception::IncompatibleGraph();
+  }
+  //(every node, expression and factor takes a word at least)
+  const size_t node_count       = in.count();
+  const size_t expression_count = in.count();
+  const size_t factor_count     = in.count();
+  const boost::uint64_t data_nodes = in.read<boost::uint64_t>();
+
+  //The model is put together on the side, 
+  // so that a damaged file leaves the builder empty.
+  //The nodes of each type are counted first, and built in place in one allocation for the type.
+  const char* node_records = in.position();
+  std::vector<size_t> node_types(GraphNode::DISCRETE_PLATE + 1, 0);
+  for(size_t i=0;i<node_count;++i){
+    const boost::uint64_t type = in.read<boost::uint64_t>();
+    if (type == GraphNode::GAUSSIAN_PLATE || type == GraphNode::DISCRETE_PLATE) 
+      in.read<boost::uint64_t>();
+    in.skip_moments();
+    if (type < node_types.size()) 
+      ++node_types[type];
+  }
+  in.seek(node_records);
+  boost::shared_ptr<Block<GaussianType> >          Gaussians(new Block<GaussianType>(node_types[GraphNode::GAUSSIAN]));
+  boost::shared_ptr<Block<RectifiedGaussianType> > RectifiedGaussians(new Block<RectifiedGaussianType>(node_types[GraphNode::RECTIFIED_GAUSSIAN]));
+  boost::shared_ptr<Block<GammaType> >             Gammas(new Block<GammaType>(node_types[GraphNode::GAMMA]));
+  boost::shared_ptr<Block<DirichletType> >         Dirichlets(new Block<DirichletType>(node_types[GraphNode::DIRICHLET]));
+  boost::shared_ptr<Block<CatagoryType> >          Catagories(new Block<CatagoryType>(node_types[GraphNode::DISCRETE]));
+  boost::shared_ptr<Block<GaussianResultType> >    Results(new Block<GaussianResultType>(node_types[GraphNode::GAUSSIAN_RESULT]));
+  boost::shared_ptr<Block<GaussianDataType> >      GaussianData(new Block<GaussianDataType>(node_types[GraphNode::GAUSSIAN_OBSERVED]));
+  boost::shared_ptr<Block<GammaDataType> >         GammaData(new Block<GammaDataType>(node_types[GraphNode::GAMMA_OBSERVED]));
+  boost::shared_ptr<Block<DirichletConstType> >    DirichletData(new Block<DirichletConstType>(node_types[GraphNode::DIRICHLET_OBSERVED]));
+  boost::shared_ptr<Block<GaussianPlateType> >     GaussianPlates(new Block<GaussianPlateType>(node_types[GraphNode::GAUSSIAN_PLATE]));
+  boost::shared_ptr<Block<CatagoryPlateType> >     CatagoryPlates(new Block<CatagoryPlateType>(node_types[GraphNode::DISCRETE_PLATE]));
+
+  std::vector<boost::shared_ptr<VariableNode<T> > > nodes;
+  nodes.reserve(node_count);
+  //The moments of the nodes that are not observed are set once the factors are in place,
+  // they are read from the mapping again then.
+  std::vector<std::pair<size_t, const char*> > hidden;
+  for(size_t i=0;i<node_count;++i){
+    const boost::uint64_t type = in.read<boost::uint64_t>();
+    const size_t instances 
+      = (type == GraphNode::GAUSSIAN_PLATE || type == GraphNode::DISCRETE_PLATE) ? in.read<boost::uint64_t>() : 1;
+    const char* moments = in.position();
+    const size_t size = in.count();
+    in.seek(moments);
+    //Only the Dirichlet and Discrete models and the plates have other than two moments.
+    //(an observed plate holds the moments of each value)
+    const bool pair = size == 2;
+    const bool plate = instances != 0 && size != 0 && size%instances == 0;
+    typedef VariableNode<T> V;
+    boost::shared_ptr<V> node;
+    switch (type) {
+    case GraphNode::GAUSSIAN:           
+      if (pair) node = in_block<V>(Gaussians, new (Gaussians->next()) GaussianType()); 
+      break;
+    case GraphNode::RECTIFIED_GAUSSIAN: 
+      if (pair) node = in_block<V>(RectifiedGaussians, new (RectifiedGaussians->next()) RectifiedGaussianType()); 
+      break;
+    case GraphNode::GAMMA:              
+      if (pair) node = in_block<V>(Gammas, new (Gammas->next()) GammaType()); 
+      break;
+    case GraphNode::DIRICHLET:          
+      if (size != 0) node = in_block<V>(Dirichlets, new (Dirichlets->next()) DirichletType(size)); 
+      break;
+    case GraphNode::DISCRETE:           
+      if (size != 0) node = in_block<V>(Catagories, new (Catagories->next()) CatagoryType(size)); 
+      break;
+    case GraphNode::GAUSSIAN_RESULT:    
+      if (pair) node = in_block<V>(Results, new (Results->next()) GaussianResultType()); 
+      break;
+    case GraphNode::GAUSSIAN_OBSERVED:  
+      if (size != 0 && size%2 == 0) node = in_block<V>(GaussianData, new (GaussianData->next()) GaussianDataType(in.moments<T>())); 
+      break;
+    case GraphNode::GAMMA_OBSERVED:     
+      if (pair) node = in_block<V>(GammaData, new (GammaData->next()) GammaDataType(in.moments<T>())); 
+      break;
+    case GraphNode::DIRICHLET_OBSERVED: 
+      if (size != 0) node = in_block<V>(DirichletData, new (DirichletData->next()) DirichletConstType(in.moments<T>())); 
+      break;
+    case GraphNode::GAUSSIAN_PLATE:     
+      if (plate && size == 2*instances) node = in_block<V>(GaussianPlates, new (GaussianPlates->next()) GaussianPlateType(instances)); 
+      break;
+    case GraphNode::DISCRETE_PLATE:     
+      if (plate) node = in_block<V>(CatagoryPlates, new (CatagoryPlates->next()) CatagoryPlateType(instances, size/instances)); 
+      break;
+    }
+    if (!node)
+      throw Exception::IncompatibleGraph();
+    if (in.position() == moments) {
+      hidden.push_back(std::make_pair(i, moments));
+      in.skip_moments();
     }
+    nodes.push_back(node);
+  }
+
+  //Every expression is rebuilt by a factory of its own.
+  // The placeholders are made as they are first met, and found by their saved id.
+  typedef std::map<boost::uint64_t, Placeholder<T>*> PlaceholderMap;
+  std::vector<boost::shared_ptr<ExpressionFactory<T> > > factories;
+  std::vector<PlaceholderMap> placeholders(expression_count);
+  std::vector<Expression<T>*> roots;
+  for(size_t e=0;e<expression_count;++e){
+    const size_t length = in.count();
+    boost::shared_ptr<ExpressionFactory<T> > factory(new ExpressionFactory<T>());
+    std::vector<Expression<T>*> stack;
+    for(size_t j=0;j<length;++j){
+      const boost::uint64_t code = in.read<boost::uint64_t>();
+      if (code == ExpressionCode::PLACEHOLDER && j+1<length) {
+	Placeholder<T>*& P = placeholders[e][in.read<boost::uint64_t>()];
+	if (P == 0)
+	  P = factory->placeholder();
+	stack.push_back(P);
+	++j;
+	continue;
+      }
+      if (stack.size() < 2)
+	throw Exception::IncompatibleGraph();
+      Expression<T>* b = stack.back(); stack.pop_back();
+      Expression<T>* a = stack.back(); stack.pop_back();
+      if (code == ExpressionCode::PLUS)
+	stack.push_back(factory->Add(a,b));
+      else if (code == ExpressionCode::TIMES)
+	stack.push_back(factory->Multiply(a,b));
+      else 
+	throw Exception::IncompatibleGraph();
+    }
+    if (stack.size() != 1)
+      throw Exception::IncompatibleGraph();
+    factories.push_back(factory);
+    roots.push_back(stack.back());
+  }
+
+  //The factors are built as the nodes are (their types are counted first).
+  const char* factor_records = in.position();
+  std::vector<size_t> factor_types(GraphFactor::GAUSSIAN_INSTANCE_PLATE + 1, 0);
+  for(size_t f=0;f<factor_count;++f){
+    const boost::uint64_t type = in.read<boost::uint64_t>();
+    in.skip_words();
+    if (type < factor_types.size()) 
+      ++factor_types[type];
+  }
+  in.seek(factor_records);
+  boost::shared_ptr<Block<GaussianFactor> >                 GaussianFactors(new Block<GaussianFactor>(factor_types[GraphFactor::GAUSSIAN]));
+  boost::shared_ptr<Block<RectifiedGaussianFactor> >        RectifiedGaussianFactors(new Block<RectifiedGaussianFactor>(factor_types[GraphFactor::RECTIFIED_GAUSSIAN]));
+  boost::shared_ptr<Block<GammaFactor> >                    GammaFactors(new Block<GammaFactor>(factor_types[GraphFactor::GAMMA]));
+  boost::shared_ptr<Block<DirichletFactor> >                DirichletFactors(new Block<DirichletFactor>(factor_types[GraphFactor::DIRICHLET]));
+  boost::shared_ptr<Block<DiscreteFactor> >                 DiscreteFactors(new Block<DiscreteFactor>(factor_types[GraphFactor::DISCRETE]));
+  boost::shared_ptr<Block<GaussianPlateFactor> >            GaussianPlateFactors(new Block<GaussianPlateFactor>(factor_types[GraphFactor::GAUSSIAN_PLATE]));
+  boost::shared_ptr<Block<GammaPlateFactor> >               GammaPlateFactors(new Block<GammaPlateFactor>(factor_types[GraphFactor::GAMMA_PLATE]));
+  boost::shared_ptr<Block<GaussianMixtureFactor> >          GaussianMixtures(new Block<GaussianMixtureFactor>(factor_types[GraphFactor::GAUSSIAN_MIXTURE]));
+  boost::shared_ptr<Block<RectifiedGaussianMixtureFactor> > RectifiedGaussianMixtures(new Block<RectifiedGaussianMixtureFactor>(factor_types[GraphFactor::RECTIFIED_GAUSSIAN_MIXTURE]));
+  boost::shared_ptr<Block<DiscretePlateFactor> >            DiscretePlates(new Block<DiscretePlateFactor>(factor_types[GraphFactor::DISCRETE_PLATE]));
+  boost::shared_ptr<Block<GaussianMixturePlateFactor> >     GaussianMixturePlates(new Block<GaussianMixturePlateFactor>(factor_types[GraphFactor::GAUSSIAN_MIXTURE_PLATE]));
+  boost::shared_ptr<Block<GaussianInstancePlateFactor> >    GaussianInstancePlates(new Block<GaussianInstancePlateFactor>(factor_types[GraphFactor::GAUSSIAN_INSTANCE_PLATE]));
+  boost::shared_ptr<Block<DeterministicFactor> >            Calculations(new Block<DeterministicFactor>(factor_types[GraphFactor::CALCULATION]));
+
+  std::vector<boost::shared_ptr<FactorNode<T> > > factors;
+  factors.reserve(factor_count);
+  //The children of every node are collected, and each node is given all of its own at once.
+  //(the moments are read once the graph is in place, so the nodes are not initialised on the way)
+  typename detail::ChildStaging<T>::Links links(omp_get_thread_num() + 1);
+  try {
+    const typename detail::ChildStaging<T>::Scope staging(&links, false);
+    typedef FactorNode<T> F;
+    //The weights of a mixture are the parent of its catagory.
+    std::vector<WeightsNode> weights(nodes.size(), WeightsNode(0));
+    std::vector<boost::uint64_t> args;
+    std::vector<Variable> vParent1, vParent2;
+    for(size_t f=0;f<factor_count;++f){
+      const boost::uint64_t type = in.read<boost::uint64_t>();
+      args.resize(in.count());
+      for(size_t j=0;j<args.size();++j){
+	args[j] = in.read<boost::uint64_t>();
+      }
+      const size_t size = args.size();
+      boost::shared_ptr<FactorNode<T> > factor;
+      switch (type) {
+      case GraphFactor::GAUSSIAN: 
+      case GraphFactor::RECTIFIED_GAUSSIAN: 
+      case GraphFactor::GAMMA: {
+	if (size != 3) break;
+	Variable Parent1 = graph_node<VariableNode<T> >(nodes, args[0]);
+	Variable Parent2 = graph_node<VariableNode<T> >(nodes, args[1]);
+	Variable Child   = graph_node<VariableNode<T> >(nodes, args[2]);
+	if (type == GraphFactor::GAUSSIAN) 
+	  factor = in_block<F>(GaussianFactors, new (GaussianFactors->next()) GaussianFactor(Parent1, Parent2, Child));
+	else if (type == GraphFactor::RECTIFIED_GAUSSIAN) 
+	  factor = in_block<F>(RectifiedGaussianFactors, new (RectifiedGaussianFactors->next()) RectifiedGaussianFactor(Parent1, Parent2, Child));
+	else
+	  factor = in_block<F>(GammaFactors, new (GammaFactors->next()) GammaFactor(Parent1, Parent2, Child));
+	break;
+      }
+      case GraphFactor::DIRICHLET: {
+	if (size != 2) break;
+	factor = in_block<F>(DirichletFactors, new (DirichletFactors->next()) DirichletFactor(graph_node<VariableNode<T> >(nodes, args[0]), 
+					 graph_node<VariableNode<T> >(nodes, args[1])));
+	break;
+      }
+      case GraphFactor::DISCRETE: {
+	if (size != 2) break;
+	WeightsNode Weights = graph_node<WeightsType>(nodes, args[0]);
+	CatagoryNode Catagory = graph_node<CatagoryType>(nodes, args[1]);
+	factor = in_block<F>(DiscreteFactors, new (DiscreteFactors->next()) DiscreteFactor(Weights, Catagory));
+	weights[args[1]] = Weights;
+	break;
+      }
+      case GraphFactor::GAUSSIAN_PLATE: 
+      case GraphFactor::GAMMA_PLATE: {
+	if (size != 4) break;
+	Variable Parent1 = graph_node<VariableNode<T> >(nodes, args[1]);
+	Variable Parent2 = graph_node<VariableNode<T> >(nodes, args[2]);
+	Variable Child   = graph_node<VariableNode<T> >(nodes, args[3]);
+	if (type == GraphFactor::GAUSSIAN_PLATE) 
+	  factor = in_block<F>(GaussianPlateFactors, new (GaussianPlateFactors->next()) GaussianPlateFactor(Parent1, Parent2, Child, args[0]));
+	else
+	  factor = in_block<F>(GammaPlateFactors, new (GammaPlateFactors->next()) GammaPlateFactor(Parent1, Parent2, Child, args[0]));
+	break;
+      }
+      case GraphFactor::GAUSSIAN_MIXTURE: 
+      case GraphFactor::RECTIFIED_GAUSSIAN_MIXTURE: {
+	//(keep, the components' first and second parents, the catagory and the child)
+	if (size < 5 || (size-3)%2 != 0) break;
+	const size_t number = (size-3)/2;
+	vParent1.resize(number);
+	vParent2.resize(number);
+	for(size_t k=0;k<number;++k){
+	  vParent1[k] = graph_node<VariableNode<T> >(nodes, args[1+k]);
+	  vParent2[k] = graph_node<VariableNode<T> >(nodes, args[1+number+k]);
+	}
+	CatagoryNode Catagory = graph_node<CatagoryType>(nodes, args[size-2]);
+	Variable Child = graph_node<VariableNode<T> >(nodes, args[size-1]);
+	WeightsNode Weights = weights[args[size-2]];
+	if (Weights == 0 || Weights->size() != number) break;
+	if (type == GraphFactor::GAUSSIAN_MIXTURE)
+	  factor = in_block<F>(GaussianMixtures, new (GaussianMixtures->next()) GaussianMixtureFactor(vParent1, vParent2, Catagory, Child,
+						 mixture_components(Weights, vParent1, vParent2),
+						 args[0],
+						 mixture_shortlist(Weights, args[0])));
+	else
+	  factor = in_block<F>(RectifiedGaussianMixtures, new (RectifiedGaussianMixtures->next()) RectifiedGaussianMixtureFactor(vParent1, vParent2, Catagory, Child,
+							  mixture_components(Weights, vParent1, vParent2),
+							  args[0],
+							  mixture_shortlist(Weights, args[0])));
+	break;
+      }
+      case GraphFactor::DISCRETE_PLATE: {
+	if (size != 3) break;
+	WeightsNode Weights = graph_node<WeightsType>(nodes, args[1]);
+	CatagoryPlateType* Catagory = graph_node<CatagoryPlateType>(nodes, args[2]);
+	if (Catagory->count() != args[0] || Catagory->size() != Weights->size()) break;
+	factor = in_block<F>(DiscretePlates, new (DiscretePlates->next()) DiscretePlateFactor(Weights, Catagory, args[0]));
+	weights[args[2]] = Weights;
+	break;
+      }
+      case GraphFactor::GAUSSIAN_MIXTURE_PLATE: {
+	//(the size, the components' first and second parents, the catagories and the children)
+	if (size < 5 || (size-3)%2 != 0) break;
+	const size_t number = (size-3)/2;
+	vParent1.resize(number);
+	vParent2.resize(number);
+	for(size_t k=0;k<number;++k){
+	  vParent1[k] = graph_node<VariableNode<T> >(nodes, args[1+k]);
+	  vParent2[k] = graph_node<VariableNode<T> >(nodes, args[1+number+k]);
+	}
+	CatagoryPlateType* Catagory = graph_node<CatagoryPlateType>(nodes, args[size-2]);
+	Variable Child = graph_node<VariableNode<T> >(nodes, args[size-1]);
+	WeightsNode Weights = weights[args[size-2]];
+	if (Weights == 0 || Weights->size() != number || Child->GetMoments().size() != 2*args[0]) break;
+	factor = in_block<F>(GaussianMixturePlates, new (GaussianMixturePlates->next()) GaussianMixturePlateFactor(vParent1, vParent2, Catagory, Child, args[0],
+						    mixture_components(Weights, vParent1, vParent2)));
+	break;
+      }
+      case GraphFactor::GAUSSIAN_INSTANCE_PLATE: {
+	if (size != 4) break;
+	Variable Parent1 = graph_node<VariableNode<T> >(nodes, args[1]);
+	Variable Parent2 = graph_node<VariableNode<T> >(nodes, args[2]);
+	Variable Child   = graph_node<VariableNode<T> >(nodes, args[3]);
+	if (Child->GetMoments().size() != 2*args[0]) break;
+	factor = in_block<F>(GaussianInstancePlates, new (GaussianInstancePlates->next()) GaussianInstancePlateFactor(Parent1, Parent2, Child, args[0]));
+	break;
+      }
+      case GraphFactor::CALCULATION: {
+	//(the expression, each parent and its placeholder, and the child)
+	if (size < 2 || size%2 != 0 || args[0] >= expression_count) break;
+	const PlaceholderMap& Placeholders = placeholders[args[0]];
+	Context<T> context;
+	for(size_t j=1;j+1<size;j+=2){
+	  typename PlaceholderMap::const_iterator P = Placeholders.find(args[j+1]);
+	  if (P == Placeholders.end())
+	    throw Exception::IncompatibleGraph();
+	  context.Assign(P->second, graph_node<VariableNode<T> >(nodes, args[j]));
+	}
+	GaussianResultNode Child = graph_node<GaussianResultType>(nodes, args[size-1]);
+	//(the expressions belong to the builder, so calc_gaussian() can not be given them to share the calculation)
+	factor = in_block<F>(Calculations, new (Calculations->next()) DeterministicFactor(roots[args[0]], context, Child));
+	break;
+      }
+      }
+      if (!factor)
+	throw Exception::IncompatibleGraph();
+      factors.push_back(factor);
+    }
+    if (!in.finished())
+      throw Exception::IncompatibleGraph();
+  }
+  catch(...) {
+    m_mixtures.clear();
+    throw;
+  }
+
+  m_Nodes.swap(nodes);
+  m_Factors.swap(factors);
+  m_data_nodes = data_nodes;
+  m_graph_expressions.insert(m_graph_expressions.end(), factories.begin(), factories.end());
+  m_staged_links.swap(links);
+  link_staged_children();
+  m_staged_links.clear();
+  for(size_t i=0;i<hidden.size();++i){
+    in.seek(hidden[i].second);
+    m_Nodes[hidden[i].first]->SetMoments(in.moments<T>());
   }
-  if (100.0*std::fabs((Cost - m_PrevCost)/Cost)<epsilon) 
-    return true;
-	
-  m_PrevCost = Cost;
-  return false;
 }
-    
 
+template<class T>
+typename ICR::EnsembleLearning::Builder<T>::Variable
+ICR::EnsembleLearning::Builder<T>::node(const size_t i) const
+{
+  BOOST_ASSERT(i < m_Nodes.size());
+  return m_Nodes[i].get();
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::extract_posteriors(const std::vector<Variable>& nodes, 
+						     T* mean, T* variance, const size_t index) const
+{
+  const std::vector<std::ptrdiff_t> i = detail::indices(nodes.size());
+  if (m_parallel)
+    PARALLEL_FOREACH(i.begin(), i.end(),
+		     boost::bind(&Builder<T>::extract_posterior, this, boost::cref(nodes), mean, variance, index, _1));
+  else
+    std::for_each(i.begin(), i.end(),
+		  boost::bind(&Builder<T>::extract_posterior, this, boost::cref(nodes), mean, variance, index, _1));
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::extract_posterior(const std::vector<Variable>& nodes, 
+						    T* mean, T* variance, 
+						    const size_t index, const std::ptrdiff_t i) const
+{
+  Variable node = nodes[i];
+  if (dynamic_cast<DirichletType*>(node) || dynamic_cast<GaussianPlateType*>(node)
+      || (variance != 0 && dynamic_cast<GammaType*>(node))) {
+    mean[i] = node->GetMean()[index];
+    if (variance != 0)
+      variance[i] = node->GetVariance()[index];
+    return;
+  }
+  const Moments<T>& m = node->GetMoments();
+  T mu = m[0], var = 0;
+  if (dynamic_cast<CatagoryType*>(node)) {
+    //(the moments are the probabilities of each catagory)
+    mu = 0;
+    for(size_t j=0;j<m.size();++j){
+      mu += j*m[j];
+    }
+    for(size_t j=0;j<m.size();++j){
+      var += m[j]*(j-mu)*(j-mu);
+    }
+  }
+  else if (dynamic_cast<GaussianType*>(node) || dynamic_cast<RectifiedGaussianType*>(node)) {
+    //(the moments are <x> and <x^2>)
+    var = m[1] - m[0]*m[0];
+  }
+  //(the observed and calculated nodes have no variance)
+  mean[i] = mu;
+  if (variance != 0)
+    variance[i] = var;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::extract_moments(const std::vector<Variable>& nodes, T* moments) const
+{
+  //Where the moments of each node go.
+  //(the size is looked up for every node but the calculations, which work their moments out and have two)
+  std::vector<size_t> offset(nodes.size());
+  size_t size = 0;
+  for(size_t i=0;i<nodes.size();++i){
+    offset[i] = size;
+    Variable node = nodes[i];
+    if (dynamic_cast<GaussianResultType*>(node))
+      size += 2;
+    else
+      size += node->GetMoments().size();
+  }
+  const std::vector<std::ptrdiff_t> i = detail::indices(nodes.size());
+  if (m_parallel)
+    PARALLEL_FOREACH(i.begin(), i.end(),
+		     boost::bind(&Builder<T>::extract_node_moments, this, boost::cref(nodes), boost::cref(offset), moments, _1));
+  else
+    std::for_each(i.begin(), i.end(),
+		  boost::bind(&Builder<T>::extract_node_moments, this, boost::cref(nodes), boost::cref(offset), moments, _1));
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::extract_node_moments(const std::vector<Variable>& nodes, 
+						       const std::vector<size_t>& offset, 
+						       T* moments, const std::ptrdiff_t i) const
+{
+  const Moments<T>& m = nodes[i]->GetMoments();
+  for(size_t j=0;j<m.size();++j){
+    moments[offset[i]+j] = m[j];
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::perturb()
+{
+  //The moments are drawn from the one random number generator, and from the parents' moments,
+  // so the nodes are initialised in order.
+  std::for_each(m_Nodes.begin(), m_Nodes.end(),
+		boost::bind(&VariableNode<T>::InitialiseMoments, _1)
+		);
+}
+
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::set_reducer(const boost::shared_ptr<Reducer>& reducer)
+{
+  m_reducer = reducer;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::begin_partition()
+{
+  end_concurrent();
+  if (m_partitioning) return;
+  m_partitioning = true;
+  m_partition_begin = m_Nodes.size();
+  m_partition_factor_begin = m_Factors.size();
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::end_partition()
+{
+  end_concurrent();
+  if (!m_partitioning) return;
+  m_partitioning = false;
+  for(size_t i=m_partition_begin;i<m_Nodes.size();++i){
+    m_partitioned_nodes.insert(m_Nodes[i].get());
+  }
+  for(size_t i=m_partition_factor_begin;i<m_Factors.size();++i){
+    m_partitioned_factors.insert(m_Factors[i].get());
+  }
+}
+
+namespace{
+  //Order the links of the child factors by parent.
+  template<class T>
+  struct ParentOrder
+  {
+    typedef typename ICR::EnsembleLearning::detail::ChildStaging<T>::Link Link;
+    bool operator()(const Link& a, const Link& b) const {return a.first < b.first;}
+  };
+
+  //Give a parent its children.
+  template<class T>
+  struct HandOverChildren
+  {
+    typedef typename ICR::EnsembleLearning::detail::ChildStaging<T>::Link Link;
+    HandOverChildren(const std::vector<Link>& links, 
+		     const std::vector<size_t>& begin,
+		     const std::vector<ICR::EnsembleLearning::FactorNode<T>*>& children)
+      : m_links(links), m_begin(begin), m_children(children) {}
+    void operator()(const std::ptrdiff_t g) const
+    {
+      m_links[m_begin[g]].first->AddChildFactors(&m_children[0] + m_begin[g], &m_children[0] + m_begin[g+1]);
+    }
+    const std::vector<Link>& m_links;
+    const std::vector<size_t>& m_begin;
+    const std::vector<ICR::EnsembleLearning::FactorNode<T>*>& m_children;
+  };
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::begin_concurrent()
+{
+  if (m_concurrent) return;
+  const size_t threads = omp_get_max_threads();
+  m_concurrent = true;
+  m_staging.assign(threads, Staging());
+  m_staged_links.assign(threads, typename detail::ChildStaging<T>::Links::value_type());
+  Random::Split(threads);
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::end_concurrent()
+{
+  if (!m_concurrent) return;
+  m_concurrent = false;
+  for(size_t t=0;t<m_staging.size();++t){
+    m_Nodes.insert(m_Nodes.end(), m_staging[t].nodes.begin(), m_staging[t].nodes.end());
+    m_Factors.insert(m_Factors.end(), m_staging[t].factors.begin(), m_staging[t].factors.end());
+    m_data_nodes += m_staging[t].data_nodes;
+  }
+  m_staging.clear();
+  link_staged_children();
+  m_staged_links.clear();
+  Random::Split(1);
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::link_staged_children()
+{
+  //The links in the order of the threads, sorted by parent 
+  // (stably, so that the children of every parent stay in the order in which they were built).
+  typedef typename detail::ChildStaging<T>::Link Link;
+  size_t size = 0;
+  for(size_t t=0;t<m_staged_links.size();++t){
+    size += m_staged_links[t].size();
+  }
+  if (size == 0)
+    return;
+  std::vector<Link> links;
+  links.reserve(size);
+  for(size_t t=0;t<m_staged_links.size();++t){
+    links.insert(links.end(), m_staged_links[t].begin(), m_staged_links[t].end());
+  }
+  std::stable_sort(links.begin(), links.end(), ParentOrder<T>());
+
+  //The children of each parent are together, 
+  // so every parent can be given all of its children at once (and by one thread).
+  std::vector<FactorNode<T>*> children(size);
+  std::vector<size_t> begin;
+  for(size_t j=0;j<size;++j){
+    children[j] = links[j].second;
+    if (j == 0 || links[j].first != links[j-1].first)
+      begin.push_back(j);
+  }
+  const std::vector<std::ptrdiff_t> parents = detail::indices(begin.size());
+  begin.push_back(size);
+  PARALLEL_FOREACH(parents.begin(), parents.end(), 
+		   HandOverChildren<T>(links, begin, children));
+}
+
+template<class T>
+inline
+typename ICR::EnsembleLearning::detail::ChildStaging<T>::Links*
+ICR::EnsembleLearning::Builder<T>::staged_links()
+{
+  //(the links are only staged by the thread that makes them, while it makes them)
+  return m_concurrent ? &m_staged_links : 0;
+}
+
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Builder<T>::add_node(const boost::shared_ptr<VariableNode<T> >& node)
+{
+  if (!m_concurrent) {
+    m_Nodes.push_back(node);
+    return;
+  }
+  BOOST_ASSERT(size_t(omp_get_thread_num()) < m_staging.size());
+  m_staging[omp_get_thread_num()].nodes.push_back(node);
+}
+
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Builder<T>::add_factor(const boost::shared_ptr<FactorNode<T> >& factor)
+{
+  if (!m_concurrent) {
+    m_Factors.push_back(factor);
+    return;
+  }
+  BOOST_ASSERT(size_t(omp_get_thread_num()) < m_staging.size());
+  m_staging[omp_get_thread_num()].factors.push_back(factor);
+}
+
+template<class T>
+inline
+void
+ICR::EnsembleLearning::Builder<T>::add_data_nodes(const size_t count)
+{
+  if (!m_concurrent) {
+    m_data_nodes += count;
+    return;
+  }
+  m_staging[omp_get_thread_num()].data_nodes += count;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::distribute()
+{
+  end_partition();
+
+  for(size_t i=0;i<m_Nodes.size();++i){
+    VariableNode<T>* node = m_Nodes[i].get();
+    if (m_partitioned_nodes.count(node)) {
+      m_local_nodes.push_back(node);
+    }
+    else {
+      m_global_nodes.push_back(node);
+      if (node->PartitionChildren(m_partitioned_factors) != 0)
+	m_reduced_nodes.push_back(node);
+    }
+  }
+
+  //The cost is normalised by the total number of data points.
+  std::vector<double> count(1, double(m_data_nodes));
+  m_reducer->sum(count);
+  m_data_nodes = size_t(count[0] + 0.5);
+  
+  //The global nodes were initialised at random on each process,
+  // start every process from the moments on the first one.
+  std::vector<double> moments;
+  for(size_t i=0;i<m_global_nodes.size();++i){
+    const Moments<T>& m = m_global_nodes[i]->GetMoments();
+    for(size_t j=0;j<m.size();++j){
+      moments.push_back(m_reducer->rank() == 0 ? double(m[j]) : 0.0);
+    }
+  }
+  m_reducer->sum(moments);
+  for(size_t i=0, k=0;i<m_global_nodes.size();++i){
+    std::vector<T> m(m_global_nodes[i]->GetMoments().size());
+    for(size_t j=0;j<m.size();++j, ++k){
+      m[j] = moments[k];
+    }
+    m_global_nodes[i]->SetMoments(Moments<T>(m));
+  }
+  
+  m_distributed = true;
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::iterate_distributed()
+{
+  //Update the nodes in this processes partition.
+  //Each node reads the moments that the nodes before it have just written,
+  // so (as in iterate) they are updated in order on the calling thread.
+  Coster LocalCost;
+  std::for_each(m_local_nodes.begin(), m_local_nodes.end(),
+		boost::bind(&VariableNode<T>::Iterate, _1, boost::ref(LocalCost))
+		);
+
+  //Sum the messages to the global nodes (and the local cost) over all processes,
+  // all in one go.
+  std::vector<double> buffer;
+  for(size_t i=0;i<m_reduced_nodes.size();++i){
+    const NaturalParameters<T> NP = m_reduced_nodes[i]->GetPartitionedNP();
+    for(size_t j=0;j<NP.size();++j){
+      buffer.push_back(NP[j]);
+    }
+  }
+  buffer.push_back(LocalCost);
+  m_reducer->sum(buffer);
+  
+  for(size_t i=0, k=0;i<m_reduced_nodes.size();++i){
+    NaturalParameters<T> NP(m_reduced_nodes[i]->GetMoments().size());
+    for(size_t j=0;j<NP.size();++j, ++k){
+      NP[j] = buffer[k];
+    }
+    m_reduced_nodes[i]->SetReducedNP(NP);
+  }
+
+  //Every process now updates the global nodes identically
+  // (so they are updated in order, rather than in parallel).
+  Coster GlobalCost;
+  std::for_each(m_global_nodes.begin(), m_global_nodes.end(),
+		boost::bind(&VariableNode<T>::Iterate, _1, boost::ref(GlobalCost))
+		);
+
+  return buffer.back() + GlobalCost;
+}
+
+template<class T>
+void 
+ICR::EnsembleLearning::Builder<T>::set_acceleration(const Acceleration::Value method)
+{
+  m_acceleration = method;
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::iterations_saved() const
+{
+  return m_iterations_saved;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::stack_natural_parameters(std::vector<double>& stack)
+{
+  stack.clear();
+  for(size_t i=0;i<m_Nodes.size();++i){
+    m_Nodes[i]->GetNaturalParameters(stack);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::set_natural_parameters(const std::vector<double>& stack)
+{
+  std::vector<double>::const_iterator it = stack.begin();
+  for(size_t i=0;i<m_Nodes.size();++i){
+    //a node that refuses keeps its moments from the last sweep
+    m_Nodes[i]->SetNaturalParameters(it);
+  }
+  BOOST_ASSERT(it == stack.end());
+  refresh_synchronous();
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::refresh_synchronous()
+{
+  //The deterministic nodes hold the moments of their parents in a synchronous sweep
+  for(size_t i=0;i<m_synchronous_nodes;++i){
+    m_Nodes[i]->SetSynchronous(true);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::reset_acceleration()
+{
+  m_extrapolated = false;
+  m_relaxation   = 1;
+  m_squarem_step = 0;
+  m_theta0.clear();
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::set_mixture_truncation(const size_t keep)
+{
+  m_mixture_truncation = keep;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::set_pruning(const double weight, 
+					       const double precision, 
+					       const bool verify)
+{
+  m_prune_weight    = weight;
+  m_prune_precision = precision;
+  m_verify_pruning  = verify;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::prune_with(GammaNode Precision, const std::vector<Variable>& nodes)
+{
+  PrecisionRule rule;
+  rule.precision = Precision;
+  rule.nodes     = nodes;
+  rule.pruned    = false;
+  m_precision_rules.push_back(rule);
+}
+
+template<class T>
+size_t
+ICR::EnsembleLearning::Builder<T>::number_of_pruned_nodes() const
+{
+  return m_pruned.size();
+}
+
+template<class T>
+boost::shared_ptr<std::vector<size_t> >
+ICR::EnsembleLearning::Builder<T>::mixture_components(WeightsNode Weights, 
+						      const std::vector<Variable>& vMean, 
+						      const std::vector<Variable>& vPrecision)
+{
+  //Every mixture with the same weights shares the list of active components.
+  boost::shared_ptr<std::vector<size_t> > active;
+#pragma omp critical(EnsembleLearning_mixtures)
+  {
+    MixtureComponents& components = m_mixtures[Weights];
+    if (!components.active) {
+      components.active.reset(new std::vector<size_t>(vMean.size()));
+      for(size_t k=0;k<vMean.size();++k){
+	(*components.active)[k] = k;
+      }
+      components.nodes.resize(vMean.size());
+    }
+    BOOST_ASSERT(components.nodes.size() == vMean.size());
+    for(size_t k=0;k<vMean.size();++k){
+      components.nodes[k].insert(vMean[k]);
+      components.nodes[k].insert(vPrecision[k]);
+    }
+    active = components.active;
+  }
+  return active;
+}
+
+template<class T>
+boost::shared_ptr<ICR::EnsembleLearning::detail::Shortlist<T> >
+ICR::EnsembleLearning::Builder<T>::mixture_shortlist(WeightsNode Weights, const size_t keep)
+{
+  //Every truncated mixture with the same weights shares the shortlist of components.
+  boost::shared_ptr<detail::Shortlist<T> > shortlist;
+  if (keep == 0)
+    return shortlist;
+#pragma omp critical(EnsembleLearning_mixtures)
+  {
+    MixtureComponents& components = m_mixtures[Weights];
+    if (!components.shortlist)
+      components.shortlist.reset(new detail::Shortlist<T>());
+    components.shortlist->Keep(keep);
+    shortlist = components.shortlist;
+  }
+  return shortlist;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::refresh_shortlists()
+{
+  typename std::map<WeightsNode, MixtureComponents>::iterator it;
+  for(it = m_mixtures.begin(); it != m_mixtures.end(); ++it){
+    if (it->second.shortlist)
+      it->second.shortlist->Refresh(it->first->GetMoments(), *it->second.active);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::prune()
+{
+  if (m_distributed)
+    return;
+
+  //Remove the collapsed components from the mixtures (always leaving one).
+  if (m_prune_weight > 0) {
+    typename std::map<WeightsNode, MixtureComponents>::iterator it;
+    for(it = m_mixtures.begin(); it != m_mixtures.end(); ++it){
+      const Moments<T>& LogWeights = it->first->GetMoments();
+      std::vector<size_t>& active = *it->second.active;
+      for(size_t a=0;a<active.size() && active.size()>1;){
+	if (std::exp(LogWeights[active[a]]) < m_prune_weight)
+	  active.erase(active.begin()+a);
+	else
+	  ++a;
+      }
+    }
+  }
+
+  //The nodes still needed by an active component are never pruned.
+  std::set<VariableNode<T>*> needed;
+  std::set<VariableNode<T>*> pruned;
+  typename std::map<WeightsNode, MixtureComponents>::const_iterator it;
+  for(it = m_mixtures.begin(); it != m_mixtures.end(); ++it){
+    const std::vector<size_t>& active = *it->second.active;
+    for(size_t a=0;a<active.size();++a){
+      needed.insert(it->second.nodes[active[a]].begin(), it->second.nodes[active[a]].end());
+    }
+    for(size_t k=0;k<it->second.nodes.size();++k){
+      pruned.insert(it->second.nodes[k].begin(), it->second.nodes[k].end());
+    }
+  }
+
+  if (m_prune_precision > 0) {
+    for(size_t r=0;r<m_precision_rules.size();++r){
+      PrecisionRule& rule = m_precision_rules[r];
+      if (!rule.pruned && rule.precision->GetMoments()[0] > m_prune_precision) {
+	rule.pruned = true;
+	pruned.insert(rule.nodes.begin(), rule.nodes.end());
+	pruned.insert(rule.precision);
+      }
+    }
+  }
+
+  std::set<VariableNode<T>*> freezing;
+  std::set_difference(pruned.begin(), pruned.end(), needed.begin(), needed.end(),
+		      std::inserter(freezing, freezing.begin()));
+  freeze(freezing);
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::freeze(const std::set<VariableNode<T>*>& nodes)
+{
+  bool changed = false;
+  for(size_t i=0;i<m_Nodes.size();++i){
+    VariableNode<T>* node = m_Nodes[i].get();
+    if (nodes.count(node) == 0 || m_pruned.count(node) != 0)
+      continue;
+    //A last update, the cost of which is held from now on.
+    Coster Cost = 0;
+    node->Iterate(Cost);
+    node->SwapMoments();
+    m_pruned_cost += Cost;
+    m_pruned.insert(node);
+    changed = true;
+  }
+  if (!changed)
+    return;
+
+  collect_unpruned();
+  refresh_synchronous();
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::collect_unpruned()
+{
+  //(in the order of the sweep)
+  const std::vector<boost::shared_ptr<VariableNode<T> > >& Nodes = m_sweep.empty() ? m_Nodes : m_sweep;
+  m_unpruned_nodes.clear();
+  m_compiled_valid = false;
+  for(size_t i=0;i<Nodes.size();++i){
+    if (m_pruned.count(Nodes[i].get()) == 0)
+      m_unpruned_nodes.push_back(Nodes[i]);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::unprune()
+{
+  typename std::map<WeightsNode, MixtureComponents>::iterator it;
+  for(it = m_mixtures.begin(); it != m_mixtures.end(); ++it){
+    std::vector<size_t>& active = *it->second.active;
+    active.resize(it->second.nodes.size());
+    for(size_t k=0;k<active.size();++k){
+      active[k] = k;
+    }
+  }
+  for(size_t r=0;r<m_precision_rules.size();++r){
+    m_precision_rules[r].pruned = false;
+  }
+  m_pruned.clear();
+  m_unpruned_nodes.clear();
+  m_compiled_valid = false;
+  m_pruned_cost = 0;
+}
+
+template<class T>
+const std::vector<boost::shared_ptr<ICR::EnsembleLearning::VariableNode<T> > >&
+ICR::EnsembleLearning::Builder<T>::sweep_nodes() const
+{
+  if (!m_pruned.empty())
+    return m_unpruned_nodes;
+  return m_sweep.empty() ? m_Nodes : m_sweep;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::compile_sweep()
+{
+  if (m_reorder && m_sweep.size() != m_Nodes.size())
+    reorder();
+  //Nodes may have been added since the last sweep (in the order they were built).
+  if (m_synchronous) {
+    for(; m_synchronous_nodes<m_Nodes.size(); ++m_synchronous_nodes){
+      m_Nodes[m_synchronous_nodes]->SetSynchronous(true);
+    }
+  }
+  if (m_compiled_valid && m_compiled_nodes == m_Nodes.size())
+    return;
+  //The type of every node is looked up once, rather than on every update.
+  const std::vector<boost::shared_ptr<VariableNode<T> > >& Nodes = sweep_nodes();
+  m_compiled.clear();
+  m_kinds.clear();
+  for(size_t i=0;i<Nodes.size();++i){
+    VariableNode<T>* node = Nodes[i].get();
+    typename NodeKind::Value kind = NodeKind::OTHER;
+    if (dynamic_cast<GaussianResultType*>(node))
+      continue; //the moments are worked out when they are read, there is nothing to update
+    else if (dynamic_cast<GaussianType*>(node))
+      kind = NodeKind::GAUSSIAN;
+    else if (dynamic_cast<RectifiedGaussianType*>(node))
+      kind = NodeKind::RECTIFIED_GAUSSIAN;
+    else if (dynamic_cast<GammaType*>(node))
+      kind = NodeKind::GAMMA;
+    else if (dynamic_cast<DirichletType*>(node))
+      kind = NodeKind::DIRICHLET;
+    else if (dynamic_cast<CatagoryType*>(node))
+      kind = NodeKind::DISCRETE;
+    else if (dynamic_cast<GaussianDataType*>(node))
+      kind = NodeKind::GAUSSIAN_DATA;
+    else if (dynamic_cast<GammaDataType*>(node))
+      kind = NodeKind::GAMMA_DATA;
+    else if (dynamic_cast<DirichletConstType*>(node))
+      kind = NodeKind::DIRICHLET_CONST;
+    m_compiled.push_back(node);
+    m_kinds.push_back(kind);
+  }
+  m_compiled_nodes = m_Nodes.size();
+  m_compiled_valid = true;
+}
+
+namespace{
+  //What the sweep does to each node.
+  //The templates are called with the type of the node, and the qualified calls are not virtual.
+  template<class T>
+  struct IterateNode
+  {
+    IterateNode(ICR::EnsembleLearning::Coster& cost) : m_cost(cost) {}
+    template<class Node>
+    void operator()(Node* node) const {node->Node::Iterate(m_cost);}
+    void operator()(ICR::EnsembleLearning::VariableNode<T>* node) const {node->Iterate(m_cost);}
+    ICR::EnsembleLearning::Coster& m_cost;
+  };
+
+  template<class T>
+  struct UpdateNode
+  {
+    UpdateNode(double& change) : m_change(change) {}
+    template<class Node>
+    void operator()(Node* node) const {m_change = std::max<double>(m_change, node->Node::Update());}
+    void operator()(ICR::EnsembleLearning::VariableNode<T>* node) const {m_change = std::max<double>(m_change, node->Update());}
+    double& m_change;
+  };
+
+  template<class T>
+  struct EvaluateNode
+  {
+    EvaluateNode(ICR::EnsembleLearning::Coster& cost) : m_cost(cost) {}
+    template<class Node>
+    void operator()(Node* node) const {node->Node::EvaluateCost(m_cost);}
+    void operator()(ICR::EnsembleLearning::VariableNode<T>* node) const {node->EvaluateCost(m_cost);}
+    ICR::EnsembleLearning::Coster& m_cost;
+  };
+}
+
+template<class T>
+template<class Operation>
+inline
+void
+ICR::EnsembleLearning::Builder<T>::sweep_node(const std::ptrdiff_t i, const Operation& op)
+{
+  VariableNode<T>* node = m_compiled[i];
+  switch (m_kinds[i]) {
+  case NodeKind::GAUSSIAN:
+    op(static_cast<GaussianType*>(node));
+    break;
+  case NodeKind::RECTIFIED_GAUSSIAN:
+    op(static_cast<RectifiedGaussianType*>(node));
+    break;
+  case NodeKind::GAMMA:
+    op(static_cast<GammaType*>(node));
+    break;
+  case NodeKind::DIRICHLET:
+    op(static_cast<DirichletType*>(node));
+    break;
+  case NodeKind::DISCRETE:
+    op(static_cast<CatagoryType*>(node));
+    break;
+  case NodeKind::GAUSSIAN_DATA:
+    op(static_cast<GaussianDataType*>(node));
+    break;
+  case NodeKind::GAMMA_DATA:
+    op(static_cast<GammaDataType*>(node));
+    break;
+  case NodeKind::DIRICHLET_CONST:
+    op(static_cast<DirichletConstType*>(node));
+    break;
+  default:
+    op(node);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::sweep_node_synchronous(const std::ptrdiff_t i)
+{
+  m_node_costs[i] = 0;
+  sweep_node(i, IterateNode<T>(m_node_costs[i]));
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::update_node_synchronous(const std::ptrdiff_t i)
+{
+  m_node_changes[i] = 0;
+  sweep_node(i, UpdateNode<T>(m_node_changes[i]));
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::evaluate_node_synchronous(const std::ptrdiff_t i)
+{
+  m_node_costs[i] = 0;
+  sweep_node(i, EvaluateNode<T>(m_node_costs[i]));
+}
+
+namespace{
+  //Order the nodes with fewer factors first (and then in the order they were built).
+  struct fewer_factors
+  {
+    fewer_factors(const std::vector<size_t>& begin) : m_begin(begin) {}
+    bool
+    operator()(const size_t a, const size_t b) const
+    {
+      const size_t da = m_begin[a+1] - m_begin[a], db = m_begin[b+1] - m_begin[b];
+      return da < db || (da == db && a < b);
+    }
+    const std::vector<size_t>& m_begin;
+  };
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::reorder()
+{
+  const size_t nodes = m_Nodes.size(), factors = m_Factors.size();
+  std::map<VariableNode<T>*, size_t> index;
+  for(size_t i=0;i<nodes;++i){
+    index[m_Nodes[i].get()] = i;
+  }
+
+  //The nodes of every factor, and the factors of every node (both in compressed rows).
+  std::vector<size_t> factor_begin(1, 0), factor_nodes;
+  std::vector<VariableNode<T>*> adjacent;
+  for(size_t f=0;f<factors;++f){
+    adjacent.clear();
+    m_Factors[f]->GetAdjacentNodes(adjacent);
+    for(size_t j=0;j<adjacent.size();++j){
+      factor_nodes.push_back(index[adjacent[j]]);
+    }
+    factor_begin.push_back(factor_nodes.size());
+  }
+  std::vector<size_t> node_begin(nodes+1, 0);
+  for(size_t j=0;j<factor_nodes.size();++j){
+    ++node_begin[factor_nodes[j]+1];
+  }
+  for(size_t i=0;i<nodes;++i){
+    node_begin[i+1] += node_begin[i];
+  }
+  std::vector<size_t> node_factors(factor_nodes.size()), next(node_begin.begin(), node_begin.end()-1);
+  for(size_t f=0;f<factors;++f){
+    for(size_t j=factor_begin[f];j<factor_begin[f+1];++j){
+      node_factors[next[factor_nodes[j]]++] = f;
+    }
+  }
+
+  //The nodes in more factors than this are placed but not followed.
+  const size_t hub = std::max<size_t>(16, size_t(std::sqrt(double(factors))));
+  const fewer_factors order(node_begin);
+
+  //Cuthill-McKee: a breadth first search from a node with the fewest factors,
+  //visiting the neighbours of each node with the fewest factors first.
+  std::vector<size_t> start(nodes);
+  for(size_t i=0;i<nodes;++i){
+    start[i] = i;
+  }
+  std::sort(start.begin(), start.end(), order);
+  std::vector<bool> placed(nodes, false), followed(factors, false);
+  std::vector<size_t> sequence;
+  sequence.reserve(nodes);
+  std::vector<size_t> neighbours;
+  for(size_t s=0;s<nodes;++s){
+    if (placed[start[s]])
+      continue;
+    placed[start[s]] = true;
+    sequence.push_back(start[s]);
+    for(size_t q=sequence.size()-1;q<sequence.size();++q){
+      const size_t node = sequence[q];
+      if (node_begin[node+1] - node_begin[node] > hub)
+	continue;
+      neighbours.clear();
+      for(size_t j=node_begin[node];j<node_begin[node+1];++j){
+	const size_t f = node_factors[j];
+	if (followed[f])
+	  continue;
+	followed[f] = true;
+	for(size_t k=factor_begin[f];k<factor_begin[f+1];++k){
+	  if (!placed[factor_nodes[k]]) {
+	    placed[factor_nodes[k]] = true;
+	    neighbours.push_back(factor_nodes[k]);
+	  }
+	}
+      }
+      std::sort(neighbours.begin(), neighbours.end(), order);
+      sequence.insert(sequence.end(), neighbours.begin(), neighbours.end());
+    }
+  }
+
+  //(reversed)
+  m_sweep.clear();
+  m_sweep.reserve(nodes);
+  for(size_t i=nodes;i>0;--i){
+    m_sweep.push_back(m_Nodes[sequence[i-1]]);
+  }
+  m_compiled_valid = false;
+  if (!m_pruned.empty())
+    collect_unpruned();
+}
+
+template<class T>
+bool
+ICR::EnsembleLearning::Builder<T>::reject_extrapolation(const double Cost)
+{
+  if (!m_extrapolated)
+    return false;
+  m_extrapolated = false;
+  //(the comparison is false for a nan cost as well)
+  if (Cost >= m_accepted_cost - 1e-12*std::fabs(m_accepted_cost))
+    return false;
+  
+  //Go back to the plain sweep and start again
+  set_natural_parameters(m_theta_plain);
+  reset_acceleration();
+  m_iterations_saved -= 1;
+  return true;
+}
+
+namespace{
+  double
+  distance(const std::vector<double>& a, const std::vector<double>& b)
+  {
+    double d = 0;
+    for(size_t i=0;i<a.size();++i){
+      d += (a[i]-b[i])*(a[i]-b[i]);
+    }
+    return std::sqrt(d);
+  }
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::extrapolate(const double Cost)
+{
+  //The growth of the over-relaxation factor, and the largest it may become.
+  const double growth = 1.5, max_relaxation = 16;
+
+  m_accepted_cost = Cost;
+  std::vector<double> theta;
+  stack_natural_parameters(theta);
+  if (m_theta0.size() != theta.size()) {
+    //The first sweep, or the model has changed
+    m_theta0.swap(theta);
+    m_relaxation   = 1;
+    m_squarem_step = 0;
+    return;
+  }
+
+  std::vector<double> extrapolated(theta.size());
+  double step = 0;
+  if (m_acceleration == Acceleration::OVER_RELAXATION) {
+    //theta0 is where the sweep started
+    m_relaxation = std::min(m_relaxation*growth, max_relaxation);
+    for(size_t i=0;i<theta.size();++i){
+      extrapolated[i] = m_theta0[i] + m_relaxation*(theta[i] - m_theta0[i]);
+    }
+    step = m_relaxation - 1;
+  }
+  else {
+    //SQUAREM takes two sweeps, from theta0 to theta1 and then to theta.
+    if (m_squarem_step == 0) {
+      m_theta1.swap(theta);
+      m_squarem_step = 1;
+      return;
+    }
+    const double r = distance(m_theta1, m_theta0);
+    double v = 0;
+    for(size_t i=0;i<theta.size();++i){
+      const double vi = theta[i] - 2*m_theta1[i] + m_theta0[i];
+      v += vi*vi;
+    }
+    v = std::sqrt(v);
+    const double alpha = (v > 0) ? std::min(-r/v, -1.0) : -1.0;
+    for(size_t i=0;i<theta.size();++i){
+      const double ri = m_theta1[i] - m_theta0[i];
+      const double vi = theta[i] - 2*m_theta1[i] + m_theta0[i];
+      extrapolated[i] = m_theta0[i] - 2*alpha*ri + alpha*alpha*vi;
+    }
+    step = (r > 0) ? distance(extrapolated, m_theta0)/r - 2 : 0;
+    m_squarem_step = 0;
+  }
+
+  m_theta_plain.swap(theta);
+  set_natural_parameters(extrapolated);
+  m_extrapolated = true;
+  m_iterations_saved += step;
+  //The next sweep starts from here (less any node that refused the extrapolation).
+  stack_natural_parameters(m_theta0);
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::clone_restart(Builder<T>& restart,
+						 const std::map<VariableNode<T>*, size_t>& index) const
+{
+  //(the graph has been loaded into the restart already, so its nodes are in the same order)
+  restart.set_quiet();
+  restart.set_synchronous(m_synchronous);
+  restart.set_reordering(m_reorder);
+  restart.set_acceleration(m_acceleration);
+  restart.set_bound_interval(m_bound_interval, m_bound_change);
+  restart.set_mixture_truncation(m_mixture_truncation);
+  restart.set_pruning(m_prune_weight, m_prune_precision, m_verify_pruning);
+  for(size_t r=0;r<m_precision_rules.size();++r){
+    const PrecisionRule& rule = m_precision_rules[r];
+    std::vector<Variable> nodes(rule.nodes.size());
+    for(size_t j=0;j<nodes.size();++j){
+      nodes[j] = restart.m_Nodes[index.find(rule.nodes[j])->second].get();
+    }
+    restart.prune_with(static_cast<GammaNode>(restart.m_Nodes[index.find(rule.precision)->second].get()), 
+		       nodes);
+  }
+  //The restart starts from the full model, drawn in build order (so the parents are drawn first).
+  std::for_each(restart.m_Nodes.begin(), restart.m_Nodes.end(),
+		boost::bind(&VariableNode<T>::InitialiseMoments, _1));
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::adopt_restart(const Builder<T>& restart,
+						 const std::map<VariableNode<T>*, size_t>& index)
+{
+  for(size_t i=0;i<m_Nodes.size();++i){
+    m_Nodes[i]->SetMoments(restart.m_Nodes[i]->GetMoments());
+  }
+  m_cost_history = restart.m_cost_history;
+  m_PrevCost     = restart.m_PrevCost;
+
+  //What the restart has pruned, found by the index of each node.
+  typename std::map<WeightsNode, MixtureComponents>::iterator it;
+  for(it = m_mixtures.begin(); it != m_mixtures.end(); ++it){
+    const WeightsNode Weights = static_cast<WeightsNode>(restart.m_Nodes[index.find(it->first)->second].get());
+    *it->second.active = *restart.m_mixtures.find(Weights)->second.active;
+  }
+  for(size_t r=0;r<m_precision_rules.size();++r){
+    m_precision_rules[r].pruned = restart.m_precision_rules[r].pruned;
+  }
+  m_pruned.clear();
+  for(size_t i=0;i<restart.m_Nodes.size();++i){
+    if (restart.m_pruned.count(restart.m_Nodes[i].get()) != 0)
+      m_pruned.insert(m_Nodes[i].get());
+  }
+  m_pruned_cost = restart.m_pruned_cost;
+  collect_unpruned();
+}
+
+template<class T>
+bool
+ICR::EnsembleLearning::Builder<T>::run_restarts(const size_t restarts,
+						const double epsilon, 
+						const size_t max_iterations, 
+						const size_t skip,
+						const size_t round,
+						const double abandon)
+{
+  BOOST_ASSERT(restarts > 0 && round > 0);
+  end_concurrent();
+
+  //Restart zero is this model, the others are copies of its graph.
+  std::vector<boost::shared_ptr<Builder<T> > > copies;
+  std::vector<Builder<T>*> models(1, this);
+  std::map<VariableNode<T>*, size_t> index;
+  if (restarts > 1) {
+    for(size_t i=0;i<m_Nodes.size();++i){
+      index[m_Nodes[i].get()] = i;
+    }
+    char filename[] = "/tmp/EnsembleLearning_restartXXXXXX";
+    const int file = mkstemp(filename);
+    if (file == -1) {
+      std::cout<<"Unable to open a file to copy the graph to"<<std::endl;
+      throw("EXITING");
+    }
+    close(file);
+    save_graph(filename);
+    try {
+      for(size_t r=1;r<restarts;++r){
+	boost::shared_ptr<Builder<T> > copy(new Builder<T>());
+	copy->load_graph(filename);
+	clone_restart(*copy, index);
+	copies.push_back(copy);
+	models.push_back(copy.get());
+      }
+    }
+    catch(...) {
+      std::remove(filename);
+      throw;
+    }
+    std::remove(filename);
+  }
+
+  std::vector<size_t> iterations(restarts, 0);
+  std::vector<double> cost(restarts, -std::numeric_limits<double>::max());
+  std::vector<char> converged(restarts, 0);
+  std::vector<char> running(restarts, 1);
+  const size_t first = m_iterations;
+  std::vector<size_t> start(restarts);
+  for(size_t r=0;r<restarts;++r){
+    start[r] = models[r]->m_iterations;
+  }
+
+  std::vector<Builder<T>*> batch;
+  std::vector<size_t> which;
+  bool warmed = false;
+  for(;;) {
+    batch.clear();
+    which.clear();
+    size_t furthest = 0;
+    for(size_t r=0;r<restarts;++r){
+      if (!running[r]) 
+	continue;
+      batch.push_back(models[r]);
+      which.push_back(r);
+      furthest = std::max(furthest, iterations[r]);
+    }
+    if (batch.empty())
+      break;
+
+    //Every restart that is still running is advanced by a round, the restarts shared out amongst the threads
+    // (a restart on its own keeps its sweeps split between them, see set_synchronous()).
+    //(run may stop early, and counts the sweeps it skips or warms up with)
+    const size_t sweeps = std::min(round, max_iterations - furthest);
+    const std::vector<bool> done = batch.size() == 1
+      ? std::vector<bool>(1, batch[0]->run(epsilon, sweeps, warmed ? 0 : skip))
+      : run_batch(batch.begin(), batch.end(), epsilon, sweeps, warmed ? 0 : skip);
+    warmed = true;
+    for(size_t b=0;b<batch.size();++b){
+      const size_t r = which[b];
+      converged[r]  = done[b];
+      iterations[r] = models[r]->m_iterations - start[r];
+      if (!models[r]->m_cost_history.empty())
+	cost[r] = models[r]->m_cost_history.back();
+      if (converged[r] || iterations[r] >= max_iterations)
+	running[r] = 0;
+    }
+
+    //Abandon the restarts that have fallen behind the leader
+    const double leader = *std::max_element(cost.begin(), cost.end());
+    for(size_t r=0;r<restarts;++r){
+      if (running[r] && 100.0*(leader - cost[r])/std::fabs(leader) > abandon) 
+	running[r] = 0;
+    }
+  }
+
+  //The sweeps of every restart are counted.
+  m_iterations = first;
+  for(size_t r=0;r<restarts;++r){
+    m_iterations += iterations[r];
+  }
+
+  const size_t best = std::max_element(cost.begin(), cost.end()) - cost.begin();
+  if (best != 0) {
+    adopt_restart(*models[best], index);
+    reset_acceleration();
+    refresh_synchronous();
+  }
+  return converged[best];
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::iterate_synchronous()
+{
+  compile_sweep();
+  m_node_costs.resize(m_compiled.size());
+
+  //Every node reads the current moments and writes the next,
+  //so the order does not matter.
+  const std::vector<std::ptrdiff_t> index = detail::indices(m_compiled.size());
+  if (m_parallel)
+    PARALLEL_FOREACH(index.begin(), index.end(),
+		     boost::bind(&Builder<T>::sweep_node_synchronous, this, _1));
+  else
+    std::for_each(index.begin(), index.end(),
+		  boost::bind(&Builder<T>::sweep_node_synchronous, this, _1));
+
+  double Cost = m_pruned_cost;
+  for(size_t i=0;i<m_node_costs.size();++i){
+    Cost += m_node_costs[i];
+  }
+  swap_moments();
+  return Cost;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::swap_moments()
+{
+  //The barrier: make the next moments current 
+  //(in build order whatever the order of the sweep, for the deterministic nodes).
+  for(size_t i=0;i<m_Nodes.size();++i){
+    if (m_pruned.empty() || m_pruned.count(m_Nodes[i].get()) == 0)
+      m_Nodes[i]->SwapMoments();
+  }
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::update()
+{
+  ++m_iterations;
+  refresh_shortlists();
+  compile_sweep();
+  double change = 0;
+  if (m_synchronous) {
+    m_node_changes.resize(m_compiled.size());
+    const std::vector<std::ptrdiff_t> index = detail::indices(m_compiled.size());
+    if (m_parallel)
+      PARALLEL_FOREACH(index.begin(), index.end(),
+		       boost::bind(&Builder<T>::update_node_synchronous, this, _1));
+    else
+      std::for_each(index.begin(), index.end(),
+		    boost::bind(&Builder<T>::update_node_synchronous, this, _1));
+    if (!m_node_changes.empty())
+      change = *std::max_element(m_node_changes.begin(), m_node_changes.end());
+    swap_moments();
+  }
+  else {
+    //(in order, see iterate())
+    for(size_t i=0;i<m_compiled.size();++i){
+      sweep_node(i, UpdateNode<T>(change));
+    }
+  }
+  return change;
+}
+
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::warm_up()
+{
+  //The depth of every node: one more than the deepest of its parents (the child of a factor is last).
+  std::map<VariableNode<T>*, size_t> depth;
+  std::vector<VariableNode<T>*> adjacent;
+  for(size_t f=0;f<m_Factors.size();++f){
+    adjacent.clear();
+    m_Factors[f]->GetAdjacentNodes(adjacent);
+    if (adjacent.empty())
+      continue;
+    size_t d = 0;
+    for(size_t j=0;j+1<adjacent.size();++j){
+      d = std::max(d, depth[adjacent[j]] + 1);
+    }
+    size_t& child = depth[adjacent.back()];
+    child = std::max(child, d);
+  }
+
+  //Each node must see the update of the last, so the passes are never synchronous.
+  const bool synchronous = m_synchronous;
+  if (synchronous)
+    set_synchronous(false);
+  compile_sweep();
+  std::vector<std::pair<size_t, size_t> > order(m_compiled.size());
+  for(size_t i=0;i<m_compiled.size();++i){
+    order[i] = std::make_pair(depth[m_compiled[i]], i);
+  }
+  std::sort(order.begin(), order.end());
+
+  double change = 0;
+  //roots to leaves
+  ++m_iterations;
+  for(size_t k=0;k<order.size();++k){
+    sweep_node(order[k].second, UpdateNode<T>(change));
+  }
+  //and back
+  ++m_iterations;
+  for(size_t k=order.size();k>0;--k){
+    sweep_node(order[k-1].second, UpdateNode<T>(change));
+  }
+  //(the nodes are made synchronous again before the next sweep)
+  m_synchronous = synchronous;
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::evaluate_bound()
+{
+  compile_sweep();
+  if (m_synchronous) {
+    //Nothing is written, the costs of the nodes are independent.
+    m_node_costs.resize(m_compiled.size());
+    const std::vector<std::ptrdiff_t> index = detail::indices(m_compiled.size());
+    if (m_parallel)
+      PARALLEL_FOREACH(index.begin(), index.end(),
+		       boost::bind(&Builder<T>::evaluate_node_synchronous, this, _1));
+    else
+      std::for_each(index.begin(), index.end(),
+		    boost::bind(&Builder<T>::evaluate_node_synchronous, this, _1));
+    double Cost = m_pruned_cost;
+    for(size_t i=0;i<m_node_costs.size();++i){
+      Cost += m_node_costs[i];
+    }
+    return Cost;
+  }
+  //The deterministic nodes work out their moments when they are read, which is not thread safe.
+  Coster Cost = 0;
+  for(size_t i=0;i<m_compiled.size();++i){
+    sweep_node(i, EvaluateNode<T>(Cost));
+  }
+  return Cost + m_pruned_cost;
+}
+
+template<class T>
+double
+ICR::EnsembleLearning::Builder<T>::iterate()
+{
+  // Initialise();
+  if (m_Factors.size() == 0)
+    {
+      std::cout<<"No graph has been built, cannot iterate"<<std::endl;
+      return -1.0/0.0;
+    }
+	
+  ++m_iterations;
+  refresh_shortlists();
+  if (m_distributed)
+    return iterate_distributed();
+  if (m_synchronous)
+    return iterate_synchronous();
+
+  Coster Cost;
+  for(size_t i=0;i<1;++i){
+    {
+      // std::cout<<"ITERATE"<<std::endl;
+      Cost = 0;
+
+      // PARALLEL_FOREACH(m_Factors.begin(), m_Factors.end(),
+      // 		     boost::bind(&FactorNode<T>::Iterate, _1 )
+      // 		     );
+	    
+      // std::cout<<"ITERATE Nodes"<<std::endl;
+      //Each node reads the moments that the nodes before it have just written
+      //(the first and second moments of a parent in separate calls),
+      //so this sweep is always in order on the calling thread.
+      //Synchronous sweeps are split between threads.
+      compile_sweep();
+      for(size_t i=0;i<m_compiled.size();++i){
+	sweep_node(i, IterateNode<T>(Cost));
+      }
+
+    }
+  }
+  return Cost + m_pruned_cost;
+
+}
+
+template<class T>
+bool
+ICR::EnsembleLearning::Builder<T>::run(const double& epsilon, const size_t& max_iterations , size_t skip)
+{
+  end_concurrent();
+  if (m_reducer && !m_distributed)
+    distribute();
+
+  //The bound is only needed every few sweeps (see set_bound_interval()).
+  const bool lazy = m_bound_interval > 1 && m_acceleration == Acceleration::NONE 
+    && !m_distributed && m_Factors.size() != 0;
+
+  if (skip == auto_skip) {
+    //(a restarted or reloaded model has been warmed up already)
+    if (m_cost_history.empty() && !m_distributed && m_Factors.size() != 0)
+      warm_up();
+    skip = m_distributed ? 1 : 0;
+  }
+
+  //std::cout<<"initialising"<<std::endl;
+  for(size_t i=0;i<skip;++i){
+    if (lazy)
+      update();
+    else
+      iterate();
+  }
+	
+  bool converged = false;
+  bool pruning = m_prune_weight > 0 || m_prune_precision > 0;
+  size_t unchecked = 0;
+  for(size_t i=0;i<max_iterations && !converged;++i){
+    double Cost;
+    if (lazy) {
+      const double change = update();
+      if (++unchecked < m_bound_interval && change > m_bound_change)
+	continue;
+      unchecked = 0;
+      Cost = evaluate_bound()/m_data_nodes;
+    }
+    else
+      Cost = iterate()/m_data_nodes;
+    if (m_acceleration != Acceleration::NONE && reject_extrapolation(Cost))
+      continue;
+	  
+    converged = HasConverged(Cost, epsilon);
+    if (m_acceleration != Acceleration::NONE && !converged)
+      extrapolate(Cost);
+    if (pruning && !converged)
+      prune();
+    if (m_verify_pruning && converged && !m_pruned.empty()) {
+      //Finish with the full model
+      unprune();
+      pruning   = false;
+      converged = false;
+    }
+    if (m_checkpoint_file != "" 
+	&& (converged || m_iterations % m_checkpoint_interval == 0)) {
+      save_state(m_checkpoint_file);
+    }
+  }
+
+  //Out of iterations, leave the full model in place
+  if (m_verify_pruning && !m_pruned.empty()) {
+    unprune();
+    converged = HasConverged(iterate()/m_data_nodes, epsilon) && converged;
+  }
+
+  //The records are written in the background, make sure they are all out before returning.
+  m_logger->flush();
+  return converged;
+
+}
+    
+     
+      
+template<class T>
+void
+ICR::EnsembleLearning::Builder<T>::sweep_lanes(const std::vector<Builder<T>*>& lanes,
+					       const std::vector<size_t>& begin,
+					       std::vector<Coster>& costs,
+					       const std::ptrdiff_t b)
+{
+  //Node k of every lane in the block, before node k+1 of any,
+  // so each node of the graph is visited once (its code and its kind shared by the lanes).
+  const size_t nodes = lanes[begin[b]]->m_compiled.size();
+  for(size_t k=0;k<nodes;++k){
+    for(size_t l=begin[b];l<begin[b+1];++l){
+      lanes[l]->sweep_node(k, IterateNode<T>(costs[l]));
+    }
+  }
+}
+
+template<class T>
+std::vector<bool>
+ICR::EnsembleLearning::Builder<T>::run_lanes(const std::vector<Builder<T>*>& lanes,
+					     const double epsilon, 
+					     const size_t max_iterations, 
+					     const size_t skip)
+{
+  std::vector<bool> converged(lanes.size(), false);
+  if (lanes.empty()) 
+    return converged;
+
+  for(size_t l=0;l<lanes.size();++l){
+    lanes[l]->end_concurrent();
+  }
+
+  for(size_t l=0;l<lanes.size();++l){
+    if (lanes[l]->m_Nodes.size() != lanes[0]->m_Nodes.size()
+	|| lanes[l]->m_Factors.size() != lanes[0]->m_Factors.size()
+	|| lanes[l]->m_Factors.size() == 0
+	|| lanes[l]->m_reducer
+	|| lanes[l]->m_synchronous
+	|| lanes[l]->m_acceleration != Acceleration::NONE
+	|| lanes[l]->m_bound_interval > 1
+	|| lanes[l]->m_prune_weight > 0 || lanes[l]->m_prune_precision > 0 || !lanes[l]->m_pruned.empty())
+      throw Exception::IncompatibleLanes();
+  }
+  //(the lanes are swept in the order that each compiles)
+  for(size_t l=0;l<lanes.size();++l){
+    lanes[l]->compile_sweep();
+    if (lanes[l]->m_compiled.size() != lanes[0]->m_compiled.size())
+      throw Exception::IncompatibleLanes();
+  }
+
+  //Warm up each lane just as run() would.
+  size_t flush = skip;
+  if (skip == auto_skip) {
+    for(size_t l=0;l<lanes.size();++l){
+      if (lanes[l]->m_cost_history.empty())
+	lanes[l]->warm_up();
+    }
+    flush = 0;
+  }
+
+  //The lanes still running
+  std::vector<size_t> active(lanes.size());
+  for(size_t l=0;l<lanes.size();++l){
+    active[l] = l;
+  }
+  
+  for(size_t i=0;i<flush + max_iterations && !active.empty();++i){
+    std::vector<Builder<T>*> running(active.size());
+    for(size_t a=0;a<active.size();++a){
+      running[a] = lanes[active[a]];
+      running[a]->refresh_shortlists();
+    }
+    //The lanes share no nodes, so each thread sweeps a block of them.
+    std::vector<size_t> begin;
+    const std::ptrdiff_t blocks = detail::reduction_blocks(running.size());
+    for(std::ptrdiff_t b=0;b<=blocks;++b){
+      begin.push_back(b*running.size()/blocks);
+    }
+    std::vector<Coster> costs(active.size());
+    const std::vector<std::ptrdiff_t> b = detail::indices(blocks);
+    PARALLEL_FOREACH(b.begin(), b.end(), 
+		     boost::bind(&Builder<T>::sweep_lanes, boost::cref(running), boost::cref(begin), boost::ref(costs), _1));
+    
+    std::vector<size_t> still_active;
+    for(size_t a=0;a<active.size();++a){
+      Builder<T>& lane = *lanes[active[a]];
+      ++lane.m_iterations;
+      if (i < flush) {
+	still_active.push_back(active[a]);
+	continue;
+      }
+      converged[active[a]] = lane.HasConverged((costs[a] + lane.m_pruned_cost)/lane.m_data_nodes, epsilon);
+      if (lane.m_checkpoint_file != "" 
+	  && (converged[active[a]] || lane.m_iterations % lane.m_checkpoint_interval == 0)) {
+	lane.save_state(lane.m_checkpoint_file);
+      }
+      if (!converged[active[a]])
+	still_active.push_back(active[a]);
+    }
+    active.swap(still_active);
+  }
+
+  for(size_t l=0;l<lanes.size();++l){
+    lanes[l]->m_logger->flush();
+  }
+  return converged;
+}
+
+template<class T>
+bool
+ICR::EnsembleLearning::Builder<T>::HasConverged(const T Cost, const T epsilon)
+{
+  //Only queue the record, the sinks are written to on another thread.
+  const CostRecord record = {m_iterations, 
+			     Cost, 
+			     100.0*(((Cost-m_PrevCost)/std::fabs(Cost))), 
+			     omp_get_wtime() - m_start_time,
+			     sweep_nodes().size()};
+  m_logger->push(record);
+  m_cost_history.push_back(Cost);
+
+  if (100.0*std::fabs((Cost - m_PrevCost)/Cost)<epsilon) 
+    return true;
+	
+  m_PrevCost = Cost;
+  return false;
+}
+    
+
+
+template<class T>
+const size_t ICR::EnsembleLearning::Builder<T>::auto_skip;
 
 template class ICR::EnsembleLearning::Builder<double>;
 template class ICR::EnsembleLearning::Builder<float>;
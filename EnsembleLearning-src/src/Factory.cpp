@@ -34,7 +34,7 @@ ICR::EnsembleLearning::ExpressionFactory<T>::placeholder()
 {
   typedef boost::shared_ptr<Placeholder<T> > Ptr;
   //create
-  Ptr v(new Placeholder<T>());
+  Ptr v(new Placeholder<T>(m_placeholders++, this));
   //store
   m_Expr.push_back(v);
   //return
@@ -41,7 +41,10 @@ class BuildModel //: public Model<data_t>
   };
   
 public:
-  BuildModel(matrix<double>& data,
+  //Matrix is any row/column indexable matrix with size1() and size2(),
+  //for example a ublas matrix or a (memory mapped) DataMatrix
+  template<class Matrix>
+  BuildModel(const Matrix& data,
 	     size_t assumed_sources,
 	     size_t mixing_components,
 	     const bool positive_sources,
@@ -58,6 +61,7 @@ public:
       m_noisePrecision(data.size1()),
       m_positive_sources(positive_sources),
       m_positive_mixing(positive_mixing),
+      m_noise_offset(noise_offset),
       m_GaussianPrecision(GaussianPrecision),
       m_GammaVar(1.0/GammaPrecision)
   {
@@ -136,9 +140,13 @@ public:
     }
     
     
+    //The data dominates the size of the model, so it is built by all the threads
+    //(with a static schedule the model is the same as if it were built by one).
     matrix<ResultNode> AtimesSplusN(N,T);
+    m_Build.begin_concurrent();
     for(size_t n=0;n<N;++n){ 
-      for(size_t t=0;t<T;++t){ 
+#pragma omp parallel for schedule(static)
+      for(long t=0;t<long(T);++t){ 
     	/**  Now need to replace the placeholders with given nodes 
     	 *   I.e. set up a context to the expression
     	 */
@@ -153,17 +161,21 @@ public:
     	AtimesSplusN(n,t) = m_Build.calc_gaussian(Expr,context);  
       }
     }
+    m_Build.end_concurrent();
     m_AtimesSplusN = AtimesSplusN;
 
 
     std::cout<<"built context - nodes = "<< m_Build.number_of_nodes() <<std::endl;
      
     //join to the data
+    m_Build.begin_concurrent();
     for(size_t n=0;n<N;++n){
-      for(size_t t=0;t<T;++t){
+#pragma omp parallel for schedule(static)
+      for(long t=0;t<long(T);++t){
     	m_Build.join(AtimesSplusN(n,t),m_noisePrecision(n), data(n,t));
       }
     }
+    m_Build.end_concurrent();
 
     std::cout<<"built data - nodes = "<< m_Build.number_of_nodes() <<std::endl;
      
@@ -174,7 +186,8 @@ public:
   vector<Variable>& get_noiseMean(){return m_noiseMean;}
   //vector<Variable>& get_noisePrecision(){return m_noisePrecision;}
   
-  void set_means(matrix<data_t>&Means)
+  template<class Matrix>
+  void set_means(const Matrix& Means)
   {
     //First check that number of rows and columns less than m_S.
 
@@ -214,7 +227,8 @@ public:
     }
   }
 
-  void set_sigmas(matrix<data_t>&SD)
+  template<class Matrix>
+  void set_sigmas(const Matrix& SD)
   {
     std::cout<<"setting Sigmas"<<std::endl;
 
@@ -233,8 +247,10 @@ public:
     //for each row 
     for(size_t m=0;m<SD.size1();++m){
       //set m^th column of A matrix to be the average sd of row.
-      matrix_row<matrix<double> > row(SD,m);
-      double av_sd = std::accumulate(row.begin(), row.end(), 0.0)/row.size();
+      double av_sd = 0;
+      for(size_t t=0;t<SD.size2(); ++t) 
+	av_sd += SD(m,t);
+      av_sd /= SD.size2();
       for(size_t n=0;n<m_A.size1();++n){
 	if (m_positive_mixing) 
 	  ICR::EnsembleLearning::SetStandardDeviation(static_cast<RectifiedGaussianNode>(m_A(n,m)), av_sd);
@@ -255,7 +271,8 @@ public:
     }
   }
 
-  void set_mixing_mean(matrix<data_t>& M)
+  template<class Matrix>
+  void set_mixing_mean(const Matrix& M)
   {
     std::cout<<"setting Mixing"<<std::endl;
 
@@ -291,18 +308,9 @@ public:
 
   void get_normalised_means(matrix<data_t>& A, matrix<data_t>& S)
   {
-    
-    for(size_t i=0;i<m_A.size1();++i){
-      for(size_t j=0; j<m_A.size2();++j){
-	A(i,j)= m_A(i,j)->GetMoments()[0];
-      }
-    }
-
-    for(size_t i=0;i<m_S.size1();++i){
-      for(size_t j=0; j<m_S.size2();++j){
-	S(i,j)= m_S(i,j)->GetMoments()[0];
-      }
-    }
+    //(the matrices are row major, so the means are written straight into their storage)
+    m_Build.extract_posteriors(std::vector<Variable>(m_A.data().begin(), m_A.data().end()), &A.data()[0]);
+    m_Build.extract_posteriors(std::vector<Variable>(m_S.data().begin(), m_S.data().end()), &S.data()[0]);
 
     //normalise
     for(size_t j=0;j<A.size2();++j){
@@ -318,12 +326,33 @@ public:
   matrix<data_t> get_results() const
   {
     matrix<data_t> r(m_AtimesSplusN.size1(), m_AtimesSplusN.size2());
-    for(size_t i=0;i<m_AtimesSplusN.size1();++i){
-      for(size_t j=0; j<m_AtimesSplusN.size2();++j){
-	r(i,j)= m_AtimesSplusN(i,j)->GetMoments()[0];
+    m_Build.extract_posteriors(std::vector<Variable>(m_AtimesSplusN.data().begin(), m_AtimesSplusN.data().end()), &r.data()[0]);
+    return r;
+  }
+
+  //Infer the sources (and the evidence) of new samples (the columns of data) without changing the model.
+  template<class Matrix>
+  void
+  score(const Matrix& data, matrix<data_t>& S, std::vector<data_t>& evidence) const
+  {
+    if (data.size1() != m_A.size1()) {
+      std::cout<<"The samples to score have "<<data.size1()<<" channels rather than "<<m_A.size1()<<std::endl;
+      throw size_exception();
+    }
+    //(a sample at a time)
+    std::vector<data_t> samples(data.size1()*data.size2());
+    for(size_t t=0;t<data.size2();++t){
+      for(size_t n=0;n<data.size1();++n){
+	samples[t*data.size1()+n] = data(n,t);
       }
     }
-    return r;
+    matrix<data_t> sources(data.size2(), m_A.size2());
+    evidence.resize(data.size2());
+    if (m_positive_sources) 
+      score_samples<ICR::EnsembleLearning::RectifiedGaussian>(samples, sources, evidence);
+    else
+      score_samples<ICR::EnsembleLearning::Gaussian>(samples, sources, evidence);
+    S = trans(sources);
   }
 
 private: 
@@ -352,6 +381,22 @@ private:
 						  components));
   }
   
+  //A source is switched off when the precision of its column of the mixing matrix becomes large.
+  void
+  prune_sources(const vector<GammaNode>& APrecision)
+  {
+    for(size_t m=0;m<APrecision.size();++m){
+      std::vector<Variable> nodes;
+      for(size_t n=0;n<m_A.size1();++n){
+	nodes.push_back(m_A(n,m));
+      }
+      for(size_t t=0;t<m_S.size2();++t){
+	nodes.push_back(m_S(m,t));
+      }
+      m_Build.prune_with(APrecision[m], nodes);
+    }
+  }
+
   void
   build_mixing_matrix(Int2Type<false>, size_t N, size_t M)
   {
@@ -365,6 +410,7 @@ private:
 	m_A(n,m) = m_Build.gaussian(AMean[m], APrecision[m]);
       }
     }
+    prune_sources(APrecision);
     std::cout<<"built mixing - nodes = "<< m_Build.number_of_nodes() <<std::endl;
   };
 
@@ -381,11 +427,48 @@ private:
 	m_A(n,m) = m_Build.rectified_gaussian(AMean[m], APrecision[m]);
       }
     }
+    prune_sources(APrecision);
     std::cout<<"built mixing (RG)- nodes = "<< m_Build.number_of_nodes() <<std::endl;
   };
 
 
   
+  void
+  keep_source_mixtures(const vector<WeightsNode>& Weights,
+		       const std::vector< vector<GaussianNode> >& ShypMean,
+		       const std::vector< vector<GammaNode> >& ShypPrec)
+  {
+    m_SourceWeights.assign(Weights.begin(), Weights.end());
+    m_SourceMean.resize(ShypMean.size());
+    m_SourcePrecision.resize(ShypPrec.size());
+    for(size_t m=0;m<ShypMean.size();++m){
+      m_SourceMean[m].assign(ShypMean[m].begin(), ShypMean[m].end());
+      m_SourcePrecision[m].assign(ShypPrec[m].begin(), ShypPrec[m].end());
+    }
+  }
+
+  //Infer the sources of new samples with the rest of the model frozen.
+  template<template<class> class Model>
+  void
+  score_samples(const std::vector<data_t>& samples, matrix<data_t>& sources, std::vector<data_t>& evidence) const
+  {
+    std::vector<ICR::EnsembleLearning::MixtureScorer<Model, data_t> > priors;
+    for(size_t m=0;m<m_SourceWeights.size();++m){
+      priors.push_back(ICR::EnsembleLearning::MixtureScorer<Model, data_t>(m_SourceMean[m], 
+									  m_SourcePrecision[m], 
+									  m_SourceWeights[m]));
+    }
+    std::vector<Variable> noise_mean;
+    if (m_noise_offset) 
+      noise_mean.assign(m_noiseMean.begin(), m_noiseMean.end());
+    ICR::EnsembleLearning::SourceScorer<Model, data_t> Scorer(std::vector<Variable>(m_A.data().begin(), m_A.data().end()),
+							      priors,
+							      std::vector<Variable>(m_noisePrecision.begin(), m_noisePrecision.end()),
+							      noise_mean);
+    if (sources.size1() != 0)
+      Scorer.score(&samples[0], sources.size1(), &sources.data()[0], &evidence[0]);
+  }
+
   void
   build_source_matrix(Int2Type<false>, size_t M, size_t T, size_t Components)
   {
@@ -404,6 +487,7 @@ private:
       build_vector(ShypPrec[m]);
     }
     std::cout<<"built hyperparams - nodes = "<< m_Build.number_of_nodes() <<std::endl;
+    keep_source_mixtures(Weights, ShypMean, ShypPrec);
     
     for(size_t m=0;m<M;++m){ 
       for(size_t t=0;t<T;++t){ 
@@ -435,6 +519,7 @@ private:
       build_vector(ShypPrec[m]);
     }
     std::cout<<"built hyperparams - nodes = "<< m_Build.number_of_nodes() <<std::endl;
+    keep_source_mixtures(Weights, ShypMean, ShypPrec);
     
     for(size_t m=0;m<M;++m){ 
       for(size_t t=0;t<T;++t){ 
@@ -457,7 +542,10 @@ private:
   vector<GaussianNode> m_noiseMean;
   vector<GammaNode>     m_noisePrecision;
   //GammaNode     m_noisePrecision;
-  bool m_positive_mixing, m_positive_sources;
+  //The mixture of each source (kept to score new samples).
+  std::vector<WeightsNode> m_SourceWeights;
+  std::vector<std::vector<Variable> > m_SourceMean, m_SourcePrecision;
+  bool m_positive_mixing, m_positive_sources, m_noise_offset;
   data_t m_GaussianPrecision;
   data_t m_GammaVar;
 
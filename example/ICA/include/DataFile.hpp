@@ -0,0 +1,250 @@
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/numeric/ublas/matrix.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+/* The binary data format is a 24 byte header
+ *    magic "ICADATA" (8 chars including the terminating '\0'),
+ *    rows    (uint64),
+ *    columns (uint64),
+ * followed by rows*columns doubles in row major order (native byte order).
+ * The header keeps the doubles 8 byte aligned so that the file can be used in place once mapped.
+ */
+
+class data_file_exception{};
+
+namespace data_file_detail{
+  const char data_magic[8] = {'I','C','A','D','A','T','A','\0'};
+}
+
+/* A read only matrix of doubles loaded from a data file.
+ * Binary files are memory mapped and read in place, text files are parsed into a single buffer.
+ * The matrix is cheap to copy (the data is shared) and can be transposed without copying,
+ * so that it can be passed straight to BuildModel.
+ */
+class DataMatrix
+{
+public:
+  DataMatrix()
+    : m_rows(0), m_cols(0), m_transposed(false), m_data(0), m_region(), m_buffer()
+  {}
+
+  //Copy a ublas matrix (used for the generated example data).
+  DataMatrix(const boost::numeric::ublas::matrix<double>& M)
+    : m_rows(M.size1()), m_cols(M.size2()), m_transposed(false), m_data(0), m_region(),
+      m_buffer(new std::vector<double>(M.size1()*M.size2()))
+  {
+    for(size_t r=0;r<m_rows;++r){
+      for(size_t c=0;c<m_cols;++c){
+	(*m_buffer)[r*m_cols+c] = M(r,c);
+      }
+    }
+    m_data = m_buffer->empty() ? 0 : &(*m_buffer)[0];
+  }
+
+  size_t size1() const {return m_transposed ? m_cols : m_rows;}
+  size_t size2() const {return m_transposed ? m_rows : m_cols;}
+  bool   empty() const {return m_data == 0;}
+
+  double operator()(size_t r, size_t c) const
+  {
+    return m_transposed ? m_data[c*m_cols + r] : m_data[r*m_cols + c];
+  }
+
+  //swap rows and columns (no data is moved)
+  void transpose() {m_transposed = !m_transposed;}
+
+  //release the mapping/buffer (clear all memory)
+  void clear() {*this = DataMatrix();}
+
+  friend DataMatrix load_binary(const std::string& filename);
+  friend DataMatrix load_text(const std::string& filename);
+
+private:
+  size_t m_rows, m_cols;
+  bool m_transposed;
+  const double* m_data;
+  boost::shared_ptr<boost::interprocess::mapped_region> m_region;
+  boost::shared_ptr<std::vector<double> > m_buffer;
+};
+
+//Is the file in the binary format?
+inline
+bool
+is_binary_data(const std::string& filename)
+{
+  char magic[sizeof(data_file_detail::data_magic)];
+  std::ifstream in(filename.c_str(), std::ios_base::binary);
+  in.read(magic, sizeof(magic));
+  return in && std::memcmp(magic, data_file_detail::data_magic, sizeof(magic)) == 0;
+}
+
+//Map a binary data file into memory.
+inline
+DataMatrix
+load_binary(const std::string& filename)
+{
+  namespace ip = boost::interprocess;
+  DataMatrix M;
+  ip::file_mapping file(filename.c_str(), ip::read_only);
+  M.m_region.reset(new ip::mapped_region(file, ip::read_only));
+
+  const size_t header = sizeof(data_file_detail::data_magic) + 2*sizeof(boost::uint64_t);
+  const char* begin = static_cast<const char*>(M.m_region->get_address());
+  const size_t size = M.m_region->get_size();
+  if (size < header || std::memcmp(begin, data_file_detail::data_magic, sizeof(data_file_detail::data_magic)) != 0) {
+    std::cout<<"The file '"<<filename<<"' is not a binary data file"<<std::endl;
+    throw data_file_exception();
+  }
+  boost::uint64_t rows, cols;
+  std::memcpy(&rows, begin + sizeof(data_file_detail::data_magic), sizeof(rows));
+  std::memcpy(&cols, begin + sizeof(data_file_detail::data_magic) + sizeof(rows), sizeof(cols));
+  if (size - header < rows*cols*sizeof(double)) {
+    std::cout<<"The file '"<<filename<<"' is truncated"<<std::endl;
+    throw data_file_exception();
+  }
+  M.m_rows = rows;
+  M.m_cols = cols;
+  M.m_data = reinterpret_cast<const double*>(begin + header);
+  return M;
+}
+
+namespace data_file_detail{
+  //Parse the numbers in [p, eol) into out (at most max of them), returning how many there were.
+  //Whitespace is skipped by hand so that strtod never looks beyond the end of the line.
+  inline
+  size_t
+  parse_line(const char* p, const char* eol, double* out, size_t max)
+  {
+    size_t count = 0;
+    while(true) {
+      while(p<eol && (*p==' ' || *p=='\t' || *p=='\r' || *p==',')) ++p;
+      if (p>=eol) break;
+      char* next;
+      const double d = std::strtod(p,&next);
+      if (next == p) break; //not a number
+      if (count<max) out[count] = d;
+      ++count;
+      p = next;
+    }
+    return count;
+  }
+
+  //The number of leading blank characters in [p, eol)
+  inline
+  size_t
+  count_blank(const char* p, const char* eol)
+  {
+    const char* q = p;
+    while(q<eol && (*q==' ' || *q=='\t' || *q=='\r')) ++q;
+    return q-p;
+  }
+}
+
+//Parse a whitespace separated text file, one row per line.
+//The file is mapped and the lines are parsed in parallel straight into a single buffer.
+inline
+DataMatrix
+load_text(const std::string& filename)
+{
+  namespace ip = boost::interprocess;
+  DataMatrix M;
+  ip::file_mapping file(filename.c_str(), ip::read_only);
+  ip::mapped_region region(file, ip::read_only);
+  const char* begin = static_cast<const char*>(region.get_address());
+  const char* end   = begin + region.get_size();
+
+  //The start and end of every non-blank line
+  std::vector<const char*> lines, ends;
+  for(const char* p = begin; p<end; ){
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end-p));
+    if (eol == 0) eol = end;
+    if (size_t(eol-p) != data_file_detail::count_blank(p, eol)) {
+      lines.push_back(p);
+      ends.push_back(eol);
+    }
+    p = eol+1;
+  }
+  if (lines.empty()) {
+    std::cout<<"The file '"<<filename<<"' contains no data"<<std::endl;
+    throw data_file_exception();
+  }
+
+  //strtod needs a terminator, which the mapping does not have if the last line has no newline.
+  //In that case parse a copy of that line.
+  std::string last_line;
+  if (ends.back() == end) {
+    last_line.assign(lines.back(), end);
+    lines.back() = last_line.c_str();
+    ends.back()  = last_line.c_str() + last_line.size();
+  }
+
+  const size_t rows = lines.size();
+  const size_t cols = data_file_detail::parse_line(lines[0], ends[0], 0, 0);
+  if (cols == 0) {
+    std::cout<<"The file '"<<filename<<"' does not start with a row of numbers"<<std::endl;
+    throw data_file_exception();
+  }
+  M.m_buffer.reset(new std::vector<double>(rows*cols));
+  std::vector<double>& data = *M.m_buffer;
+  bool ragged = false;
+
+#pragma omp parallel for schedule(static) reduction(||:ragged)
+  for(long r=0;r<long(rows);++r){
+    if (data_file_detail::parse_line(lines[r], ends[r], &data[r*cols], cols) != cols)
+      ragged = true;
+  }
+  if (ragged) {
+    std::cout<<"The rows in '"<<filename<<"' are not all the same length"<<std::endl;
+    throw data_file_exception();
+  }
+
+  M.m_rows = rows;
+  M.m_cols = cols;
+  M.m_data = data.empty() ? 0 : &data[0];
+  return M;
+}
+
+//Load either format.
+inline
+DataMatrix
+load_data(const std::string& filename)
+{
+  if (is_binary_data(filename))
+    return load_binary(filename);
+  return load_text(filename);
+}
+
+//Write a matrix in the binary format.
+template<class Matrix>
+void
+save_binary(const std::string& filename, const Matrix& M)
+{
+  std::ofstream out(filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+  const boost::uint64_t rows = M.size1(), cols = M.size2();
+  out.write(data_file_detail::data_magic, sizeof(data_file_detail::data_magic));
+  out.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+  out.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+  std::vector<double> row(cols);
+  for(size_t r=0;r<rows;++r){
+    for(size_t c=0;c<cols;++c){
+      row[c] = M(r,c);
+    }
+    if (cols != 0)
+      out.write(reinterpret_cast<const char*>(&row[0]), cols*sizeof(double));
+  }
+  if (!out) {
+    std::cout<<"Failed to write '"<<filename<<"'"<<std::endl;
+    throw data_file_exception();
+  }
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Compare the ICA example in float and double precision.
+# The float model stores its messages and moments in float but accumulates 
+# the sums of messages in double.
+# Both run the same (fixed) number of iterations, -c 0 -i 2 (ICA restarts the run 100 times).
+# Reports the run time and the final evidence bound of each, and their relative difference.
+# The nodes are updated asynchronously, one after another on the calling thread,
+# so the threads only matter to the synchronous sweeps (see Builder::set_synchronous).
+# The initial moments are random, so repeat the benchmark before reading much into a small deviation.
+#
+# usage: benchmark_precision.sh [path/to/ICA] [data file] [extra ICA options]
+#   With no data file the generated example data is used.
+
+ICA=${1:-./ICA}
+DATA=${2:-}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+run()
+{
+    NAME=$1
+    FLAG=$2
+    shift 2
+    mkdir -p "$WORK/$NAME"
+    if [ -z "$DATA" ]; then
+	ARGS="--example"
+    else
+	ARGS="$DATA"
+    fi
+    START=$(date +%s.%N)
+    "$ICA" $FLAG -c 0 -i 2 -o "$WORK/$NAME" $ARGS "$@" > "$WORK/$NAME.log" 2>&1
+    END=$(date +%s.%N)
+    TIME=$(awk "BEGIN{print $END - $START}")
+    COST=$(tail -n 1 "$WORK/$NAME/Cost.txt")
+    echo "$NAME $TIME $COST"
+}
+
+D=$(run double "" "$@")
+F=$(run float "-f" "$@")
+
+echo "$D" "$F" | awk '{
+  printf "precision   time(s)    final bound\n";
+  printf "double   %10.3f  %14.8g\n", $2, $3;
+  printf "float    %10.3f  %14.8g\n", $5, $6;
+  printf "speed up %10.3f,  bound deviation %g%%\n", $2/$5, 100*($6-$3)/($3==0?1:$3);
+}'
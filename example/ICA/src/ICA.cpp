@@ -1,5 +1,6 @@
 #include "ExampleData.hpp"
 #include "BuildModel.hpp"
+#include "DataFile.hpp"
 
 #include <boost/program_options.hpp>
 #include "boost/filesystem.hpp"   // includes all needed Boost.Filesystem declarations
@@ -32,12 +33,21 @@ main  (int ac, char **av)
   double GaussianPrecision;
   double GammaPrecision;
   size_t max_iterations;
+  bool   prune = false;
+  bool   synchronous = false;
+  bool   reorder = false;
+  size_t bound_interval;
+  std::string acceleration_method;
+  std::string parallel_backend;
+  ICR::EnsembleLearning::Acceleration::Value acceleration = ICR::EnsembleLearning::Acceleration::NONE;
   
   std::string data_file;
   std::string output_directory;
   std::string mean_file;
   std::string sigma_file;
   std::string mixing_mean_file;
+  std::string binary_file;
+  std::string score_file;
   
   
   //parse the command line
@@ -60,6 +70,10 @@ main  (int ac, char **av)
      "filename containing prior knowledge of the standard-deviations")
     ("mixing-mean", po::value<std::string>(&mixing_mean_file)->default_value(""), 
      "filename containing prior knowledge of the Mixing means")
+    ("write-binary", po::value<std::string>(&binary_file)->default_value(""), 
+     "Write the data to this file in the binary format, which is memory mapped (rather than parsed) when used as an input file")
+    ("score", po::value<std::string>(&score_file)->default_value(""), 
+     "filename containing new samples (with the same channels as the data) whose sources are inferred from the inferred model, without changing it")
     ;
   
   // Hidden options, will be allowed both on command line and
@@ -86,6 +100,18 @@ main  (int ac, char **av)
      "The change in evidence when the model is assumed to have converged")
     ("iterations,i", po::value<size_t>(&max_iterations)->default_value(1000), 
      "The maximum number of interations")
+    ("accelerate", po::value<std::string>(&acceleration_method)->default_value("none"), 
+     "Accelerate the convergence: none, over-relaxation or squarem")
+    ("parallel-backend", po::value<std::string>(&parallel_backend)->default_value("work-stealing"), 
+     "How to run the parallel algorithms: serial, openmp-tasks or work-stealing")
+    ("synchronous", 
+     "Update all the sources at once (split between threads) rather than one after another")
+    ("reorder", 
+     "Update the nodes in an order that keeps neighbouring nodes together")
+    ("bound-interval", po::value<size_t>(&bound_interval)->default_value(1), 
+     "The number of iterations between evaluations of the cost")
+    ("prune", 
+     "Stop updating the sources and mixture components that have been switched off")
     ("Gaussian-precision", po::value<double>(&GaussianPrecision)->default_value(0.01), 
      "The precision of the Gaussian Priors in the model")
     ("Gamma-precision", po::value<double>(&GammaPrecision)->default_value(0.01), 
@@ -146,11 +172,38 @@ main  (int ac, char **av)
     positive_mixing = true;
   if (vm.count("noise-offset")) 
     model_noise_offset = true;
+  if (vm.count("prune")) 
+    prune = true;
+  if (vm.count("synchronous")) 
+    synchronous = true;
+  if (vm.count("reorder")) 
+    reorder = true;
   if (vm.count("transpose-priors")) 
     transpose_priors = true;
   if (vm.count("transpose-mixing")) 
     transpose_mixing = true;
 
+  if (parallel_backend == "serial")
+    ICR::EnsembleLearning::set_parallel_backend(ICR::EnsembleLearning::ParallelBackend::SERIAL);
+  else if (parallel_backend == "openmp-tasks")
+    ICR::EnsembleLearning::set_parallel_backend(ICR::EnsembleLearning::ParallelBackend::OPENMP_TASKS);
+  else if (parallel_backend == "work-stealing")
+    ICR::EnsembleLearning::set_parallel_backend(ICR::EnsembleLearning::ParallelBackend::WORK_STEALING);
+  else {
+    std::cout << "Unknown parallel backend '"<<parallel_backend<<"'\n\n"
+	      << visible  << "\n";
+    return 1;
+  }
+  if (acceleration_method == "over-relaxation")
+    acceleration = ICR::EnsembleLearning::Acceleration::OVER_RELAXATION;
+  else if (acceleration_method == "squarem")
+    acceleration = ICR::EnsembleLearning::Acceleration::SQUAREM;
+  else if (acceleration_method != "none") {
+    std::cout << "Unknown acceleration '"<<acceleration_method<<"'\n\n"
+	      << visible  << "\n";
+    return 1;
+  }
+
 
   if ( !fs::exists(output_directory) ) {
     std::cout << "Output directory '"<<output_directory<<"' does not exist!\n\n"
@@ -159,7 +212,7 @@ main  (int ac, char **av)
   }
 
   //check to see if mean file inputted
-  matrix<double> Means;
+  DataMatrix Means;
   if ( mean_file != "") {
     if (!fs::exists(mean_file))  { //wrong filename
       std::cout << "The file '"<<mean_file<<"' does not exist!\n\n"
@@ -168,46 +221,12 @@ main  (int ac, char **av)
     }
     //load the data.
     std::cout<<"loading means"<<std::endl;
-    std::string line;
-    std::ifstream myfile (mean_file.c_str());
-    std::vector< std::vector<double> > data;
-    while ( getline( myfile, line ) )
-      {
-	std::stringstream ss(line);
-	std::vector<double> v;
-	std::copy( 
-		  std::istream_iterator<double>(ss), 
-		  std::istream_iterator<double>( ),
-		  std::back_inserter(v)
-		   ); // copies all data into bufferdata[i]
-	data.push_back(v);
-      }
+    Means = load_data(mean_file);
     if (transpose_priors)
-      { 
-	const size_t rows = data[0].size();
-	const size_t cols = data.size(); //assume all the same size.
-	Means = matrix<double>(rows,cols);
-	for(size_t r=0;r<Means.size1();++r){
-	  for(size_t c=0;c<Means.size2();++c){
-	    Means(r,c) = data[c][r];
-	  }
-	}
-      }
-    else 
-      {
-	const size_t rows = data.size();
-	const size_t cols = data[0].size(); //assume all the same size.
-      
-	Means = matrix<double>(rows,cols);
-	for(size_t r=0;r<Means.size1();++r){
-	  for(size_t c=0;c<Means.size2();++c){
-	    Means(r,c) = data[r][c];
-	  }
-	}
-      }
+      Means.transpose();
   }
   //check to see if sigma file inputted and exists
-  matrix<double> Sigmas;
+  DataMatrix Sigmas;
   if ( sigma_file != "" ) { 
     if (!fs::exists(sigma_file) ) {//wrong filename
       std::cout << "The file '"<<sigma_file<<"' does not exist!\n\n"
@@ -215,47 +234,14 @@ main  (int ac, char **av)
       return 1;
     }
     //load the data.
-    std::cout<<"loading means"<<std::endl;
-    std::string line;
-    std::ifstream myfile (sigma_file.c_str());
-    std::vector< std::vector<double> > data;
-    while ( getline( myfile, line ) )
-      {
-	std::stringstream ss(line);
-	std::vector<double> v;
-	std::copy( 
-		  std::istream_iterator<double>(ss), 
-		  std::istream_iterator<double>( ),
-		  std::back_inserter(v)
-		   ); // copies all data into bufferdata[i]
-	data.push_back(v);
-      }
+    std::cout<<"loading sigmas"<<std::endl;
+    Sigmas = load_data(sigma_file);
     if (transpose_priors)
-      { 
-	const size_t rows = data[0].size();
-	const size_t cols = data.size(); //assume all the same size.
-	Sigmas = matrix<double>(rows,cols);
-	for(size_t r=0;r<Sigmas.size1();++r){
-	  for(size_t c=0;c<Sigmas.size2();++c){
-	    Sigmas(r,c) = data[c][r];
-	  }
-	}
-      }
-    else 
-      {
-	const size_t rows = data.size();
-	const size_t cols = data[0].size(); //assume all the same size.
-	Sigmas = matrix<double>(rows,cols);
-	for(size_t r=0;r<Sigmas.size1();++r){
-	  for(size_t c=0;c<Sigmas.size2();++c){
-	    Sigmas(r,c) = data[r][c];
-	  }
-	}
-      }
+      Sigmas.transpose();
   }
     
   //check to see if mixing_mean file inputted and exists
-  matrix<double> MixingMean;
+  DataMatrix MixingMean;
   if ( mixing_mean_file != "" ) { 
     if (!fs::exists(mixing_mean_file) ) {//wrong filename
       std::cout << "The file '"<<mixing_mean_file<<"' does not exist!\n\n"
@@ -264,45 +250,24 @@ main  (int ac, char **av)
     }
     //load the data.
     std::cout<<"loading mixing"<<std::endl;
-    std::string line;
-    std::ifstream myfile (mixing_mean_file.c_str());
-    std::vector< std::vector<double> > data;
-    while ( getline( myfile, line ) )
-      {
-	std::stringstream ss(line);
-	std::vector<double> v;
-	std::copy( 
-		  std::istream_iterator<double>(ss), 
-		  std::istream_iterator<double>( ),
-		  std::back_inserter(v)
-		   ); // copies all data into bufferdata[i]
-	data.push_back(v);
-      }
+    MixingMean = load_data(mixing_mean_file);
     if (transpose_mixing)
-      { 
-	const size_t rows = data[0].size();
-	const size_t cols = data.size(); //assume all the same size.
-	MixingMean = matrix<double>(rows,cols);
-	for(size_t r=0;r<MixingMean.size1();++r){
-	  for(size_t c=0;c<MixingMean.size2();++c){
-	    MixingMean(r,c) = data[c][r];
-	  }
-	}
-      }
-    else 
-      {
-	const size_t rows = data.size();
-	const size_t cols = data[0].size(); //assume all the same size.
-	MixingMean = matrix<double>(rows,cols);
-	for(size_t r=0;r<MixingMean.size1();++r){
-	  for(size_t c=0;c<MixingMean.size2();++c){
-	    MixingMean(r,c) = data[r][c];
-	  }
-	}
-      }
+      MixingMean.transpose();
   }
 
-  matrix<double> Data;
+  //check to see if the samples to score exist
+  DataMatrix Samples;
+  if ( score_file != "" ) { 
+    if (!fs::exists(score_file) ) {//wrong filename
+      std::cout << "The file '"<<score_file<<"' does not exist!\n\n"
+		<< visible  << "\n";
+      return 1;
+    }
+    std::cout<<"loading samples to score"<<std::endl;
+    Samples = load_data(score_file);
+  }
+
+  DataMatrix Data;
   if ( !fs::exists(data_file) )
     {
       if (example)
@@ -318,13 +283,14 @@ main  (int ac, char **av)
 	  Sources S(number_of_sources,samples_per_record, positive_source);
 	  Mixing  M(number_of_sources,number_of_records, positive_mixing);
 	  
-	  Data =  prod(M,S);
-	  AddNoise(Data,5000);
+	  matrix<double> Example =  prod(M,S);
+	  AddNoise(Example,5000);
+	  Data = Example;
   
 	  std::ofstream data(data_file.string().c_str());
 	  std::ofstream source(source_file.string().c_str());
 	  std::ofstream mixing(mixing_file.string().c_str());
-	  data<<Data;
+	  data<<Example;
 	  source<<matrix<double>(S);
 	  mixing<<matrix<double>(M);
   
@@ -340,36 +306,17 @@ main  (int ac, char **av)
     {
       //load the data.
       std::cout<<"loading data"<<std::endl;
-
-      std::string line;
-      std::ifstream myfile (data_file.c_str());
-      std::vector< std::vector<double> > data;
-      while ( getline( myfile, line ) )
-	{
-	  std::stringstream ss(line);
-	  std::vector<double> v;
-	  std::copy( 
-	  	    std::istream_iterator<double>(ss), 
-	  	    std::istream_iterator<double>( ),
-	  	    std::back_inserter(v)
-		     ); // copies all data into bufferdata[i]
-	  data.push_back(v);
-	}
-
-      const size_t rows = data.size();
-      const size_t cols = data[0].size(); //assume all the same size.
-      
-      Data = matrix<double>(rows,cols);
-      for(size_t r=0;r<Data.size1();++r){
-	for(size_t c=0;c<Data.size2();++c){
-	  Data(r,c) = data[r][c];
-	}
-      }
+      Data = load_data(data_file);
       std::cout<<"data loaded"<<std::endl;
 
     }
   
 
+  if (binary_file != "") {
+    std::cout<<"writing binary data to "<<binary_file<<std::endl;
+    save_binary(binary_file, Data);
+  }
+
   std::cout<<"output direcotry = "<<output_directory<<std::endl;
   std::cout<<"input file = "<<data_file<<std::endl;
 
@@ -380,6 +327,8 @@ main  (int ac, char **av)
   fs::path cost_file   = fs::path(output_directory)/fs::path("Cost.txt");
   fs::path result_file   = fs::path(output_directory)/fs::path("InferedResult.txt");
   fs::path result_file2   = fs::path(output_directory)/fs::path("InferedResult2.txt");
+  fs::path scored_file   = fs::path(output_directory)/fs::path("ScoredSources.txt");
+  fs::path evidence_file   = fs::path(output_directory)/fs::path("ScoredEvidence.txt");
   
   
   
@@ -394,7 +343,7 @@ main  (int ac, char **av)
 			      GammaPrecision);
       size_t size1 = Data.size1();
       size_t size2 = Data.size2();
-      Data = matrix<float>(); //clear the memory (clear function doesn't do this)
+      Data.clear(); //release the memory (or mapping)
 
       {
 	
@@ -413,6 +362,12 @@ main  (int ac, char **av)
       
       ICR::EnsembleLearning::Builder<float> Build = Model.get_builder();
       Build.set_cost_file(cost_file.string());
+      Build.set_acceleration(acceleration);
+      if (prune)
+	Build.set_pruning();
+      Build.set_synchronous(synchronous);
+      Build.set_reordering(reorder);
+      Build.set_bound_interval(bound_interval);
       std::cout<<"Running!"<<std::endl;
       bool converged = false;
       size_t count = 0;
@@ -433,6 +388,18 @@ main  (int ac, char **av)
       	result_matrix2<< matrix<float>(prod(A,S));
       	++count;
       }
+
+      if (!Samples.empty()) {
+	matrix<float> S;
+	std::vector<float> evidence;
+	Model.score(Samples, S, evidence);
+	std::ofstream scored(scored_file.string().c_str());
+	std::ofstream scored_evidence(evidence_file.string().c_str());
+	scored<<S;
+	for(size_t t=0;t<evidence.size();++t){
+	  scored_evidence<<evidence[t]<<"\n";
+	}
+      }
     }
   else
     {
@@ -446,7 +413,7 @@ main  (int ac, char **av)
 			       );
       size_t size1 = Data.size1();
       size_t size2 = Data.size2();
-      Data = matrix<double>(); //clear the memory (clear function doesn't do this)
+      Data.clear(); //release the memory (or mapping)
 
       if (mean_file !="") 
 	Model.set_means(Means);
@@ -472,6 +439,12 @@ main  (int ac, char **av)
       
       ICR::EnsembleLearning::Builder<double> Build = Model.get_builder();
       Build.set_cost_file(cost_file.string());
+      Build.set_acceleration(acceleration);
+      if (prune)
+	Build.set_pruning();
+      Build.set_synchronous(synchronous);
+      Build.set_reordering(reorder);
+      Build.set_bound_interval(bound_interval);
       std::cout<<"Running!"<<std::endl;
       bool converged = false;
       size_t count = 0;
@@ -492,5 +465,17 @@ main  (int ac, char **av)
       	result_matrix2<< matrix<double>(prod(A,S));
       	++count;
       }
+
+      if (!Samples.empty()) {
+	matrix<double> S;
+	std::vector<double> evidence;
+	Model.score(Samples, S, evidence);
+	std::ofstream scored(scored_file.string().c_str());
+	std::ofstream scored_evidence(evidence_file.string().c_str());
+	scored<<S;
+	for(size_t t=0;t<evidence.size();++t){
+	  scored_evidence<<evidence[t]<<"\n";
+	}
+      }
     }
 }
@@ -0,0 +1,54 @@
+
+#include "EnsembleLearning.hpp"
+#include "EnsembleLearning/distributed/MPIReducer.hpp"
+#include <boost/mpi/environment.hpp>
+#include <vector>
+#include <iostream>
+using namespace ICR::EnsembleLearning;
+
+/* The InferData1 example spread over several processes.
+ * Run with, for example,
+ *   mpirun -np 4 EnsembleLearning-InferDistributedData1
+ */
+int
+main  (int ac, char **av)
+{
+  boost::mpi::environment env(ac, av);
+  boost::shared_ptr<MPIReducer> reducer(new MPIReducer());
+  
+  //Create the data (the same on every process)
+  rng* random = Random::Instance(10); //a random number generator with seed 10.
+  const size_t data_points = 2000; 
+  std::vector<double> data(data_points);
+  for(size_t i = 0; i<data_points; ++i)
+    { 
+      data[i] = random->gaussian(std::sqrt(1.0/10.0), 3);  //mean = 3, precision = 10;
+    }
+ 
+  Builder<double> build;  
+  build.set_reducer(reducer);
+  //only the first process reports the cost
+  build.set_quiet(reducer->rank() != 0);
+
+  typedef Builder<double>::GaussianNode GaussianNode ;   
+  typedef Builder<double>::GammaNode GammaNode; 
+ 
+  //The global nodes are created (in the same order) on every process.
+  GaussianNode mean = build.gaussian(0.00,0.001); 
+  GammaNode    prec = build.gamma(1.0,0.01);     
+ 
+  //Each process models its own share of the data.
+  build.begin_partition();
+  for(size_t i=reducer->rank(); i<data.size(); i+=reducer->size())
+    {
+      build.join(mean,prec,data[i]);  
+    }
+  build.end_partition();
+  
+  build.run(0.01,10);
+ 
+  if (reducer->rank() == 0) {
+    std::cout<<"mean      = "<<Mean(mean)<<"\t +- "<<StandardDeviation(mean)<<std::endl;
+    std::cout<<"precision = "<<Mean(prec)<<"\t +- "<<StandardDeviation(prec)<<std::endl;
+  }
+}